@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_callback_easgd .hpp .cpp - Elastic averaging SGD between models
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LBANN_CALLBACKS_CALLBACK_EASGD_HPP_INCLUDED
+#define LBANN_CALLBACKS_CALLBACK_EASGD_HPP_INCLUDED
+
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include "lbann/callbacks/lbann_callback.hpp"
+#include "lbann/utils/lbann_quantizer.hpp"
+
+namespace lbann {
+
+/**
+ * Elastic averaging SGD (EASGD) between models.
+ * See this paper for full details:
+ * Zhang, Sixin, Anna E. Choromanska, and Yann LeCun. "Deep learning with
+ * elastic averaging SGD." NIPS 2015.
+ * This is synchronous EASGD with period k: every k = period steps each model
+ * is pulled toward a center copy of the weights held by the inter-model
+ * master. With d = alpha * (weights - center), the weights become
+ * weights - d and the center becomes center + (sum of d over all models).
+ * Both the elastic differences (sent to the master) and the new center (sent
+ * from the master) are non-blocking and only completed at the next exchange,
+ * so the center a model is pulled toward is one period stale and models only
+ * wait on each other when one falls more than a period behind.
+ * The master holds one receive buffer per other model for each layer, and is
+ * pulled toward the same broadcast copy of the center as every other model.
+ * The center broadcast can be quantized (see set_center_quantization): the
+ * master then sends only the quantized change in the center since the last
+ * exchange, with the quantization error fed back into the next one, and every
+ * model pulls toward the center as reconstructed from those changes. One-bit
+ * quantized broadcasts are non-blocking like exact ones, but the size of
+ * threshold quantized ones depends on the data, so they are blocking.
+ */
+class lbann_callback_easgd : public lbann_callback {
+public:
+  /**
+   * Do an elastic exchange every period steps with moving rate alpha.
+   * If alpha is 0, it defaults to 0.9 / (number of models).
+   */
+  lbann_callback_easgd(uint period = 1, float alpha = 0.0f,
+                       lbann_summary* _summarizer = nullptr);
+  /** As above, but only for the layers in the layers set. */
+  lbann_callback_easgd(uint period, float alpha,
+                       std::unordered_set<uint> _layers,
+                       lbann_summary* _summarizer = nullptr);
+  /**
+   * Quantize the center broadcast, one-bit if proportion is 0 and otherwise
+   * with adaptive threshold quantization sending one in proportion entries.
+   * Must be called before setup.
+   */
+  void set_center_quantization(int proportion = 0);
+  /** Set up the center variable and buffers. */
+  void setup(model* m);
+  /** Do the elastic exchange every period steps. */
+  void on_batch_end(model* m);
+  /** Complete any outstanding exchange. */
+  void on_train_end(model* m);
+private:
+  /** Pull this model toward the center and start sending the new center. */
+  void exchange(model* m);
+  /**
+   * Wait for the outstanding elastic differences, applying them to the
+   * center, and for the outstanding center broadcast.
+   */
+  void complete_exchange(model* m);
+  /** Return the copy of the center that idx is pulled toward. */
+  inline Mat& get_shared_center(lbann_comm* comm, uint idx) {
+    return am_center_holder(comm) ? shared_centers[idx] : centers[idx];
+  }
+  /** Return true if this process holds the center variable. */
+  inline bool am_center_holder(lbann_comm* comm) const {
+    return comm->get_model_rank() == comm->get_intermodel_master();
+  }
+
+  /** Number of steps between exchanges. */
+  uint period;
+  /** Moving rate. */
+  float alpha;
+  /** Whether an exchange is outstanding. */
+  bool exchange_pending;
+  /** Whether to quantize the center broadcast. */
+  bool quantize_center;
+  /** Proportion for quantizing the center broadcast (0 for one-bit). */
+  int center_proportion;
+  /** Quantizer for the center broadcast. */
+  lbann_quantizer quantizer;
+  /** Per-layer center as last broadcast to other models (master only). */
+  std::unordered_map<uint, Mat> shared_centers;
+  /** Per-layer center broadcast quantization errors (master only). */
+  std::unordered_map<uint, Mat> center_errors;
+  /** Per-layer center variable (a receive buffer on non-masters). */
+  std::unordered_map<uint, Mat> centers;
+  /** Per-layer elastic difference from the last exchange. */
+  std::unordered_map<uint, Mat> diffs;
+  /** Per-layer elastic differences received from other models (master). */
+  std::unordered_map<uint, std::vector<Mat>> recv_diffs;
+  /** Per-layer outstanding elastic difference requests. */
+  std::unordered_map<uint, std::vector<lbann_mpi_req<DataType>>> reqs;
+  /** Per-layer one-bit quantized center broadcast buffers. */
+  std::unordered_map<uint, lbann_quantizer::QuantizedMatrix> quantized_centers;
+  /** Per-layer outstanding exact center broadcast requests. */
+  std::unordered_map<uint, lbann_mpi_req<DataType>> center_reqs;
+  /** Per-layer outstanding one-bit quantized center broadcast requests. */
+  std::unordered_map<uint, lbann_mpi_req<lbann_quantizer::qtype>>
+    quantized_center_reqs;
+  /** Layer indices to exchange. */
+  std::unordered_set<uint> layer_indices;
+};
+
+}  // namespace lbann
+
+#endif  // LBANN_CALLBACKS_CALLBACK_EASGD_HPP_INCLUDED
@@ -42,6 +42,7 @@ namespace lbann {
  * gradient updates.
  * This optionally supports quantizing the gradient updates before communication
  * in order to reduce bandwidth requirements.
+ * Alternately, LOCAL_SGD periodically averages the models' weights instead.
  */
 class lbann_callback_imcomm : public lbann_callback {
 public:
@@ -53,6 +54,10 @@ public:
     COMPRESSED_THRESH_QUANTIZATION,  /** Do compressed thresholded one-bit quantization. */
     ADAPTIVE_THRESH_QUANTIZATION,  /** Do adaptive thresholded one-bit quantization. */
     COMPRESSED_ADAPTIVE_THRESH_QUANTIZATION,  /** Do compressed adaptive thresholded one-bit quantization. */
+    LOCAL_SGD,  /** Periodically average weights instead of summing gradients. */
+    TOPK_SPARSIFICATION,  /** Sum only the largest entries, with error feedback. */
+    QSGD_QUANTIZATION,  /** Do multi-level stochastic quantization. */
+    ADAPTIVE,  /** Choose the method per layer to meet a bytes target. */
   };
   /** Do inter-model gradient updates of the given type. */
   lbann_callback_imcomm(comm_type ct = NONE, lbann_summary* _summarizer = nullptr);
@@ -62,15 +67,122 @@ public:
    */
   lbann_callback_imcomm(comm_type ct, std::unordered_set<uint> _layers,
                         lbann_summary* _summarizer = nullptr);
+  /**
+   * Set parameters for LOCAL_SGD: average weights every averaging_period
+   * steps (and before evaluation and at the end of each epoch), using the
+   * given slow momentum and outer learning rate. With d the difference
+   * between the weights at the last averaging and the average,
+   * u = slow_momentum * u + d and the weights become
+   * (last averaged weights) - outer_lr * u (or
+   * outer_lr * (slow_momentum * u + d) with Nesterov momentum). The defaults
+   * give plain model averaging.
+   */
+  void set_averaging_params(uint averaging_period, float slow_momentum = 0.0f,
+                            float outer_lr = 1.0f, bool nesterov = false);
+  /**
+   * Quantize LOCAL_SGD weight averaging with type: NORMAL (the default, no
+   * quantization), ONEBIT_QUANTIZATION, or ADAPTIVE_THRESH_QUANTIZATION
+   * sending one in proportion of the entries. Each model then sends the
+   * quantized difference of its weights from the last average, feeding the
+   * quantization error into the next average.
+   */
+  void set_averaging_quantization(comm_type type, int proportion = 32);
+  /**
+   * Pack consecutive layers' gradients into buckets of about bucket_bytes for
+   * NORMAL gradient sums, summing each bucket with one collective to avoid
+   * being latency-bound with many small layers (0 sums each layer
+   * separately).
+   */
+  void set_bucket_size(size_t bucket_bytes);
+  /**
+   * Overlap NORMAL gradient sums with backward propagation even when several
+   * models share a node. The comm layer's hierarchical sum is blocking, so
+   * by default those jobs sum after backward propagation; this uses flat
+   * non-blocking sums instead.
+   */
+  void set_overlap_sums(bool overlap);
+  /**
+   * Send one in proportion of each gradient's entries with
+   * TOPK_SPARSIFICATION (default 100).
+   */
+  void set_topk_proportion(int proportion);
+  /** Quantize to bits (2, 4, or 8) per entry with QSGD_QUANTIZATION. */
+  void set_qsgd_bits(int bits);
+  /**
+   * Defer each layer's update until just before its next forward propagation,
+   * completing its NORMAL gradient sum there, so the sums of the first
+   * layers (which start last) overlap with the forward propagation of the
+   * layers before them. This needs per-layer NORMAL sums (setup throws with
+   * other methods or buckets) and implies set_overlap_sums. Callbacks that
+   * run between mini-batches then see weights without the last update;
+   * models do the deferred updates before evaluation and the end of each
+   * epoch.
+   */
+  void set_deferred_updates(bool defer);
+  /** Return the number of layer updates deferred so far. */
+  inline uint64_t get_num_deferred_updates() const {
+    return num_deferred_updates;
+  }
+  /**
+   * Set parameters for ADAPTIVE, which chooses the method per layer to send
+   * about target_bytes (per process, over all layers) each step. For
+   * warmup_steps steps every layer is summed exactly while its sum time and
+   * fraction of zero entries are measured. Then latency-bound layers (or all
+   * layers, if they fit) stay exact and the rest of the target is split among
+   * the other layers by size. Each uses the first of exact sums, one-bit
+   * quantization, or threshold quantization (adaptive for dense gradients,
+   * compressed when few entries are sent) that fits its share, and its
+   * proportion and thresholds are adjusted each step toward the share.
+   * A target_bytes of 0 (the default) aims for an eighth of the bytes exact
+   * sums send.
+   */
+  void set_adaptive_params(size_t target_bytes, uint warmup_steps = 10);
   /** Do initialization for this model. */
   void setup(model* m);
   /** Clear out remaining error if needed. */
   void on_epoch_end(model* m);
-  /** Do inter-model gradient updates. */
+  /** Make progress on outstanding (deferred) gradient sums. */
+  void on_forward_prop_begin(model* m, Layer* l);
+  /** Make progress on outstanding gradient sums. */
+  void on_backward_prop_begin(model* m, Layer* l);
+  /**
+   * Start a non-blocking NORMAL gradient sum for this layer, so it overlaps
+   * with the backward propagation of the layers below it.
+   */
+  void on_backward_prop_end(model* m, Layer* l);
+  /**
+   * Do (or complete) inter-model gradient updates. When several models share
+   * a node, NORMAL sums use the comm layer's blocking hierarchical sum here
+   * instead of non-blocking sums, unless set_overlap_sums is set.
+   */
   void on_backward_prop_end(model* m);
+  /** Do periodic weight averaging. */
+  void on_batch_end(model* m);
+  /** Average weights with LOCAL_SGD, so every model validates the same. */
+  void on_validation_begin(model* m);
+  /** Average weights with LOCAL_SGD, so every model tests the same. */
+  void on_test_begin(model* m);
 private:
   /** Communication type. */
   comm_type ct;
+  /** Number of steps between weight averaging with LOCAL_SGD. */
+  uint averaging_period;
+  /** Slow momentum applied to averaged updates. */
+  float slow_momentum;
+  /** Learning rate applied to averaged updates. */
+  float outer_lr;
+  /** Whether to use Nesterov-style slow momentum. */
+  bool nesterov;
+  /** Quantization for weight averaging with LOCAL_SGD. */
+  comm_type averaging_ct;
+  /** Proportion for adaptive threshold quantized weight averaging. */
+  int averaging_proportion;
+  /** Step of the last weight averaging. */
+  int64_t last_averaging_step;
+  /** Per-layer local weights as of the last weight averaging. */
+  std::unordered_map<uint, Mat> averaged_weights;
+  /** Per-layer slow momentum. */
+  std::unordered_map<uint, Mat> slow_momenta;
   /** Quantizer for quantization of updates, if needed. */
   lbann_quantizer quantizer;
   /** Per-layer quantization errors. */
@@ -79,16 +191,130 @@ private:
   std::unordered_map<uint, Mat> im_quantization_errors;
   /** Per-layer gradient history when using one-bit quantization. */
   std::unordered_map<uint, Mat> gradhistories;
+  /** Proportion of entries TOPK_SPARSIFICATION sends. */
+  int topk_proportion;
+  /** Bits per entry QSGD_QUANTIZATION quantizes to. */
+  int qsgd_bits;
   /** Layers indicies to quantize. */
   std::unordered_set<uint> layer_indices;
+  /** Per-layer requests for non-blocking gradient sums. */
+  std::unordered_map<uint, lbann_mpi_req<DataType>> sum_reqs;
+  /** Per-layer packed copies of non-contiguous gradients being summed. */
+  std::unordered_map<uint, std::vector<DataType>> sum_bufs;
+  /** Layers with a non-blocking gradient sum that has not been waited on. */
+  std::vector<Layer*> pending_sums;
+  /** Whether to defer layer updates until the next forward propagation. */
+  bool defer_updates;
+  /** Number of layer updates deferred so far. */
+  uint64_t num_deferred_updates;
+  /** Whether to use non-blocking sums even with hierarchical sums. */
+  bool overlap_sums;
+  /** Bytes of gradients to pack into each bucket (0 = no bucketing). */
+  size_t bucket_bytes;
+  /** Several layers' gradients packed into one buffer and summed together. */
+  struct gradient_bucket {
+    /** Layers in the bucket. */
+    std::vector<Layer*> layers;
+    /** Local gradient matrices of those layers. */
+    std::vector<Mat*> mats;
+    /** Packed gradients (kept between steps to avoid reallocating). */
+    std::vector<DataType> buf;
+    /** Request for the bucket's sum. */
+    lbann_mpi_req<DataType> req;
+    /** Bytes of gradients in the bucket. */
+    size_t bytes = 0;
+  };
+  /** Gradient buckets; the first num_started_buckets have been started. */
+  std::vector<gradient_bucket> buckets;
+  /** Number of buckets started this step. */
+  size_t num_started_buckets;
+  /** Bytes per step ADAPTIVE aims to send (0 = automatic). */
+  size_t target_bytes;
+  /** Steps ADAPTIVE measures layers before choosing methods. */
+  uint warmup_steps;
+  /** Steps ADAPTIVE has done. */
+  uint adaptive_steps;
+  /** The method and parameters ADAPTIVE uses for a layer. */
+  struct adaptive_policy {
+    /** Method for the layer's sums (NORMAL while warming up). */
+    comm_type ct = NORMAL;
+    /** Proportion for adaptive threshold quantization. */
+    int proportion = 0;
+    /** Thresholds for threshold quantization. */
+    DataType pos_thresh = 0.0f;
+    DataType neg_thresh = 0.0f;
+    /** Bytes per step this layer aims to send. */
+    double budget = 0.0;
+    /** Bytes an exact sum of this layer sends. */
+    double full_bytes = 0.0;
+    /** Total warm-up sum time. */
+    double time = 0.0;
+    /** Total warm-up fraction of zero gradient entries. */
+    double zeros = 0.0;
+  };
+  /** Per-layer ADAPTIVE policies. */
+  std::unordered_map<uint, adaptive_policy> policies;
 
+  /** Return true if gradient updates should be done on this step. */
+  bool do_gradient_updates(model* m) const;
+  /**
+   * Return true if NORMAL sums are started during backward propagation with
+   * non-blocking sums, rather than with blocking hierarchical sums after it.
+   */
+  bool overlaps_sums(lbann_comm* comm) const;
+  /** Poll outstanding gradient sums so they progress. */
+  void progress_sums(lbann_comm* comm);
+  /** Wait for layer's non-blocking gradient sum and summarize it. */
+  void complete_sum(model* m, Layer* layer);
+  /** Start summing the current bucket, if it has anything in it. */
+  void start_bucket(lbann_comm* comm);
+  /** Complete every started bucket's sum and unpack it. */
+  void complete_buckets(model* m);
+  /** Sum every layer's gradient with the hierarchical algorithm. */
+  void hierarchical_sum_gradients(model* m);
+  /**
+   * Sum the gradient of the lth layer (WB_D) with comm type type, using
+   * proportion and thresholds where applicable.
+   */
+  void sum_gradient(lbann_comm* comm, ElMat& WB_D, size_t l, comm_type type,
+                    int proportion, DataType pos_thresh, DataType neg_thresh);
+  /** Sum every layer's gradient for ADAPTIVE, measuring and adapting. */
+  void adaptive_sum_gradients(model* m);
+  /** Choose each layer's ADAPTIVE policy at the end of the warm-up. */
+  void choose_policies(model* m);
+  /** Adjust an ADAPTIVE policy given the bytes it sent this step. */
+  void adjust_policy(adaptive_policy& policy, double bytes);
+  /**
+   * Summarize communication statistics for a layer's gradient update, which
+   * used comm type type.
+   */
+  void summarize_update(model* m, Layer* layer, double im_time,
+                        comm_type type);
+
+  /** Average weights across models. */
+  void average_weights(model* m);
+  /** Return true if averaged updates need the previous weights. */
+  inline bool uses_outer_update() const {
+    return slow_momentum != 0.0f || outer_lr != 1.0f;
+  }
+  /** Return true if weight averaging needs the previous average. */
+  inline bool keeps_averaged_weights() const {
+    return uses_outer_update() || averaging_ct != NORMAL;
+  }
   /** Return true if the comm type does quantization. */
   inline bool ct_does_quantization() const {
+    return does_quantization(ct);
+  }
+  /** Return true if comm type ct does quantization. */
+  static inline bool does_quantization(comm_type ct) {
     return (ct == ONEBIT_QUANTIZATION ||
             ct == THRESH_QUANTIZATION ||
             ct == COMPRESSED_THRESH_QUANTIZATION ||
             ct == ADAPTIVE_THRESH_QUANTIZATION ||
-            ct == COMPRESSED_ADAPTIVE_THRESH_QUANTIZATION);
+            ct == COMPRESSED_ADAPTIVE_THRESH_QUANTIZATION ||
+            ct == TOPK_SPARSIFICATION ||
+            ct == QSGD_QUANTIZATION ||
+            ct == ADAPTIVE);
   }
 };
 
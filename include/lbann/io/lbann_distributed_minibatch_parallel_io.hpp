@@ -40,7 +40,8 @@ namespace lbann
     distributed_minibatch_parallel_io(lbann_comm* comm, int num_parallel_readers, uint mini_batch_size, std::map<execution_mode, DataReader*> data_readers);
 
     int fetch_to_local_matrix(Mat& M_local);
-    void distribute_from_local_matrix(Mat& M_local, CircMat& Ms);
+    /** Distribute the current root's mini-batch; return its number of samples. */
+    int distribute_from_local_matrix(Mat& M_local, CircMat& Ms);
     bool is_data_set_processed();
     int get_num_parallel_readers();
 
@@ -61,6 +62,7 @@ namespace lbann
     int m_local_reader_done;
     uint m_mini_batch_size; /** Size of the mini-batch */
     bool m_local_data_valid; /** Has the layer copied valid data into the local matrix */
+    int m_local_num_samples; /** Number of samples in the local matrix */
 
     long m_num_data_per_epoch;
   };
@@ -37,6 +37,7 @@
 #include "lbann/optimizers/lbann_optimizer_sgd.hpp"
 #include "lbann/optimizers/lbann_optimizer_adagrad.hpp"
 #include "lbann/optimizers/lbann_optimizer_rmsprop.hpp"
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -55,6 +56,22 @@ class regularizer;
     virtual DataType forwardProp(DataType prev_WBL2NormSum);
     virtual void backProp();
     virtual bool update() { return false; };
+    /**
+     * Defer the layer's update until complete_pending_update, which calls
+     * wait first. Models call it just before the layer's next forward
+     * propagation, so the gradient's inter-model sum (completed by wait)
+     * overlaps with the forward propagation of the layers before this one.
+     */
+    void defer_update(std::function<void()> wait);
+    /** Return true if the layer has a deferred update. */
+    inline bool has_pending_update() const {
+      return static_cast<bool>(m_pending_update_wait);
+    }
+    /**
+     * Do the layer's deferred update, if any. This must be done in training
+     * mode, since layers only apply updates then.
+     */
+    void complete_pending_update();
     virtual void summarize(lbann_summary& summarizer, int64_t step);
     /**
      * Print information at the end of an epoch.
@@ -73,6 +90,22 @@ class regularizer;
 
     virtual void setup(int);
 
+    /** Set the layer's execution mode. */
+    virtual void set_execution_mode(execution_mode mode) {
+      m_execution_mode = mode;
+    }
+
+    /**
+     * Fold a per-neuron affine transform of this layer's output,
+     * y -> scale .* y + shift, into the layer's weights and biases.
+     * scale and shift have one entry per neuron. This is only possible when
+     * the layer has no nonlinearity; return false if it is not supported.
+     */
+    virtual bool fold_output_affine(const std::vector<DataType>& scale,
+                                    const std::vector<DataType>& shift) {
+      return false;
+    }
+
     /** Return the index of this layer. */
     inline uint get_index() const { return Index; }
     /** Return (a view of) the weights/biases matrix for this layer. */
@@ -81,6 +114,14 @@ class regularizer;
     virtual ElMat& get_weights_biases_gradient() { return *WB_D; }
     /** Return (a view of) the activations matrix for this layer. */
     virtual ElMat& get_activations() { return *Acts; }
+    /**
+     * Get the shape of the block of WB holding the layer's weights (as opposed
+     * to its biases). The block starts at the top-left corner of WB.
+     */
+    virtual void get_weights_shape(El::Int& height, El::Int& width) const {
+      height = WB->Height();
+      width = WB->Width();
+    }
     /** Return the layer's optimizer. */
     virtual Optimizer* get_optimizer() const { return optimizer; }
     /** Reset layer stat counters. */
@@ -106,6 +147,18 @@ class regularizer;
     virtual void set_effective_minibatch_size(uint size) {
       m_effective_mbsize = size;
     }
+    /**
+     * Return the number of samples in the current mini-batch. This is less
+     * than the mini-batch size for a partial last mini-batch, whose remaining
+     * columns are padding.
+     */
+    virtual uint get_cur_minibatch_size() const {
+      return m_cur_mbsize;
+    }
+    /** Set the number of samples in the current mini-batch to size. */
+    virtual void set_cur_minibatch_size(uint size) {
+      m_cur_mbsize = size;
+    }
 
     ElMat *fp_output();
     ElMat *bp_output();
@@ -164,11 +217,15 @@ class regularizer;
     uint m_mini_batch_size;
     /** "Effective" mini-batch size for backward propagation, etc.. */
     uint m_effective_mbsize;
+    /** Number of samples in the current mini-batch. */
+    uint m_cur_mbsize;
 
     /** Time spent in forward propagation. */
     double fp_time;
     /** Time spent in backward propagation. */
     double bp_time;
+    /** Wait to call before the deferred update (empty if none). */
+    std::function<void()> m_pending_update_wait;
   };
 }
 
@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_layer_batch_normalization .hpp .cpp - Batch normalization layer
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LBANN_LAYER_BATCH_NORMALIZATION_HPP_INCLUDED
+#define LBANN_LAYER_BATCH_NORMALIZATION_HPP_INCLUDED
+
+#include <vector>
+#include "lbann/lbann_base.hpp"
+#include "lbann/layers/lbann_layer.hpp"
+
+namespace lbann
+{
+
+  /// Batch normalization layer
+  /**
+   * See this paper for full details:
+   * Ioffe, Sergey, and Christian Szegedy. "Batch normalization: Accelerating
+   * deep network training by reducing internal covariate shift." ICML 2015.
+   * Each channel is normalized to zero mean and unit variance over the
+   * mini-batch (and, for convolutional outputs, over the channel's spatial
+   * positions), then scaled by gamma and shifted by beta. The per-channel sums
+   * needed for the mean and variance are reduced with a single allreduce, as
+   * are the gamma and beta gradients in backprop.
+   * Outside of training, running averages of the statistics are used. In
+   * prediction mode, or after fold(), they are folded into the weights of the
+   * layer given at construction (normally the preceding layer, which must have
+   * no nonlinearity), and this layer becomes a copy; the original weights are
+   * restored when training resumes.
+   * WB holds gamma in its first column and beta in its second (STAR,STAR), so
+   * the optimizer must be created for matrix_format::STAR_STAR.
+   */
+  class batch_normalization : public Layer
+  {
+
+  public:
+
+    /// Constructor
+    /**
+     * @param num_neurons Number of neurons (same as the previous layer)
+     * @param num_channels Number of channels sharing statistics; the
+     * neurons of each channel must be contiguous. Use num_neurons for
+     * per-neuron statistics.
+     * @param format Distribution of the activations; either
+     * matrix_format::MC_MR (fully-connected layers) or
+     * matrix_format::STAR_VC (convolutional and pooling layers)
+     * @param fold_layer Layer to fold the statistics into in prediction
+     * mode; NULL disables folding
+     * @param decay Decay rate of the running statistics
+     * @param epsilon Added to the variance for stability
+     */
+    batch_normalization(uint index,
+                        int num_neurons,
+                        int num_channels,
+                        uint mini_batch_size,
+                        activation_type activation,
+                        matrix_format format,
+                        lbann_comm* comm,
+                        Optimizer* optimizer,
+                        Layer* fold_layer=NULL,
+                        DataType decay=0.9,
+                        DataType epsilon=1e-5);
+
+    /// Destructor
+    ~batch_normalization();
+
+    void setup(int num_prev_neurons);
+
+    bool update();
+
+    void set_execution_mode(execution_mode mode);
+
+    /// Fold the running statistics into the fold layer's weights
+    /** This is only for validation, testing and exporting the model: it
+     *  throws in training mode, where the fold layer's weights are being
+     *  updated. Returns false if there is no fold layer or it does not
+     *  support folding, in which case the statistics are still applied here.
+     */
+    bool fold();
+    /// Whether the statistics are folded into the fold layer
+    bool is_folded() const { return m_folded; }
+
+  protected:
+
+    void fp_linearity(ElMat& _WB, ElMat& _X, ElMat& _Z, ElMat& _Y);
+    void bp_linearity();
+
+  private:
+
+    /// Number of samples in the current mini-batch (at least 1)
+    Int get_num_samples() const;
+    /// Number of local columns of X that are samples, not padding
+    Int get_local_samples(const ElMat& X) const;
+    /// Normalize local entries of X into Z
+    void fp_local(const ElMat& X, ElMat& Z);
+    /// Compute gradients from local entries of X and Ds
+    void bp_local(const ElMat& X);
+    /// Restore m_fold_layer's weights
+    void unfold();
+
+    /// Activation distribution
+    const matrix_format m_format;
+    /// Number of channels
+    const int m_num_channels;
+    /// Number of neurons in each channel
+    const int m_channel_size;
+    /// Decay rate of the running statistics
+    const DataType m_decay;
+    /// Added to the variance for numerical stability
+    const DataType m_epsilon;
+
+    /// Mean of each channel in the current mini-batch
+    std::vector<DataType> m_mean;
+    /// Inverse standard deviation of each channel in the current mini-batch
+    std::vector<DataType> m_inv_stdev;
+    /// Running mean of each channel
+    std::vector<DataType> m_running_mean;
+    /// Running variance of each channel
+    std::vector<DataType> m_running_var;
+    /// Local sums for the fused allreduce (2 * m_num_channels)
+    std::vector<double> m_local_sums;
+    /// Global sums from the fused allreduce (2 * m_num_channels)
+    std::vector<double> m_global_sums;
+    /// Channel of each local row of the activations (-1 for the bias row)
+    std::vector<int> m_local_channels;
+
+    /// Layer the statistics are folded into in prediction mode
+    Layer* m_fold_layer;
+    /// Whether the statistics are currently folded into m_fold_layer
+    bool m_folded;
+    /// Local weights of m_fold_layer before folding
+    Mat m_fold_backup;
+
+  };
+
+}
+
+#endif // LBANN_LAYER_BATCH_NORMALIZATION_HPP_INCLUDED
@@ -65,6 +65,19 @@ namespace lbann
 
     bool update();
 
+    /// Fold an affine transform into the filters and biases
+    /** The scale and shift must be constant within each output channel;
+     *  otherwise nothing is folded and this returns false.
+     */
+    bool fold_output_affine(const std::vector<DataType>& scale,
+                            const std::vector<DataType>& shift);
+
+    /// Filters are stored above the biases in WB
+    void get_weights_shape(El::Int& height, El::Int& width) const {
+      height = m_filter_size;
+      width = 1;
+    }
+
   protected:
     
     void fp_linearity(ElMat& _WB, ElMat& _X, ElMat& _Z, ElMat& _Y);
@@ -55,7 +55,13 @@ namespace lbann
       DistMat& get_weights_biases() { return WB_view; }
       DistMat& get_weights_biases_gradient() { return WB_D_view; }
       DistMat& get_activations() { return Acts_view; }
+      void get_weights_shape(El::Int& height, El::Int& width) const {
+        height = NumNeurons;
+        width = WB->Width() - 1;
+      }
       bool update();
+      bool fold_output_affine(const std::vector<DataType>& scale,
+                              const std::vector<DataType>& shift);
       DataType checkGradient(Layer& PrevLayer, const DataType Epsilon=1e-4);
       DataType computeCost(DistMat &deltas);
       DataType WBL2norm();
@@ -50,6 +50,10 @@ namespace lbann
                    Optimizer *optimizer);
         void setup(int numPrevNeurons);
         bool update();
+      void get_weights_shape(El::Int& height, El::Int& width) const {
+        height = NumNeurons;
+        width = WB->Width() - 1;
+      }
       void summarize(lbann_summary& summarizer, int64_t step);
       void epoch_print() const;
       void epoch_reset();
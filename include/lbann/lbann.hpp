@@ -43,6 +43,7 @@
 #include "lbann/layers/lbann_layer_softmax.hpp"
 #include "lbann/layers/lbann_layer_convolutional.hpp"
 #include "lbann/layers/lbann_layer_pooling.hpp"
+#include "lbann/layers/lbann_layer_batch_normalization.hpp"
 
 /// I/O Layers
 #include "lbann/layers/lbann_input_layer_distributed_minibatch.hpp"
@@ -62,6 +63,8 @@
 
 /// Regularizers
 #include "lbann/regularization/lbann_dropout.hpp"
+#include "lbann/regularization/lbann_dropconnect.hpp"
+#include "lbann/regularization/lbann_l2_regularization.hpp"
 
 /// Utilities, exceptions, etc.
 #include "lbann/utils/lbann_exception.hpp"
@@ -30,7 +30,13 @@
 #define LBANN_COMM_HPP_INCLUDED
 
 #include <vector>
+#include <list>
+#include <map>
+#include <algorithm>
+#include <tuple>
 #include "lbann_base.hpp"
+#include "lbann/utils/lbann_comm_profiler.hpp"
+#include "lbann/utils/lbann_timer.hpp"
 using namespace El;
 
 namespace lbann
@@ -43,6 +49,10 @@ using lbann_mpi_req = mpi::Request<T>;
 template <typename T>
 using lbann_mpi_req = mpi::Request;
 #endif  // EL_NEW_MPI_REQUEST
+/** Handle to a persistent request owned by lbann_comm. */
+typedef MPI_Request* lbann_persistent_req;
+/** Handle to a message matched by lbann_comm::probe_var. */
+typedef MPI_Message lbann_matched_msg;
 
   /**
    * Manage communication.
@@ -98,26 +108,80 @@ using lbann_mpi_req = mpi::Request;
     /** Return the rank of this process within its compute node. */
     inline int get_rank_in_node() const { return rank_in_node; }
 
-    /** Perform a sum reduction of mat over the inter-model communicator. */
+    /**
+     * Perform a sum reduction of mat over the inter-model communicator.
+     * When several models share a compute node, this uses the hierarchical
+     * algorithm (see hierarchical_sum_matrix) by default.
+     */
     void intermodel_sum_matrix(Mat& mat);
     void intermodel_sum_matrix(DistMat& mat);
-    /** Non-blocking intermodel_sum_matrix. */
-    //void nb_intermodel_sum_matrix(Mat& mat, mpi::Request& req);
-    //void nb_intermodel_sum_matrix(DistMat& mat, mpi::Request& req);
+    /**
+     * Non-blocking intermodel_sum_matrix. The sum is done in-place, so mat must
+     * not be touched until req completes. mat must be contiguous; sum views
+     * with LDim != Height with nb_intermodel_sum_matrices instead.
+     */
+    void nb_intermodel_sum_matrix(Mat& mat, lbann_mpi_req<DataType>& req);
+    void nb_intermodel_sum_matrix(DistMat& mat, lbann_mpi_req<DataType>& req);
+    /**
+     * Sum several local matrices over the inter-model communicator, packing
+     * consecutive matrices into contiguous buckets of at most bucket_bytes and
+     * reducing each bucket with one collective. A matrix larger than a bucket
+     * is reduced on its own.
+     */
+    void intermodel_sum_matrices(const std::vector<Mat*>& mats,
+                                 size_t bucket_bytes);
+    /**
+     * Pack mats into buf and start a non-blocking sum of buf over the
+     * inter-model communicator. Once req completes, unpack_matrices copies the
+     * sums back into mats. buf is only grown, so it can be reused.
+     */
+    void nb_intermodel_sum_matrices(const std::vector<Mat*>& mats,
+                                    std::vector<DataType>& buf,
+                                    lbann_mpi_req<DataType>& req);
+    /** Copy the matrices packed in buf back out to mats. */
+    void unpack_matrices(const std::vector<Mat*>& mats,
+                         const std::vector<DataType>& buf);
+    /**
+     * Sum mat over the inter-model communicator in three phases: a reduce-
+     * scatter among the models on this node through shared memory, an
+     * allreduce of each shard among its owners on every node, and an
+     * allgather among the models on this node through shared memory.
+     * Requires hierarchical sums to be available.
+     */
+    void hierarchical_sum_matrix(Mat& mat);
+    /**
+     * Return true if the hierarchical sum can be used, i.e. several models
+     * share a node and every node has the same number of models.
+     */
+    inline bool hierarchical_sum_available() const {
+      return hierarchical_available;
+    }
+    /** Return true if intermodel sums use the hierarchical algorithm. */
+    inline bool uses_hierarchical_sum() const { return hierarchical_sum; }
+    /** Enable or disable the hierarchical algorithm, if it is available. */
+    inline void set_hierarchical_sum(bool enable) {
+      hierarchical_sum = enable && hierarchical_available;
+    }
     /** Broadcast mat over the inter-model communicator starting from root. */
     void intermodel_broadcast_matrix(Mat& mat, int root);
     void intermodel_broadcast_matrix(DistMat& mat, int root);
-    /** Non-blocking intermodel_broadcast_matrix. */
-    //void nb_intermodel_broadcast_matrix(Mat& mat, int root, mpi::Request& req);
-    //void nb_intermodel_broadcast_matrix(DistMat& mat, int root,
-    //                                    mpi::Request& req);
+    /**
+     * Non-blocking intermodel_broadcast_matrix. mat must be contiguous and
+     * must not be touched until req completes.
+     */
+    void nb_intermodel_broadcast_matrix(Mat& mat, int root,
+                                        lbann_mpi_req<DataType>& req);
+    void nb_intermodel_broadcast_matrix(DistMat& mat, int root,
+                                        lbann_mpi_req<DataType>& req);
     /**
      * Inter-model broadcast, returns the broadcast value.
      * Root process specifies root and val, other processes just root.
      */
     template <typename T>
     T intermodel_broadcast(int root, T val = {}) {
+      double start = profile_start();
       mpi::Broadcast(&val, 1, root, intermodel_comm);
+      profile_end("intermodel_broadcast", sizeof(T), start);
       if (get_rank_in_model() == root) {
         bytes_sent += sizeof(T);
       } else {
@@ -125,13 +189,41 @@ using lbann_mpi_req = mpi::Request;
       }
       return val;
     }
+    /** Inter-model scalar-array broadcast of count T's at data from root. */
+    template <typename T>
+    void intermodel_broadcast(T* data, int count, int root) {
+      double start = profile_start();
+      mpi::Broadcast(data, count, root, intermodel_comm);
+      profile_end("intermodel_broadcast", sizeof(T) * count, start);
+      if (get_model_rank() == root) {
+        bytes_sent += sizeof(T) * count;
+      } else {
+        bytes_received += sizeof(T) * count;
+      }
+    }
+    /** Non-blocking inter-model scalar-array broadcast. */
+    template <typename T>
+    void nb_intermodel_broadcast(T* data, int count, int root,
+                                 lbann_mpi_req<T>& req) {
+      double start = profile_start();
+      MPI_Ibcast(data, count, mpi::TypeMap<T>(), root, intermodel_comm.comm,
+                 raw_request(req));
+      profile_end("nb_intermodel_broadcast", sizeof(T) * count, start);
+      if (get_model_rank() == root) {
+        bytes_sent += sizeof(T) * count;
+      } else {
+        bytes_received += sizeof(T) * count;
+      }
+    }
     /**
      * Within-model broadcast, returns the broadcast value.
      * Root process specifies root and val, other processes just root.
      */
     template <typename T>
     T model_broadcast(int root, T val = {}) {
+      double start = profile_start();
       mpi::Broadcast(&val, 1, root, model_comm);
+      profile_end("model_broadcast", sizeof(T), start);
       if (get_rank_in_model() == root) {
         bytes_sent += sizeof(T);
       } else {
@@ -143,39 +235,51 @@ using lbann_mpi_req = mpi::Request;
     template <typename T>
     void intermodel_gather(T send, int root) {
       bytes_sent += sizeof(T);
+      double start = profile_start();
       mpi::Gather(&send, 1, (T*) NULL, 0, root, intermodel_comm);
+      profile_end("intermodel_gather", sizeof(T), start);
     }
     /** Inter-model gather (for root processes). */
     template <typename T>
     void intermodel_gather(T send, std::vector<T>& recv) {
+      double start = profile_start();
       mpi::Gather(&send, 1, recv.data(), 1, get_model_rank(),
                   intermodel_comm);
+      profile_end("intermodel_gather", sizeof(T), start);
       bytes_received += sizeof(T) * (get_num_models() - 1);
     }
     /** Inter-model scalar-array gather (for non-root processes). */
     template <typename T>
     void intermodel_gather(T* send, int count, int root) {
       bytes_sent += sizeof(T) * count;
+      double start = profile_start();
       mpi::Gather(send, count, (T*) NULL, 0, root, intermodel_comm);
+      profile_end("intermodel_gather", sizeof(T) * count, start);
     }
     /** Inter-model scalar-array gather (for root processes). */
     template <typename T>
     void intermodel_gather(T* send, int count, T* recv) {
+      double start = profile_start();
       mpi::Gather(send, count, recv, count, get_model_rank(), intermodel_comm);
+      profile_end("intermodel_gather", sizeof(T) * count, start);
       bytes_received += sizeof(T) * count * (get_num_models() - 1);
     }
     /** Inter-model reduce (for non-root processes). */
     template <typename T>
     void intermodel_reduce(T send, int root, mpi::Op op = mpi::SUM) {
       bytes_sent += sizeof(T);
+      double start = profile_start();
       mpi::Reduce(&send, (T*) NULL, 0, op, root, intermodel_comm);
+      profile_end("intermodel_reduce", sizeof(T), start);
     }
     /** Inter-model reduce (for root processes). */
     template <typename T>
     T intermodel_reduce(T send, mpi::Op op = mpi::SUM) {
       T val;
+      double start = profile_start();
       mpi::Reduce(&send, &val, 1, op, get_model_rank(),
                   intermodel_comm);
+      profile_end("intermodel_reduce", sizeof(T), start);
       bytes_received += sizeof(T) * (get_num_models() - 1);
       return val;
     }
@@ -183,13 +287,17 @@ using lbann_mpi_req = mpi::Request;
     template <typename T>
     void model_reduce(T send, int root, mpi::Op op = mpi::SUM) {
       bytes_sent += sizeof(T);
+      double start = profile_start();
       mpi::Reduce(&send, (T*) NULL, 1, op, root, model_comm);
+      profile_end("model_reduce", sizeof(T), start);
     }
     /** Within-model reduce (for root processes). */
     template <typename T>
     T model_reduce(T send, mpi::Op op = mpi::SUM) {
       T val;
+      double start = profile_start();
       mpi::Reduce(&send, &val, 1, op, get_rank_in_model(), model_comm);
+      profile_end("model_reduce", sizeof(T), start);
       bytes_received += sizeof(T) * (get_procs_per_model() - 1);
       return val;
     }
@@ -197,12 +305,16 @@ using lbann_mpi_req = mpi::Request;
     template <typename T>
     void model_reduce(T* send, int count, int root, mpi::Op op = mpi::SUM) {
       bytes_sent += sizeof(T) * count;
+      double start = profile_start();
       mpi::Reduce(send, (T*) NULL, count, op, root, model_comm);
+      profile_end("model_reduce", sizeof(T) * count, start);
     }
     /** Within-model scalar array reduce (for root processes). */
     template <typename T>
     void model_reduce(T* send, int count, T* recv, mpi::Op op = mpi::SUM) {
+      double start = profile_start();
       mpi::Reduce(send, recv, count, op, get_rank_in_model(), model_comm);
+      profile_end("model_reduce", sizeof(T) * count, start);
       bytes_received += sizeof(T) * count * (get_procs_per_model() - 1);
     }
     /** Within-model all-reduce. */
@@ -210,7 +322,9 @@ using lbann_mpi_req = mpi::Request;
     T model_allreduce(T send, mpi::Op op = mpi::SUM) {
       T val;
       bytes_sent += sizeof(T);
+      double start = profile_start();
       mpi::AllReduce(&send, &val, 1, op, model_comm);
+      profile_end("model_allreduce", sizeof(T), start);
       bytes_received += sizeof(T) * (get_procs_per_model() - 1);
       return val;
     }
@@ -218,16 +332,88 @@ using lbann_mpi_req = mpi::Request;
     template <typename T>
     void model_allreduce(T* send, int count, T* recv, mpi::Op op = mpi::SUM) {
       bytes_sent += count * sizeof(T);
+      double start = profile_start();
       mpi::AllReduce(send, recv, count, op, model_comm);
+      profile_end("model_allreduce", sizeof(T) * count, start);
       bytes_received += count * sizeof(T) * (get_procs_per_model() - 1);
     }
 
     /** Wait for a non-blocking request to complete. */
     template <typename T>
     void wait(lbann_mpi_req<T>& req) {
+      double start = profile_start();
       mpi::Wait(req);
+      profile_wait("wait", start);
+    }
+    /**
+     * Test whether a non-blocking request has completed. This also drives
+     * progress on the request, so it can be polled between computations.
+     */
+    template <typename T>
+    bool test(lbann_mpi_req<T>& req) {
+      return mpi::Test(req);
     }
 
+    /**
+     * Return a buffer of at least count T's for (owner, slot) from a pool that
+     * persists across calls, so fixed-shape exchanges do not allocate in the
+     * steady state. Growing a buffer frees any persistent requests on it.
+     */
+    template <typename T>
+    T* get_pooled_buffer(const void* owner, int slot, size_t count) {
+      std::vector<uint64_t>& buf = buffer_pool[std::make_pair(owner, slot)];
+      const size_t words = (count * sizeof(T) + sizeof(uint64_t) - 1) /
+        sizeof(uint64_t);
+      if (buf.size() < words) {
+        free_persistent_requests(buf.data(), buf.size() * sizeof(uint64_t));
+        buf.resize(words);
+      }
+      return reinterpret_cast<T*>(buf.data());
+    }
+    /**
+     * Free every pooled buffer of owner and the persistent requests on them.
+     * Call this before owner is freed: the pool is keyed by address, so it
+     * would otherwise keep growing and a later owner at the same address
+     * would inherit stale buffers.
+     */
+    void release_pooled_buffers(const void* owner) {
+      release_pooled_buffers(owner, 1);
+    }
+    /** As above, for every owner in [buf, buf + bytes), e.g. views of buf. */
+    void release_pooled_buffers(const void* buf, size_t bytes);
+    /**
+     * Start a persistent send of count T's from data to the process with the
+     * same rank in model. The request is set up with MPI_Send_init on first
+     * use and restarted on later calls with the same buffer, count and
+     * destination, so data should be stable (e.g. a pooled buffer).
+     * Complete with wait_persistent.
+     */
+    template <typename T>
+    lbann_persistent_req persistent_send(const T* data, int count, int model) {
+      bytes_sent += sizeof(T) * count;
+      double start = profile_start();
+      lbann_persistent_req req = start_persistent(
+        data, count, sizeof(T), mpi::TypeMap<T>(),
+        get_world_rank(model, rank_in_model), true);
+      profile_end("persistent_send", sizeof(T) * count, start);
+      return req;
+    }
+    /** Persistent receive counterpart of persistent_send. */
+    template <typename T>
+    lbann_persistent_req persistent_recv(T* data, int count, int model) {
+      bytes_received += sizeof(T) * count;
+      double start = profile_start();
+      lbann_persistent_req req = start_persistent(
+        data, count, sizeof(T), mpi::TypeMap<T>(),
+        get_world_rank(model, rank_in_model), false);
+      profile_end("persistent_recv", sizeof(T) * count, start);
+      return req;
+    }
+    /** Wait for a persistent request to complete (it stays allocated). */
+    void wait_persistent(lbann_persistent_req req);
+    /** Free every persistent request. */
+    void free_persistent_requests();
+
     /** Barrier among the inter-model processes. */
     void intermodel_barrier();
     /** Barrier among processes in this model. */
@@ -239,7 +425,9 @@ using lbann_mpi_req = mpi::Request;
     template <typename T>
     void send(const T* data, int count, int model, int rank) {
       bytes_sent += sizeof(T) * count;
+      double start = profile_start();
       mpi::Send(data, count, get_world_rank(model, rank), mpi::COMM_WORLD);
+      profile_end("send", sizeof(T) * count, start);
     }
     template <typename T> void send(const T* data, int count, int model) {
       send(data, count, model, rank_in_model);
@@ -254,7 +442,9 @@ using lbann_mpi_req = mpi::Request;
     void nb_send(const T* data, int count, int model, int rank,
                  lbann_mpi_req<T>& req) {
       bytes_sent += sizeof(T) * count;
+      double start = profile_start();
       mpi::ISend(data, count, get_world_rank(model, rank), mpi::COMM_WORLD, req);
+      profile_end("nb_send", sizeof(T) * count, start);
     }
     template <typename T> void nb_send(const T* data, int count, int model,
                                        lbann_mpi_req<T>& req) {
@@ -271,7 +461,9 @@ using lbann_mpi_req = mpi::Request;
 
     /** Corresponding receive to send. */
     template <typename T> void recv(T* data, int count, int model, int rank) {
+      double start = profile_start();
       mpi::Recv(data, count, get_world_rank(model, rank), mpi::COMM_WORLD);
+      profile_end("recv", sizeof(T) * count, start);
       bytes_received += sizeof(T) * count;
     }
     template <typename T> void recv(T* data, int count, int model) {
@@ -283,7 +475,9 @@ using lbann_mpi_req = mpi::Request;
     void recv(DistMat& mat, int model) { recv(mat, model, rank_in_model); }
     /** As above, but receive from anyone. */
     template <typename T> void recv(T* data, int count) {
+      double start = profile_start();
       mpi::Recv(data, count, mpi::ANY_SOURCE, mpi::COMM_WORLD);
+      profile_end("recv", sizeof(T) * count, start);
       bytes_received += sizeof(T) * count;
     }
     void recv(Mat& mat);
@@ -292,13 +486,15 @@ using lbann_mpi_req = mpi::Request;
     /** Corresponding non-blocking receives. */
     template <typename T> void nb_recv(T* data, int count, int model, int rank,
                                        lbann_mpi_req<T>& req) {
+      double start = profile_start();
       mpi::IRecv(data, count, get_world_rank(model, rank), mpi::COMM_WORLD,
                  req);
+      profile_end("nb_recv", sizeof(T) * count, start);
       bytes_received += sizeof(T) * count;
     }
     template <typename T> void nb_recv(T* data, int count, int model,
                                        lbann_mpi_req<T>& req) {
-      recv(data, count, model, rank_in_model, req);
+      nb_recv(data, count, model, rank_in_model, req);
     }
     void nb_recv(Mat& mat, int model, int rank, lbann_mpi_req<DataType>& req);
     void nb_recv(DistMat& mat, int model, int rank, lbann_mpi_req<DataType>& req);
@@ -309,13 +505,19 @@ using lbann_mpi_req = mpi::Request;
       nb_recv(mat, model, rank_in_model, req);
     }
     template <typename T> void nb_recv(T* data, int count, lbann_mpi_req<T>& req) {
+      double start = profile_start();
       mpi::IRecv(data, count, mpi::ANY_SOURCE, mpi::COMM_WORLD, req);
+      profile_end("nb_recv", sizeof(T) * count, start);
       bytes_received += sizeof(T) * count;
     }
     void nb_recv(Mat& mat, lbann_mpi_req<DataType>& req);
     void nb_recv(DistMat& mat, lbann_mpi_req<DataType>& req);
 
-    /** Determine the size (count) of an incoming message. */
+    /**
+     * Determine the size (count) of an incoming message.
+     * This probes for any message on the world communicator, so it may match a
+     * different message than the next receive; prefer probe_var.
+     */
     template <typename T> int get_count(int model, int rank) {
       MPI_Status status;
       MPI_Probe(get_world_rank(model, rank), MPI_ANY_TAG, MPI_COMM_WORLD, &status);
@@ -324,30 +526,86 @@ using lbann_mpi_req = mpi::Request;
     template <typename T>
     int get_count(int model) { return get_count<T>(model, rank_in_model); }
 
+    /**
+     * Send a message whose size the receiver does not know to the process with
+     * the same rank in model, to be received with probe_var and recv_var.
+     * These use a dedicated communicator; tag separates concurrent exchanges.
+     */
+    template <typename T>
+    void nb_send_var(const T* data, int count, int model, int tag,
+                     lbann_mpi_req<T>& req) {
+      bytes_sent += sizeof(T) * count;
+      double start = profile_start();
+      mpi::TaggedISend(data, count, model, tag, var_intermodel_comm, req);
+      profile_end("nb_send_var", sizeof(T) * count, start);
+    }
+    /**
+     * Match the next message with tag from model sent with nb_send_var and
+     * return its count. Only recv_var with msg receives the matched message,
+     * so concurrent exchanges cannot receive each other's messages.
+     */
+    template <typename T>
+    int probe_var(int model, int tag, lbann_matched_msg& msg) {
+      MPI_Status status;
+      double start = profile_start();
+      MPI_Mprobe(model, tag, var_intermodel_comm.comm, &msg, &status);
+      profile_end("probe_var", 0, start);
+      return mpi::GetCount<T>(status);
+    }
+    /** Receive the message msg matched by probe_var. */
+    template <typename T>
+    void recv_var(T* data, int count, lbann_matched_msg& msg) {
+      double start = profile_start();
+      MPI_Mrecv(data, count, mpi::TypeMap<T>(), &msg, MPI_STATUS_IGNORE);
+      profile_end("recv_var", sizeof(T) * count, start);
+      bytes_received += sizeof(T) * count;
+    }
+
     /**
      * Broadcast data to the ranks in dests, beginning from root.
-     * @todo Can probably optimize this.
+     * The communicator for each (root, dests) set is cached (see
+     * get_bcast_comm). Broadcasts larger than two chunks are pipelined along a
+     * chain of the processes in chunks of the broadcast chunk size.
      */
     template <typename T>
     void broadcast(T* data, int count, std::vector<int>& dests, int root) {
-      mpi::Group bcast_group;
-      mpi::Comm bcast_comm;
-      std::vector<int> ranks;
-      ranks.push_back(root);
-      ranks.insert(ranks.end(), dests.begin(), dests.end());
-      create_group(ranks, bcast_group);
-      // Elemental doesn't expose this, so we have to reach into its internals.
-      // This lets us create a communicator without involving all of COMM_WORLD.
-      // Use a tag of 0; should not matter unless we're multi-threaded.
-      MPI_Comm_create_group(mpi::COMM_WORLD.comm, bcast_group.group, 0,
-                            &(bcast_comm.comm));
+      double start = profile_start();
+      mpi::Comm bcast_comm = get_bcast_comm(dests, root);
       int translated_root = mpi::Translate(mpi::COMM_WORLD, root, bcast_comm);
-      mpi::Broadcast(data, count, translated_root, bcast_comm);
-      mpi::Free(bcast_comm);
-      mpi::Free(bcast_group);
+      const int chunk_count = std::max(
+        bcast_chunk_bytes / sizeof(T), (size_t) 1);
+      if (count > 2 * chunk_count && mpi::Size(bcast_comm) > 2) {
+        pipelined_broadcast(data, count, translated_root, bcast_comm,
+                            chunk_count);
+      } else {
+        mpi::Broadcast(data, count, translated_root, bcast_comm);
+      }
+      profile_end("broadcast", sizeof(T) * count, start);
     }
     void broadcast(Mat& mat, std::vector<int>& dests, int root);
     void broadcast(DistMat& mat, std::vector<int>& dests, int root);
+    /**
+     * Return the communicator over root and dests, creating it if it is not
+     * cached. Creating it is collective over root and dests, so a process
+     * must miss the cache whenever the other processes in the set do. This
+     * holds when every process in the set uses the same sequence of
+     * broadcasts, or when the cache is large enough to hold every set a
+     * process uses; otherwise, use clear_bcast_comm_cache collectively.
+     * The least recently used communicator is freed when the cache is full.
+     */
+    mpi::Comm get_bcast_comm(const std::vector<int>& dests, int root);
+    /** Free every cached broadcast communicator. */
+    void clear_bcast_comm_cache();
+    /** Set the maximum number of cached broadcast communicators (>= 1). */
+    void set_bcast_comm_cache_size(size_t size);
+    /** Return the number of cached broadcast communicators. */
+    inline size_t get_num_cached_bcast_comms() const {
+      return bcast_comms.size();
+    }
+    /** Set the chunk size (in bytes) for pipelined broadcasts. */
+    inline void set_bcast_chunk_bytes(size_t bytes) {
+      bcast_chunk_bytes = bytes;
+    }
 
     // Statistics methods.
     /** Return the number of model barriers performed. */
@@ -360,20 +618,56 @@ using lbann_mpi_req = mpi::Request;
     inline size_t get_bytes_sent() const { return bytes_sent; }
     /** Return the number of bytes received. */
     inline size_t get_bytes_received() const { return bytes_received; }
+    /**
+     * Enable profiling of the communication primitives (see
+     * lbann_comm_profiler). If json_prefix is not empty, each process writes
+     * its profile to json_prefix.<world rank>.json when this is destroyed.
+     */
+    void enable_profiling(const std::string& json_prefix = "");
+    /** Return the profiler, or nullptr if profiling is not enabled. */
+    inline lbann_comm_profiler* get_profiler() { return profiler; }
+    /** Return the time spent in the intra-node reduce-scatter phase. */
+    inline double get_hier_rs_time() const { return hier_rs_time; }
+    /** Return the time spent in the inter-node allreduce phase. */
+    inline double get_hier_ar_time() const { return hier_ar_time; }
+    /** Return the time spent in the intra-node allgather phase. */
+    inline double get_hier_ag_time() const { return hier_ag_time; }
     inline void reset_stats_counters() {
       num_model_barriers = 0;
       num_intermodel_barriers = 0;
       num_global_barriers = 0;
       bytes_sent = 0;
       bytes_received = 0;
+      hier_rs_time = 0.0;
+      hier_ar_time = 0.0;
+      hier_ag_time = 0.0;
     }
   private:
     /** Communicator for every process in this model. */
     mpi::Comm model_comm;
     /** Communicator for every process with the same model rank. */
     mpi::Comm intermodel_comm;
+    /** Duplicate of intermodel_comm for variable-size messages. */
+    mpi::Comm var_intermodel_comm;
     /** Communicator for every process in the same compute node. */
     mpi::Comm node_comm;
+    /** Communicator for processes with the same model rank on this node. */
+    mpi::Comm intermodel_node_comm;
+    /**
+     * Communicator for processes with the same model rank and the same rank in
+     * intermodel_node_comm, one per node.
+     */
+    mpi::Comm intermodel_shard_comm;
+    /** Whether the hierarchical sum can be used. */
+    bool hierarchical_available;
+    /** Whether intermodel sums use the hierarchical algorithm. */
+    bool hierarchical_sum;
+    /** Shared-memory window over intermodel_node_comm for hierarchical sums. */
+    MPI_Win sum_win;
+    /** Each node-local process's segment of sum_win. */
+    std::vector<DataType*> sum_win_segments;
+    /** Number of entries in each segment of sum_win. */
+    size_t sum_win_count;
     /** Grid for this model. */
     Grid* grid;
     /** Number of models. */
@@ -395,8 +689,60 @@ using lbann_mpi_req = mpi::Request;
     size_t num_global_barriers;
     size_t bytes_sent;
     size_t bytes_received;
+    double hier_rs_time;
+    double hier_ar_time;
+    double hier_ag_time;
 
-    /** MPI tag for point-to-point communication. (Unused) */
+    /** Profiler for communication primitives, if enabled. */
+    lbann_comm_profiler* profiler;
+    /** Prefix of the per-process JSON profile files (empty to not write). */
+    std::string profile_json_prefix;
+    /** Return the start time of a profiled call (0 if not profiling). */
+    inline double profile_start() const {
+      return profiler != nullptr ? get_time() : 0.0;
+    }
+    /** Record a call to primitive that started at start. */
+    inline void profile_end(const char* primitive, size_t bytes,
+                            double start) {
+      if (profiler != nullptr) {
+        profiler->record(primitive, bytes, get_time() - start);
+      }
+    }
+    /** Record a wait on a non-blocking call that started at start. */
+    inline void profile_wait(const char* primitive, double start) {
+      if (profiler != nullptr) {
+        profiler->record_wait(primitive, get_time() - start);
+      }
+    }
+    /** Packing buffer for intermodel_sum_matrices. */
+    std::vector<DataType> sum_bucket;
+    /** Buffer pool for get_pooled_buffer, by owner and slot. */
+    std::map<std::pair<const void*, int>, std::vector<uint64_t>> buffer_pool;
+    /** Identifies a persistent request by what it transfers. */
+    struct persistent_key {
+      const void* data;
+      int count;
+      int peer;
+      bool send;
+      bool operator<(const persistent_key& other) const {
+        return std::tie(data, count, peer, send) <
+          std::tie(other.data, other.count, other.peer, other.send);
+      }
+    };
+    /** Persistent requests (see persistent_send). */
+    std::map<persistent_key, MPI_Request> persistent_reqs;
+    /** Cached broadcast communicators, most recently used first. */
+    std::list<std::pair<std::vector<int>, mpi::Comm>> bcast_comms;
+    /** Index of bcast_comms by root followed by the sorted destinations. */
+    std::map<std::vector<int>,
+             std::list<std::pair<std::vector<int>, mpi::Comm>>::iterator>
+      bcast_comm_index;
+    /** Maximum number of cached broadcast communicators. */
+    size_t bcast_comm_cache_size;
+    /** Chunk size (in bytes) for pipelined broadcasts. */
+    size_t bcast_chunk_bytes;
+
+    /** MPI tag for point-to-point communication with persistent requests. */
     static const int PT2PT_TAG = 42;
     /** Create a new group from a list of ranks. (Needs to be freed.) */
     inline void create_group(std::vector<int>& ranks, mpi::Group& g) {
@@ -405,13 +751,74 @@ using lbann_mpi_req = mpi::Request;
       mpi::Incl(world_group, (int) ranks.size(), ranks.data(), g);
     }
 
+    /**
+     * Broadcast data in chunks of chunk_count along the chain root, root + 1,
+     * ... (mod the size of comm). Each process forwards a chunk while it
+     * receives the next, so large broadcasts do not serialize on one message.
+     */
+    template <typename T>
+    void pipelined_broadcast(T* data, int count, int root, mpi::Comm comm,
+                             int chunk_count) {
+      const int size = mpi::Size(comm);
+      const int rank = mpi::Rank(comm);
+      const int pos = (rank - root + size) % size;
+      const int prev = (rank - 1 + size) % size;
+      const int next = (rank + 1) % size;
+      const int num_chunks = (count + chunk_count - 1) / chunk_count;
+      std::vector<lbann_mpi_req<T>> reqs(pos == size - 1 ? 0 : num_chunks);
+      for (int chunk = 0; chunk < num_chunks; ++chunk) {
+        T* chunk_data = data + chunk * chunk_count;
+        const int n = std::min(chunk_count, count - chunk * chunk_count);
+        if (pos != 0) {
+          mpi::Recv(chunk_data, n, prev, comm);
+        }
+        if (pos != size - 1) {
+          mpi::ISend((const T*) chunk_data, n, next, comm, reqs[chunk]);
+        }
+      }
+      for (lbann_mpi_req<T>& req : reqs) {
+        mpi::Wait(req);
+      }
+    }
+
     /** Setup communicator for processes in the same compute node.
      *  We obtain a string specifying the compute node. The string is
      *  hashed (with salt) and used to split the communicators. To
      *  avoid hash collisions, the splitting procedure is repeated
      *  with a different salt. */
     void setup_node_comm();
-    
+    /**
+     * Setup communicators for the hierarchical sum and decide whether it is
+     * used by default.
+     */
+    void setup_hierarchical_comms();
+    /**
+     * Return the MPI_Request in req. This reaches into the Elemental internals
+     * where mpi::Request is either a typedef of MPI_Request or wraps one in its
+     * backend member.
+     */
+    template <typename T>
+    static MPI_Request* raw_request(lbann_mpi_req<T>& req) {
+#ifdef EL_NEW_MPI_REQUEST
+      return &(req.backend);
+#else
+      return &req;
+#endif
+    }
+    /** Start (setting up if needed) a persistent request. */
+    lbann_persistent_req start_persistent(const void* data, int count,
+                                          size_t type_size, MPI_Datatype type,
+                                          int peer, bool send);
+    /**
+     * Free persistent requests on data in [buf, buf + bytes), e.g. before the
+     * buffer is reallocated.
+     */
+    void free_persistent_requests(const void* buf, size_t bytes);
+    /** Ensure sum_win has segments of at least count entries. */
+    void ensure_sum_window(size_t count);
+    /** Make writes to sum_win visible to the other processes on this node. */
+    void sync_sum_window();
+
   };
 }
 
@@ -105,6 +105,33 @@ namespace lbann
 
     /// Type of intermodel communication to use, if any.
     int IntermodelCommMethod;
+    /// Number of steps between weight averaging with local SGD.
+    int IntermodelAveragingPeriod;
+    /// Slow momentum for weight averaging with local SGD.
+    float IntermodelSlowMomentum;
+    /// Size in MB of buckets for packing intermodel gradient sums (0 = off).
+    float IntermodelBucketMB;
+    /// Defer layer updates so gradient sums overlap the next forward pass.
+    bool IntermodelDeferUpdates;
+    /// Overlap gradient sums with backprop even if models share a node.
+    bool IntermodelOverlapSums;
+    /// Send one in this many gradient entries with top-k sparsification.
+    int IntermodelTopKProportion;
+    /// Bits per entry (2, 4, or 8) for QSGD quantization.
+    int IntermodelQSGDBits;
+    /// Bytes per step adaptive communication aims to send (0 = automatic).
+    int IntermodelTargetBytes;
+    /// Steps adaptive communication measures layers before choosing methods.
+    int IntermodelWarmupSteps;
+    /// Number of steps between elastic averaging (EASGD) exchanges (0 = off).
+    int EASGDPeriod;
+    /// EASGD moving rate (0 = 0.9 / number of models).
+    float EASGDAlpha;
+    /// Weight averaging/EASGD center quantization (-1 = off, 0 = one-bit,
+    /// N = adaptive threshold quantization sending one in N entries).
+    int WeightQuantization;
+    /// Prefix for per-process communication profiles (empty = no profiling).
+    std::string CommProfile;
     /// Number of processes to use in each model (if using multiple).
     int ProcsPerModel;
   };
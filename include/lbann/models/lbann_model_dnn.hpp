@@ -70,6 +70,14 @@ namespace lbann
     /// Evaluation step on one mini-batch
     bool evaluate_mini_batch(long *num_samples, long *num_errors);
 
+    /// Fold batch normalization statistics into the preceding layers
+    /** This makes evaluation cheaper; training again restores the original
+     *  weights. It is only for validation, testing and export (e.g. after
+     *  evaluate()), and throws in training mode. Returns the number of batch
+     *  normalization layers folded.
+     */
+    int fold_batch_normalization();
+
     /// Get train accuracy
     /** Classification accuracy over the last training epoch
      */
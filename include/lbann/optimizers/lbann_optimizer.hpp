@@ -42,7 +42,7 @@ namespace lbann
 {
   class Optimizer {
   public:
-    Optimizer() {}
+    Optimizer() : weight_decay(0), decay_height(0), decay_width(0) {}
     virtual ~Optimizer() {}
     // virtual Optimizer *create_optimizer() {};
     virtual void setup(int input_dims, int num_neurons) {}
@@ -51,6 +51,20 @@ namespace lbann
     virtual float get_learning_rate() const { return 0.0f; }
     /** Set the optimizer's learning rate. */
     virtual void set_learning_rate(float _lr) {}
+    /**
+     * Set the L2 weight decay applied in update_weight_bias_matrix.
+     * The gradient used for each entry of the top-left height x width block of
+     * WB (the weights, not the biases) is WB_D + lambda * WB. This is applied
+     * inside the optimizer's update loop, so it needs no extra pass over WB.
+     */
+    virtual void set_weight_decay(DataType lambda, El::Int height,
+                                  El::Int width) {
+      weight_decay = lambda;
+      decay_height = height;
+      decay_width = width;
+    }
+    /** Get the current L2 weight decay. */
+    virtual DataType get_weight_decay() const { return weight_decay; }
     virtual bool saveToCheckpoint(int fd, const char* filename, uint64_t* bytes) {
       return false;
     }
@@ -64,7 +78,35 @@ namespace lbann
       return false;
     }
 
-  public:
+  protected:
+    /**
+     * Compute how many of WB's local rows and columns fall in the weight decay
+     * block. Local indices are increasing in global index, so the block is a
+     * leading local_height x local_width block of the local matrix.
+     */
+    void get_local_decay_block(const ElMat& WB, El::Int& local_height,
+                               El::Int& local_width) const {
+      local_height = 0;
+      local_width = 0;
+      if (weight_decay == DataType(0)) {
+        return;
+      }
+      while (local_height < WB.LocalHeight() &&
+             WB.GlobalRow(local_height) < decay_height) {
+        ++local_height;
+      }
+      while (local_width < WB.LocalWidth() &&
+             WB.GlobalCol(local_width) < decay_width) {
+        ++local_width;
+      }
+    }
+
+    /** L2 weight decay coefficient. */
+    DataType weight_decay;
+    /** Height of the block of WB that weight decay applies to. */
+    El::Int decay_height;
+    /** Width of the block of WB that weight decay applies to. */
+    El::Int decay_width;
   };
 
   class Optimizer_factory {
@@ -50,8 +50,6 @@ namespace lbann
 
     lbann_comm* comm;
     _DistMat     WB_D_Cache;     // Cache of Weights and Bias Gradient (current time t - 1)
-    _DistMat     WB_D_Temp;      // Temporary for Weights and Bias Gradient computation
-    _DistMat     WB_D_Temp2;     // Temporary for Weights and Bias Gradient computation
 
   private:
     static inline DataType _sq(DataType x) { return (x * x); }
@@ -62,9 +60,7 @@ namespace lbann
     /// Constructor
     Adagrad(lbann_comm* comm, float lr, float epsilon)
       : lr(lr), epsilon(epsilon), comm(comm),
-        WB_D_Cache(comm->get_model_grid()),
-        WB_D_Temp(comm->get_model_grid()),
-        WB_D_Temp2(comm->get_model_grid()) {
+        WB_D_Cache(comm->get_model_grid()) {
       if (comm->am_model_master()) {
         printf("Initializing Adagrad optimizer with lr=%f and epsilon=%f\n", lr, epsilon);
       }
@@ -73,8 +69,6 @@ namespace lbann
     /// Destructor
     ~Adagrad() {
       WB_D_Cache.Empty();
-      WB_D_Temp.Empty();
-      WB_D_Temp2.Empty();
     }
 
     /// Setup optimizer
@@ -83,28 +77,39 @@ namespace lbann
         printf("Setting up Adagrad optimizer with cache size %d x %d\n", num_neurons, input_dim);
       }
       Zeros(WB_D_Cache, num_neurons, input_dim);
-      Zeros(WB_D_Temp, num_neurons, input_dim);
-      Zeros(WB_D_Temp2, num_neurons, input_dim);  
       if (comm->am_model_master()) {
         printf("Setting up Adagrad optimizer with WB_D_Cache size %d x %d\n", WB_D_Cache.Height(), WB_D_Cache.Width());  
       }
     }
     
     void update_weight_bias_matrix(ElMat& WB_D, ElMat& WB) {
-      Copy(WB_D, WB_D_Temp);
-      // Square each entry of the WB_D matrix
-      EntrywiseMap(WB_D_Temp, std::function<DataType(DataType)>(_sq));
-      // Add squared value to WB_D_Cache
-      Axpy(1., WB_D_Temp, WB_D_Cache);
-
-      Copy(WB_D_Cache, WB_D_Temp);
-      // Compute the inverse of the square root of the historical gradient (with a small perturbation)
-      EntrywiseMap(WB_D_Temp, std::function<DataType(DataType)>(_sqrt));
-      Copy(WB_D, WB_D_Temp2);
-      Hadamard(WB_D_Temp2, WB_D_Temp, WB_D);
-
-      //    WBL2NormSum = 0.0;
-      Axpy((DataType)-lr, WB_D, WB);
+      // Fused update over the local entries. WB, WB_D, and the cache share a
+      // distribution, so their local matrices line up.
+      const Int local_height = WB.LocalHeight();
+      const Int local_width = WB.LocalWidth();
+      Int decay_local_height, decay_local_width;
+      get_local_decay_block(WB, decay_local_height, decay_local_width);
+      DataType* __restrict__ wb_buf = WB.Buffer();
+      const Int wb_ldim = WB.LDim();
+      const DataType* __restrict__ wb_d_buf = WB_D.LockedBuffer();
+      const Int wb_d_ldim = WB_D.LDim();
+      DataType* __restrict__ cache_buf = WB_D_Cache.Buffer();
+      const Int cache_ldim = WB_D_Cache.LDim();
+      for (Int col = 0; col < local_width; ++col) {
+        const DataType col_decay = col < decay_local_width ? weight_decay : 0;
+        for (Int row = 0; row < local_height; ++row) {
+          const DataType w = wb_buf[row + col * wb_ldim];
+          const DataType lambda = row < decay_local_height ? col_decay : 0;
+          // Gradient including L2 weight decay.
+          const DataType g = wb_d_buf[row + col * wb_d_ldim] + lambda * w;
+          // Add squared gradient to the historical gradient.
+          DataType& cache = cache_buf[row + col * cache_ldim];
+          cache += _sq(g);
+          // Scale by the inverse of the square root of the historical gradient
+          // (with a small perturbation).
+          wb_buf[row + col * wb_ldim] = w - lr * g * _sqrt(cache);
+        }
+      }
     }
 
     float get_learning_rate() const { return lr; }
@@ -54,20 +54,17 @@ namespace lbann
   private:
     long iterations; // BVE FIXME how do we save / checkpoint this
     _DistMat velocity;
-    _DistMat nesterov_ag; // Nesterov Accelerated Gradient term (scratch space only -- do not save / checkpoint)
 
   public:
     SGD(lbann_comm* comm, float lr, float momentum, float decay, bool nesterov)
       : comm(comm), lr(lr), momentum(momentum),
         decay(decay), nesterov(nesterov),
-        velocity(comm->get_model_grid()),
-        nesterov_ag(comm->get_model_grid()) {
+        velocity(comm->get_model_grid()) {
       iterations = 0;
     }
 
     ~SGD() {
       velocity.Empty();
-      nesterov_ag.Empty();
     }
 
     void setup(int input_dim, int num_neurons) {
@@ -76,7 +73,6 @@ namespace lbann
       }
       iterations = 0;
       Zeros(velocity, num_neurons, input_dim);
-      Zeros(nesterov_ag, num_neurons, input_dim);
     }
 
     void update_weight_bias_matrix(ElMat& WB_D, ElMat& WB) {
@@ -84,22 +80,38 @@ namespace lbann
       // KERAS: lr = self.lr * (1.0 / (1.0 + self.decay * self.iterations))
       lr = lr * (1.0 / (1.0 + decay * iterations));
       iterations++;
-  
-      // velocity
-      // KERAS: v = self.momentum * m - lr * g  # velocity
-      Scale(momentum, velocity);
-      Scale(lr, WB_D); // step
-      Axpy(-1, WB_D.Matrix(), velocity.Matrix()); // Update // TODO
-
-      if(nesterov) {
-        //KERAS: new_p = p + self.momentum * v - lr * g
-        Copy(velocity, nesterov_ag);
-        Scale(momentum, nesterov_ag);
-        Axpy(-1, WB_D.Matrix(), nesterov_ag.Matrix()); // TODO
-        Axpy(1., nesterov_ag.Matrix(), WB.Matrix()); // TODO
-      }else {
-        //KERAS: new_p = p + v
-        Axpy(1., velocity.Matrix(), WB.Matrix()); // TODO
+
+      // Fused update over the local entries. WB, WB_D, and velocity share a
+      // distribution, so their local matrices line up.
+      const Int local_height = WB.LocalHeight();
+      const Int local_width = WB.LocalWidth();
+      Int decay_local_height, decay_local_width;
+      get_local_decay_block(WB, decay_local_height, decay_local_width);
+      DataType* __restrict__ wb_buf = WB.Buffer();
+      const Int wb_ldim = WB.LDim();
+      const DataType* __restrict__ wb_d_buf = WB_D.LockedBuffer();
+      const Int wb_d_ldim = WB_D.LDim();
+      DataType* __restrict__ vel_buf = velocity.Buffer();
+      const Int vel_ldim = velocity.LDim();
+      for (Int col = 0; col < local_width; ++col) {
+        const DataType col_decay = col < decay_local_width ? weight_decay : 0;
+        for (Int row = 0; row < local_height; ++row) {
+          const DataType w = wb_buf[row + col * wb_ldim];
+          const DataType lambda = row < decay_local_height ? col_decay : 0;
+          // Gradient including L2 weight decay, scaled by the step size.
+          const DataType step = lr * (wb_d_buf[row + col * wb_d_ldim] +
+                                      lambda * w);
+          // KERAS: v = self.momentum * m - lr * g  # velocity
+          DataType& v = vel_buf[row + col * vel_ldim];
+          v = momentum * v - step;
+          if (nesterov) {
+            //KERAS: new_p = p + self.momentum * v - lr * g
+            wb_buf[row + col * wb_ldim] = w + momentum * v - step;
+          } else {
+            //KERAS: new_p = p + v
+            wb_buf[row + col * wb_ldim] = w + v;
+          }
+        }
       }
 
     }
@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_dropconnect .cpp .hpp - DropConnect implementation
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LBANN_REGULARIZATION_DROPCONNECT_HPP_INCLUDED
+#define LBANN_REGULARIZATION_DROPCONNECT_HPP_INCLUDED
+
+#include "lbann/regularization/lbann_regularizer.hpp"
+#include <vector>
+
+namespace lbann {
+
+/**
+ * DropConnect: probabilistically drop connections (weights) from a layer.
+ * See this paper for full details:
+ * Wan, Li, et al. "Regularization of neural networks using DropConnect."
+ * Proceedings of the 30th International Conference on Machine Learning (2013).
+ * Like dropout, kept weights are scaled by 1/(keep probability) at training
+ * time and weights are not modified at test time. Biases are never dropped.
+ * The mask is stored bit-packed, one bit per local weight. The weights are
+ * masked in place for forward and backward propagation and restored from a
+ * copy afterward, so no rounding error accumulates in them.
+ * This requires the weights not be replicated across processes (e.g. MC,MR
+ * weights in a fully-connected layer), since each process draws its own mask.
+ */
+class dropconnect : public regularizer {
+public:
+  /** Keep connections with probability keep_prob. */
+  dropconnect(float keep_prob=0.5f);
+  /** Check that the layer's weights are supported. */
+  void setup(Layer* l);
+  /** Drop connections before the forward propagation linearity. */
+  void fp_connections();
+  /** Mask the weight gradient and restore the weights after backprop. */
+  void bp_connections();
+protected:
+  /** Restore the weights saved by fp_connections. */
+  void restore_weights();
+
+  /** Probability of keeping each connection. */
+  float m_keep_prob;
+  /** Current mask, one bit per entry of the local weight block (column-major). */
+  std::vector<uint64_t> m_mask;
+  /** Local height of the weight block the mask covers. */
+  Int m_local_height;
+  /** Local width of the weight block the mask covers. */
+  Int m_local_width;
+  /** Copy of the local weights/biases before masking. */
+  Mat m_weights_backup;
+  /** Whether the layer's weights are currently masked. */
+  bool m_masked;
+};
+
+}  // namespace lbann
+
+#endif  // LBANN_REGULARIZATION_DROPCONNECT_HPP_INCLUDED
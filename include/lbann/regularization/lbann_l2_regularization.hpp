@@ -0,0 +1,55 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_l2_regularization .cpp .hpp - L2 weight decay implementation
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LBANN_REGULARIZATION_L2_HPP_INCLUDED
+#define LBANN_REGULARIZATION_L2_HPP_INCLUDED
+
+#include "lbann/regularization/lbann_regularizer.hpp"
+
+namespace lbann {
+
+/**
+ * L2 regularization (weight decay): add lambda/2 * ||W||^2 to the objective.
+ * Rather than adding lambda * W to the gradient in a separate pass over the
+ * weights, this passes lambda to the layer's optimizer, which folds it into its
+ * update loop. Biases are not decayed.
+ */
+class l2_regularization : public regularizer {
+public:
+  /** Regularize with coefficient lambda. */
+  l2_regularization(DataType lambda);
+  /** Configure the optimizer's weight decay for this step's update. */
+  void bp_connections();
+protected:
+  /** Weight decay coefficient. */
+  DataType m_lambda;
+};
+
+}  // namespace lbann
+
+#endif  // LBANN_REGULARIZATION_L2_HPP_INCLUDED
@@ -0,0 +1,104 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_comm_profiler .hpp .cpp - Profiling for communication primitives
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LBANN_UTILS_COMM_PROFILER_HPP_INCLUDED
+#define LBANN_UTILS_COMM_PROFILER_HPP_INCLUDED
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+namespace lbann {
+
+class lbann_summary;
+
+/**
+ * Record statistics for each communication primitive used by lbann_comm:
+ * the number of calls, a histogram of message sizes, the time spent in the
+ * call, and the time spent waiting for it to complete (for non-blocking
+ * primitives).
+ * Statistics are kept both for the whole run (dumped with dump_json) and since
+ * the last call to summarize.
+ */
+class lbann_comm_profiler {
+public:
+  /**
+   * Number of message size buckets. Bucket 0 holds empty messages and bucket
+   * b > 0 holds messages of [2^(b-1), 2^b) bytes; the last bucket holds
+   * everything larger.
+   */
+  static const int NUM_SIZE_BUCKETS = 40;
+  /** Statistics for one primitive. */
+  struct primitive_stats {
+    /** Number of calls. */
+    size_t count = 0;
+    /** Total bytes transferred. */
+    size_t bytes = 0;
+    /** Time spent in calls. */
+    double time = 0.0;
+    /** Number of waits on non-blocking calls. */
+    size_t num_waits = 0;
+    /** Time spent waiting on non-blocking calls. */
+    double wait_time = 0.0;
+    /** Message size histogram. */
+    std::vector<size_t> histogram = std::vector<size_t>(NUM_SIZE_BUCKETS, 0);
+  };
+
+  /** Record a call to primitive transferring bytes that took time. */
+  void record(const std::string& primitive, size_t bytes, double time);
+  /** Record a wait on a non-blocking call to primitive. */
+  void record_wait(const std::string& primitive, double time);
+  /** Return statistics for the whole run. */
+  const std::map<std::string, primitive_stats>& get_stats() const {
+    return total_stats;
+  }
+  /** Clear all statistics. */
+  void reset();
+  /**
+   * Summarize the statistics since the last call, as comm/<primitive>/...
+   * scalars.
+   */
+  void summarize(lbann_summary& summarizer, int64_t step);
+  /** Write the statistics for the whole run to os as JSON. */
+  void dump_json(std::ostream& os) const;
+  /** Write the statistics for the whole run to the file filename as JSON. */
+  void dump_json(const std::string& filename) const;
+  /** Return the histogram bucket for a message of bytes. */
+  static int get_size_bucket(size_t bytes);
+private:
+  /** Statistics for the whole run. */
+  std::map<std::string, primitive_stats> total_stats;
+  /** Statistics since the last summarize. */
+  std::map<std::string, primitive_stats> interval_stats;
+};
+
+}  // namespace lbann
+
+#endif  // LBANN_UTILS_COMM_PROFILER_HPP_INCLUDED
@@ -29,6 +29,8 @@
 #ifndef LBANN_QUANTIZER_HPP_INCLUDED
 #define LBANN_QUANTIZER_HPP_INCLUDED
 
+#include <unordered_map>
+#include <algorithm>
 #include "lbann/lbann_base.hpp"
 #include "lbann/lbann_comm.hpp"
 #include "lbann/utils/lbann_timer.hpp"
@@ -65,6 +67,13 @@ public:
   typedef El::Matrix<qtype> QuantizedMatrix;
   typedef std::vector<uqtype> ThreshQuantized;
 
+  /** Algorithms for the reduce-scatter/allgather of quantized sums. */
+  enum class collective_algorithm {
+    AUTO,  /** Pick based on the number of models and message size. */
+    RING,  /** Ring reduce-scatter and allgather. */
+    RECURSIVE,  /** Recursive halving/doubling (when possible). */
+  };
+
   lbann_quantizer();
   ~lbann_quantizer();
 
@@ -99,11 +108,22 @@ public:
    * in AdaGrad, and uses gradhist to store the gradient history. If used, you
    * should use SGD as the optimizer for those layers to avoid applying AdaGrad
    * twice.
+   * The quantized messages have a fixed shape, so they use buffers pooled in
+   * comm (keyed on mat) and persistent requests, which are reused when this is
+   * called again with the same matrix.
+   * With a power-of-two number of models, this can use recursive halving and
+   * doubling instead of rings (see set_collective_algorithm), which takes
+   * log_2(models) rather than models - 1 steps per phase.
+   * The distributed versions of this and the other sums work on any
+   * distribution, since every model distributes mat the same way. When other
+   * processes in the model hold copies of the local matrix (e.g. [*,*]
+   * matrices), each sums only its share (see get_redundant_share), so qerror
+   * and im_qerror are for that share, and the shares are then combined.
    */
   void intermodel_sum_quantized(lbann_comm* comm, Mat& mat, Mat& qerror,
                                 Mat& im_qerror, bool do_adagrad = false,
                                 Mat* gradhist = nullptr);
-  void intermodel_sum_quantized(lbann_comm* comm, DistMat& mat, Mat& qerror,
+  void intermodel_sum_quantized(lbann_comm* comm, ElMat& mat, Mat& qerror,
                                 Mat& im_qerror, bool do_adagrad = false,
                                 Mat* gradhist = nullptr);
   void intermodel_sum_quantized2(lbann_comm* comm, Mat& mat, Mat& qerror,
@@ -111,6 +131,35 @@ public:
   void intermodel_sum_quantized2(lbann_comm* comm, DistMat& mat, Mat& qerror,
                                  Mat& im_qerror);
 
+  /**
+   * Quantize a matrix to 2, 4, or 8 bits per entry with stochastic rounding
+   * (as in QSGD). Each column is scaled by its maximum magnitude (mat plus
+   * qerror), which is stored in the first word, and each entry is rounded to
+   * one of the 2^(bits-1) - 1 levels on either side of zero, randomly so the
+   * rounding is unbiased. Levels are packed 32 / bits to a word. qerror is
+   * updated with the rounding error, as with quantize.
+   * @param mat The matrix to quantize.
+   * @param qmat The output quantized matrix (will be resized).
+   * @param qerror Running quantization error.
+   * @param bits Bits per entry (2, 4, or 8).
+   */
+  void qsgd_quantize(const Mat& mat, QuantizedMatrix& qmat, Mat& qerror,
+                     int bits);
+  void qsgd_quantize(const DistMat& mat, QuantizedMatrix& qmat, Mat& qerror,
+                     int bits);
+  /** Unquantize a matrix quantized with qsgd_quantize using bits bits. */
+  void qsgd_unquantize(const QuantizedMatrix& qmat, Mat& mat, int bits,
+                       bool apply = false);
+  void qsgd_unquantize(const QuantizedMatrix& qmat, DistMat& mat, int bits,
+                       bool apply = false);
+  /**
+   * As with intermodel_sum_quantized, but use qsgd_quantize with bits bits.
+   */
+  void intermodel_sum_qsgd(lbann_comm* comm, Mat& mat, Mat& qerror,
+                           Mat& im_qerror, int bits);
+  void intermodel_sum_qsgd(lbann_comm* comm, ElMat& mat, Mat& qerror,
+                           Mat& im_qerror, int bits);
+
   /**
    * Threshold and quantize a matrix. qerror needs to be initialized with:
    * Zeros(qerror, mat.Height(), mat.Width())).
@@ -177,7 +226,7 @@ public:
                                           Mat& qerror, DataType pos_thresh,
                                           DataType neg_thresh, Mat& im_qerror,
                                           bool compress=true);
-  void intermodel_sum_threshold_quantized(lbann_comm* comm, DistMat& mat,
+  void intermodel_sum_threshold_quantized(lbann_comm* comm, ElMat& mat,
                                           Mat& qerror, DataType pos_thresh,
                                           DataType neg_thresh, Mat& im_qerror,
                                           bool compress=true);
@@ -189,13 +238,76 @@ public:
     lbann_comm* comm, Mat& mat, Mat& qerror, int proportion, Mat& im_qerror,
     bool compress=true);
   void intermodel_sum_adaptive_threshold_quantized(
-    lbann_comm* comm, DistMat& mat, Mat& qerror, int proportion, Mat& im_qerror,
+    lbann_comm* comm, ElMat& mat, Mat& qerror, int proportion, Mat& im_qerror,
     bool compress=true);
 
+  /**
+   * Sum mat across models, sending only the largest (in magnitude) one in
+   * proportion of the entries of mat + qerror, as (index, value) pairs. The
+   * entries not sent are accumulated in qerror. With a power-of-two number of
+   * models, the sparse sets are merged (summing entries with the same index)
+   * by recursive doubling; otherwise each set is passed around a ring. The
+   * result is densified into mat at the end.
+   */
+  void intermodel_sum_topk(lbann_comm* comm, Mat& mat, Mat& qerror,
+                           int proportion);
+  void intermodel_sum_topk(lbann_comm* comm, ElMat& mat, Mat& qerror,
+                           int proportion);
+
+  /**
+   * Replace mat with its average over all models, communicating only the
+   * quantized difference of mat from ref, weights every model shares (e.g.
+   * the previous average). The quantization errors are kept in qerror and
+   * im_qerror, as in intermodel_sum_quantized, and fed back into the next
+   * average. Differences are one-bit quantized if proportion is 0, and
+   * otherwise adaptively threshold quantized, sending one in proportion.
+   * Every model ends with the same average. ref is not modified.
+   */
+  void intermodel_average_delta_quantized(lbann_comm* comm, Mat& mat,
+                                          const Mat& ref, Mat& qerror,
+                                          Mat& im_qerror, int proportion = 0);
+  /**
+   * Broadcast mat from root by quantizing its difference from ref (quantized
+   * as with intermodel_average_delta_quantized, with error feedback in
+   * qerror on root) and adding the unquantized difference to ref on every
+   * model, root included. ref thus stays identical on every model and tracks
+   * mat on root. mat is only used on root.
+   */
+  void intermodel_broadcast_delta_quantized(lbann_comm* comm, const Mat& mat,
+                                            Mat& ref, Mat& qerror, int root,
+                                            int proportion = 0);
+  /**
+   * Start a non-blocking, one-bit quantized
+   * intermodel_broadcast_delta_quantized into qmat, which is resized as
+   * needed. Neither ref nor qmat may be modified until
+   * complete_broadcast_delta_quantized finishes it with the same qmat and req.
+   */
+  void nb_intermodel_broadcast_delta_quantized(lbann_comm* comm,
+                                               const Mat& mat, const Mat& ref,
+                                               Mat& qerror, int root,
+                                               QuantizedMatrix& qmat,
+                                               lbann_mpi_req<qtype>& req);
+  /**
+   * Wait for a broadcast started by nb_intermodel_broadcast_delta_quantized
+   * and add the unquantized difference to ref.
+   */
+  void complete_broadcast_delta_quantized(lbann_comm* comm,
+                                          const QuantizedMatrix& qmat,
+                                          Mat& ref, lbann_mpi_req<qtype>& req);
+  /**
+   * Free the buffers kept for mat and views of it, here and in comm's buffer
+   * pool. Buffers are keyed by address, so call this before mat is freed.
+   */
+  void release_buffers(lbann_comm* comm, const Mat& mat);
+  void release_buffers(lbann_comm* comm, const ElMat& mat) {
+    release_buffers(comm, mat.LockedMatrix());
+  }
+
   /**
    * Compress the output of threshold_quantize.
    * This uses Golumb-Rice coding, with the quotient stored first, followed by
-   * the remainder.
+   * the remainder. Bits are packed LSB-first into words and the last word is
+   * padded with 1s. The output is appended to cq.
    */
   void compress_thresholds(const ThreshQuantized& q,
                            ThreshQuantized& cq);
@@ -221,6 +333,69 @@ public:
    */
   std::tuple<DataType, DataType, DataType, DataType> proportion_threshold_average(
     const Mat& mat, const Mat& qerror, int proportion, bool sample = true);
+  /**
+   * As with proportion_threshold_average, but without copying or sampling:
+   * entries are histogrammed by the high bits of their magnitude (exponent and
+   * two mantissa bits), and, if refine is true, the entries in the bucket
+   * containing the threshold are histogrammed again by the next ten bits. The
+   * threshold is the lower edge of the selected bucket, so at least one in
+   * proportion entries are kept, with a relative error in the threshold of at
+   * most 2^-12 (2^-2 without refining). The averages are exact for the entries
+   * the threshold keeps. Columns are processed in parallel.
+   */
+  std::tuple<DataType, DataType, DataType, DataType> histogram_threshold_average(
+    const Mat& mat, const Mat& qerror, int proportion, bool refine = true);
+  /** Methods for computing adaptive thresholds. */
+  enum class threshold_estimator {
+    SELECT,  /** proportion_threshold_average. */
+    HISTOGRAM,  /** histogram_threshold_average. */
+  };
+  /** Set the method adaptive threshold quantization uses for thresholds. */
+  void set_threshold_estimator(threshold_estimator estimator) {
+    thresh_estimator = estimator;
+  }
+
+  /**
+   * Set the number of chunks each block is split into for pipelining in the
+   * ring reduce-scatter (1 disables pipelining).
+   */
+  void set_pipeline_chunks(int chunks) {
+    pipeline_chunks = std::max(1, chunks);
+  }
+  /**
+   * Set the tag used for variable-size messages. Quantizers that run sums
+   * concurrently (on the same processes) need distinct tags.
+   */
+  void set_comm_tag(int tag) { comm_tag = tag; }
+  /** Set the algorithm used by intermodel_sum_quantized. */
+  void set_collective_algorithm(collective_algorithm algo) {
+    coll_algo = algo;
+  }
+  /**
+   * With AUTO, use recursive halving/doubling when the number of models is a
+   * power of two greater than two and each model's share of the matrix is at
+   * most this many bytes (so the sum is latency-bound).
+   */
+  void set_recursive_threshold(size_t bytes) { recursive_threshold = bytes; }
+  /**
+   * Return true if a sum of mat would use recursive halving/doubling.
+   * qheight is the height of mat quantized (default: one-bit quantization).
+   */
+  bool use_recursive(lbann_comm* comm, const Mat& mat, Int qheight = 0) const;
+
+  /**
+   * Set rows and cols to the part of mat's local matrix that this process
+   * sums across models: all of it, unless there are redundant copies of it
+   * in the model, in which case the copies are split by columns (or by rows,
+   * when there are fewer columns than copies).
+   */
+  void get_redundant_share(const ElMat& mat, IR& rows, IR& cols) const;
+  /**
+   * Assemble mat's local matrix from the redundant copies' shares (from
+   * get_redundant_share) of it. Entries outside this process's share are
+   * overwritten.
+   */
+  void combine_redundant_shares(ElMat& mat, IR rows, IR cols);
 
   /** Get the total number of bytes sent during quantization. */
   size_t get_bytes_sent() const { return rs_bytes_sent + ag_bytes_sent; }
@@ -291,6 +466,23 @@ private:
   static const int NUM_PTA_SAMPLES = 2048;
   /** Samples to use to approximate column averages in onebit quantization. */
   static const int NUM_ONEBIT_SAMPLES = 128;
+  /** Minimum entries for onebit (un)quantization to use multiple threads. */
+  static const int ONEBIT_PARALLEL_MIN = 16384;
+
+  /** Algorithm for quantized sums. */
+  collective_algorithm coll_algo;
+  /** Per-model bytes at or below which AUTO uses recursive algorithms. */
+  size_t recursive_threshold;
+  /** Tag for variable-size messages. */
+  int comm_tag;
+  /** Method for computing adaptive thresholds. */
+  threshold_estimator thresh_estimator;
+  /** Number of chunks per block in the pipelined ring reduce-scatter. */
+  int pipeline_chunks;
+  /** Requests and buffers for the chunks in flight in the reduce-scatter. */
+  std::vector<lbann_persistent_req> chunk_send_reqs;
+  std::vector<lbann_persistent_req> chunk_recv_reqs;
+  std::vector<void*> chunk_recv_bufs;
 
   /** Bytes sent in doing the reduce-scatter. */
   size_t rs_bytes_sent;
@@ -321,43 +513,158 @@ private:
   /** Time spent in proportion_threshold_average_pos. */
   double pta_pos_time;
 
+  /**
+   * Writes threshold quantized entries into a buffer sized with
+   * get_thresh_bound, optionally compressing them as it goes (with the same
+   * encoding as compress_thresholds).
+   */
+  class thresh_writer {
+  public:
+    thresh_writer(uqtype* buf_, bool compress_) :
+      buf(buf_), out(0), compress(compress_), empty(true), acc(0),
+      acc_bits(0) {}
+    /** Write word as-is (e.g. an adaptive average). */
+    inline void put_raw(uqtype word) { buf[out++] = word; }
+    /** Write a quantized entry. */
+    inline void push_back(uqtype ent);
+    /** Flush pending bits and return the number of words written. */
+    inline size_t finish();
+  private:
+    uqtype* buf;
+    size_t out;
+    bool compress;
+    /** Whether no entries have been written. */
+    bool empty;
+    /** Pending bits, in the low acc_bits bits. */
+    uint64_t acc;
+    uqtype acc_bits;
+  };
+  /** Reads entries written by a thresh_writer. */
+  class thresh_reader {
+  public:
+    thresh_reader(const uqtype* buf_, size_t count_, bool compress_) :
+      buf(buf_), count(count_), i(0), compress(compress_), acc(0),
+      acc_bits(0) {}
+    /** Read a word written with thresh_writer::put_raw. */
+    inline uqtype get_raw() { return buf[i++]; }
+    /** Read the next entry into ent; return false if there are none left. */
+    inline bool next(uqtype& ent);
+  private:
+    const uqtype* buf;
+    size_t count;
+    size_t i;
+    bool compress;
+    /** Unread bits, in the low acc_bits bits. */
+    uint64_t acc;
+    uqtype acc_bits;
+  };
+
+  /**
+   * Buffers for the threshold quantized sums of one matrix, kept across calls
+   * so their capacity is reused.
+   */
+  struct thresh_buffers {
+    /** Used by intermodel_sum_topk. */
+    ThreshQuantized ag_send;
+    ThreshQuantized ag_recv;
+    ThreshQuantized uncomp;
+    /** Sorted positions received in the reduce-scatter. */
+    std::vector<unsigned> positions;
+    /** Scratch space for merge_positions. */
+    std::vector<unsigned> merged_positions;
+    /** Message buffers pooled in lbann_comm, each max_words long. */
+    uqtype* rs_send_buf = nullptr;
+    uqtype* rs_recv_buf = nullptr;
+    uqtype* ag_send_buf = nullptr;
+    uqtype* ag_recv_buf = nullptr;
+    size_t max_words = 0;
+  };
+  /** Threshold quantization buffers, by the matrix being summed. */
+  std::unordered_map<const DataType*, thresh_buffers> thresh_bufs;
+  /** Return the threshold quantization buffers for mat. */
+  inline thresh_buffers& get_thresh_buffers(const Mat& mat) {
+    return thresh_bufs[mat.LockedBuffer()];
+  }
+  /**
+   * Return the threshold quantization buffers for a sum of mat, with message
+   * buffers large enough for any block and positions cleared.
+   */
+  thresh_buffers& get_thresh_buffers(lbann_comm* comm, const Mat& mat,
+                                     bool adaptive, bool compress);
+  /** Throw if a received message of count words does not fit in bufs. */
+  void check_thresh_count(const thresh_buffers& bufs, int count) const;
+  /**
+   * Merge the sorted positions in bufs.positions from old_size on into the
+   * sorted positions before them, dropping duplicates.
+   */
+  void merge_positions(thresh_buffers& bufs, size_t old_size);
+  /**
+   * Return the most words threshold quantizing a height x width block with
+   * leading dimension ldim can take. Compressed entries are delta encoded, so
+   * their shifted values sum to less than 2 * ldim * width + height * width.
+   */
+  inline size_t get_thresh_bound(Int height, Int width, Int ldim,
+                                 bool compress) const {
+    const size_t entries = (size_t) height * width;
+    if (!compress) return entries;
+    const size_t bits = (2 * (size_t) ldim * width + entries) / GR_M +
+      entries * (GR_K + 1);
+    // Plus one for the padded (or empty marker) word.
+    return (bits + NUM_BITS - 1) / NUM_BITS + 1;
+  }
+
   /** Return the height of mat after quantization with quantize(). */
   inline int get_quantized_matrix_height(const Mat& mat) const {
     return (mat.Height() + (NUM_BITS-1)) / NUM_BITS + 2;
   }
+  /** Return the height of mat after quantization with qsgd_quantize(). */
+  inline int get_qsgd_matrix_height(const Mat& mat, int bits) const {
+    const int per_word = NUM_BITS / bits;
+    return (mat.Height() + (per_word-1)) / per_word + 1;
+  }
 
-  /** Handle threshold unquantization from arbitrary locations. */
-  void threshold_unquantize(const ThreshQuantized& q,
-                            ThreshQuantized::const_iterator qstart, Mat& mat,
-                            DataType pos_avg, DataType neg_avg,
-                            bool delta = false);
+  /** As with threshold_quantize, but write entries with quant. */
+  void threshold_quantize(const Mat& mat, thresh_writer& quant, Mat& qerror,
+                          DataType pos_thresh, DataType neg_thresh,
+                          bool delta = false, DataType pos_avg = 0.0f,
+                          DataType neg_avg = 0.0f);
+  /** As with threshold_unquantize, but read entries from quant. */
+  void threshold_unquantize(thresh_reader& quant, Mat& mat, DataType pos_avg,
+                            DataType neg_avg, bool delta = false);
   /**
-   * Do threshold unquantization from arbitrary locations, adding the
-   * unquantized values to existing ones instead of replacing them, and storing
-   * the locations applied.
+   * Do threshold unquantization, adding the unquantized values to existing
+   * ones instead of replacing them, and appending the locations applied to
+   * positions.
    */
-  void threshold_unquantize_apply(const ThreshQuantized& q,
-                                  ThreshQuantized::const_iterator qstart,
-                                  Mat& mat, DataType pos_avg, DataType neg_avg,
+  void threshold_unquantize_apply(thresh_reader& quant, Mat& mat,
+                                  DataType pos_avg, DataType neg_avg,
                                   std::vector<unsigned>& positions,
                                   bool delta = false);
   /**
-   * Quantize only the locations in mat in positions; the companion of
-   * threshold_unquantize_apply.
+   * Quantize only the locations in mat in positions (which must be sorted);
+   * the companion of threshold_unquantize_apply.
    */
-  void threshold_quantize_apply(const Mat& mat, ThreshQuantized& q, Mat& qerror,
-                                DataType pos_thresh, DataType neg_thresh,
+  void threshold_quantize_apply(const Mat& mat, thresh_writer& quant,
+                                Mat& qerror, DataType pos_thresh,
+                                DataType neg_thresh,
                                 std::vector<unsigned>& positions,
                                 bool delta = false, DataType pos_avg = 0.0f,
                                 DataType neg_avg = 0.0f);
 
+  /** As with adaptive_threshold_quantize, but write entries with q. */
+  void adaptive_threshold_quantize(const Mat& mat, thresh_writer& q,
+                                   Mat& qerror, int proportion,
+                                   bool delta = false);
+  /** As with adaptive_threshold_unquantize, but read entries from q. */
+  void adaptive_threshold_unquantize(thresh_reader& q, Mat& mat,
+                                     bool delta = false);
   /** As with threshold_unquantize_apply, but adaptively. */
   void adaptive_threshold_unquantize_apply(
-    const ThreshQuantized& q, Mat& mat, std::vector<unsigned>& positions,
+    thresh_reader& q, Mat& mat, std::vector<unsigned>& positions,
     bool delta = false);
   /** As with threshold_quantize_apply, but adaptively. */
   void adaptive_threshold_quantize_apply(
-    const Mat& mat, ThreshQuantized& q, Mat& qerror, int proportion,
+    const Mat& mat, thresh_writer& q, Mat& qerror, int proportion,
     std::vector<unsigned>& positions, bool delta = false);
   /**
    * Internal version of proportion_threshold_average that only
@@ -367,6 +674,30 @@ private:
     const Mat& mat, const Mat& qerror, int proportion,
     const std::vector<unsigned>& positions, bool sample = true);
 
+  /**
+   * Append the (index, value) pairs of the entries of mat + qerror with the
+   * largest magnitudes (one in proportion of them) to sparse, in index order,
+   * and update qerror. Indices are into a height x width column-major matrix.
+   */
+  void topk_select(const Mat& mat, Mat& qerror, int proportion,
+                   ThreshQuantized& sparse);
+  /** Add the (index, value) pairs in sparse to mat. */
+  void sparse_accumulate(const ThreshQuantized& sparse, Mat& mat);
+
+  /** Apply sum to this process's share of mat, then combine the shares. */
+  void sum_redundant_shares(ElMat& mat, std::function<void(Mat&)> sum);
+  /**
+   * Sum mat across models with fixed-size quantization: quant and unquant
+   * (un)quantize into matrices of height qheight (unquant adds when its last
+   * argument is true). reduced_hook, if set, is applied to the reduced
+   * columns before they are requantized for the allgather.
+   */
+  void intermodel_sum_fixed_quantized(
+    lbann_comm* comm, Mat& mat, Mat& qerror, Mat& im_qerror, Int qheight,
+    std::function<void(const Mat&, QuantizedMatrix&, Mat&)> quant,
+    std::function<void(const QuantizedMatrix&, Mat&, bool)> unquant,
+    std::function<void(Mat&)> reduced_hook);
+
   /** Handle compression starting from arbitrary locations. */
   void compress_thresholds(const ThreshQuantized& q,
                            ThreshQuantized::const_iterator qstart,
@@ -376,6 +707,15 @@ private:
                              ThreshQuantized::const_iterator cqstart,
                              ThreshQuantized& q);
 
+  /**
+   * Ring reduce-scatter. send_trans transforms a range of mat into a buffer to
+   * send, get_recv_buf provides a buffer to receive into for a view of mat and
+   * recv_trans accumulates a received buffer into that view.
+   * With fixed-size messages (!var_recv), each block is split into chunks that
+   * are pipelined: chunk i + 1 is transformed and sent while chunk i is in
+   * flight and chunk i - 1 is accumulated. The callbacks must then return
+   * distinct buffers for distinct columns.
+   */
   template <typename T>
   void intermodel_ring_reduce_scatter(
     lbann_comm* comm, Mat& mat, bool var_recv,
@@ -391,6 +731,51 @@ private:
     std::function<T*(Mat&, int&)> get_recv_buf,
     std::function<void(T*, Mat&)> recv_trans,
     std::function<void(T*, T*)> swap_bufs);
+
+  /**
+   * Recursive-halving reduce-scatter with the same callbacks and the same
+   * final column partition as intermodel_ring_reduce_scatter. At each step a
+   * model sends half of its remaining columns (including what it has
+   * accumulated) to its partner, so each column is transformed only once.
+   * Requires a power-of-two number of models.
+   */
+  template <typename T>
+  void intermodel_recursive_reduce_scatter(
+    lbann_comm* comm, Mat& mat, bool var_recv,
+    std::function<T*(Mat&, IR, IR, int&)> send_trans,
+    std::function<T*(Mat&, int&)> get_recv_buf,
+    std::function<void(T*, Mat&)> recv_trans);
+
+  /**
+   * Recursive-doubling allgather. reduced_trans and recv_trans are as with
+   * intermodel_ring_allgather; get_range_buf returns the transformed data for
+   * a range of columns, which must be laid out contiguously by column (as
+   * with one-bit quantization) so ranges can be combined. Requires a
+   * power-of-two number of models and fixed-size messages.
+   */
+  template <typename T>
+  void intermodel_recursive_allgather(
+    lbann_comm* comm, Mat& mat,
+    std::function<void(Mat&)> reduced_trans,
+    std::function<T*(IR, int&)> get_range_buf,
+    std::function<void(T*, Mat&)> recv_trans);
+
+  /**
+   * Return the columns of blocks [first, last) in the partition of mat used by
+   * the reduce-scatters and allgathers.
+   */
+  inline IR get_block_cols(const Mat& mat, int nprocs, int first,
+                           int last) const {
+    const int cols_per_proc = mat.Width() / nprocs;
+    return IR(first * cols_per_proc,
+              last == nprocs ? mat.Width() : last * cols_per_proc);
+  }
+  /** Return the columns of chunk of num_chunks chunks of cols. */
+  inline IR get_chunk_cols(IR cols, int chunk, int num_chunks) const {
+    const int width = cols.end - cols.beg;
+    return IR(cols.beg + (width * chunk) / num_chunks,
+              cols.beg + (width * (chunk + 1)) / num_chunks);
+  }
 };
 
 template <typename T>
@@ -409,9 +794,17 @@ void lbann_quantizer::intermodel_ring_reduce_scatter(
   int local_col_width = cols_per_proc;
   if (rank == nprocs - 1) local_col_width += cols_remainder;
   // Local view into which to accumulate our received data.
-  auto accum_view = mat(IR(0, mat.Height()),
-                        IR(rank * cols_per_proc,
-                           rank * cols_per_proc + local_col_width));
+  const IR accum_cols(rank * cols_per_proc,
+                      rank * cols_per_proc + local_col_width);
+  auto accum_view = mat(IR(0, mat.Height()), accum_cols);
+  // Fixed-size messages are pipelined in chunks.
+  const int num_chunks = var_recv ? 1 :
+    std::max(1, std::min(pipeline_chunks, cols_per_proc));
+  if (num_chunks > 1) {
+    chunk_send_reqs.resize(num_chunks);
+    chunk_recv_reqs.resize(num_chunks);
+    chunk_recv_bufs.resize(num_chunks);
+  }
   // Do the reduce-scatter.
   for (int step = 1; step < nprocs; ++step) {
     // Compute the source/destination.
@@ -421,6 +814,44 @@ void lbann_quantizer::intermodel_ring_reduce_scatter(
     // Determine the number of columns to send.
     int send_col_width = cols_per_proc;
     if (dst == nprocs - 1) send_col_width += cols_remainder;
+    if (num_chunks > 1) {
+      const IR send_cols(dst * cols_per_proc,
+                         dst * cols_per_proc + send_col_width);
+      // Start chunk c, then accumulate chunk c - 1 while it is in flight.
+      for (int c = 0; c <= num_chunks; ++c) {
+        if (c < num_chunks) {
+          int send_size;
+          double send_trans_start = get_time();
+          T* send_buf = send_trans(mat, IR(0, mat.Height()),
+                                   get_chunk_cols(send_cols, c, num_chunks),
+                                   send_size);
+          rs_send_trans_time += get_time() - send_trans_start;
+          chunk_send_reqs[c] = comm->persistent_send(send_buf, send_size, dst);
+          rs_bytes_sent += send_size * sizeof(T);
+          double recv_buf_start = get_time();
+          auto recv_view = mat(IR(0, mat.Height()),
+                               get_chunk_cols(accum_cols, c, num_chunks));
+          int recv_size = 0;
+          T* recv_buf = get_recv_buf(recv_view, recv_size);
+          rs_recv_buf_time += get_time() - recv_buf_start;
+          chunk_recv_reqs[c] = comm->persistent_recv(recv_buf, recv_size, src);
+          chunk_recv_bufs[c] = recv_buf;
+          rs_bytes_received += recv_size * sizeof(T);
+        }
+        if (c > 0) {
+          comm->wait_persistent(chunk_recv_reqs[c - 1]);
+          auto recv_view = mat(IR(0, mat.Height()),
+                               get_chunk_cols(accum_cols, c - 1, num_chunks));
+          double recv_trans_start = get_time();
+          recv_trans(static_cast<T*>(chunk_recv_bufs[c - 1]), recv_view);
+          rs_recv_trans_time += get_time() - recv_trans_start;
+        }
+      }
+      for (int c = 0; c < num_chunks; ++c) {
+        comm->wait_persistent(chunk_send_reqs[c]);
+      }
+      continue;
+    }
     // Transform the portion to send.
     int send_size;
     double send_trans_start = get_time();
@@ -428,26 +859,40 @@ void lbann_quantizer::intermodel_ring_reduce_scatter(
       mat, IR(0, mat.Height()),
       IR(dst * cols_per_proc, dst * cols_per_proc + send_col_width), send_size);
     rs_send_trans_time += get_time() - send_trans_start;
-    // Send.
+    // Send. Fixed-size exchanges reuse persistent requests.
     lbann_mpi_req<T> req;
-    comm->nb_send(send_buf, send_size, dst, req);
+    lbann_persistent_req preq = nullptr;
+    if (var_recv) {
+      comm->nb_send_var(send_buf, send_size, dst, comm_tag, req);
+    } else {
+      preq = comm->persistent_send(send_buf, send_size, dst);
+    }
     rs_bytes_sent += send_size * sizeof(T);
     // Get receive buffer.
     double recv_buf_start = get_time();
     int recv_size = 0;
+    lbann_matched_msg msg;
     if (var_recv) {
-      recv_size = comm->get_count<T>(src);
+      recv_size = comm->probe_var<T>(src, comm_tag, msg);
     }
     T* recv_buf = get_recv_buf(accum_view, recv_size);
     rs_recv_buf_time += get_time() - recv_buf_start;
     // Receive.
-    comm->recv(recv_buf, recv_size, src);
+    if (var_recv) {
+      comm->recv_var(recv_buf, recv_size, msg);
+    } else {
+      comm->wait_persistent(comm->persistent_recv(recv_buf, recv_size, src));
+    }
     rs_bytes_received += recv_size * sizeof(T);
     // Transform the received portion.
     double recv_trans_start = get_time();
     recv_trans(recv_buf, accum_view);
     rs_recv_trans_time += get_time() - recv_trans_start;
-    comm->wait<T>(req);
+    if (var_recv) {
+      comm->wait<T>(req);
+    } else {
+      comm->wait_persistent(preq);
+    }
   }
   rs_time += get_time() - rs_start;
 }
@@ -484,10 +929,16 @@ void lbann_quantizer::intermodel_ring_allgather(
   // Do the allgather.
   for (int step = 0; step < nprocs - 1; ++step) {
     // Send our data or forward received data.
+    // Fixed-size exchanges reuse persistent requests.
     lbann_mpi_req<T> req;
+    lbann_persistent_req preq = nullptr;
     int send_size;
     T* send_buf = get_send_buf(send_size);
-    comm->nb_send(send_buf, send_size, dst, req);
+    if (var_recv) {
+      comm->nb_send_var(send_buf, send_size, dst, comm_tag, req);
+    } else {
+      preq = comm->persistent_send(send_buf, send_size, dst);
+    }
     ag_bytes_sent += send_size * sizeof(T);
     // Compute the original rank that sent the data we're going to receive.
     int data_src = (rank - step - 1) % nprocs;
@@ -502,19 +953,28 @@ void lbann_quantizer::intermodel_ring_allgather(
     // Get receive buffer.
     double recv_buf_start = get_time();
     int recv_size = 0;
+    lbann_matched_msg msg;
     if (var_recv) {
-      recv_size = comm->get_count<T>(src);
+      recv_size = comm->probe_var<T>(src, comm_tag, msg);
     }
     T* recv_buf = get_recv_buf(recv_view, recv_size);
     ag_recv_buf_time += get_time() - recv_buf_start;
     // Receive data.
-    comm->recv(recv_buf, recv_size, src);
+    if (var_recv) {
+      comm->recv_var(recv_buf, recv_size, msg);
+    } else {
+      comm->wait_persistent(comm->persistent_recv(recv_buf, recv_size, src));
+    }
     ag_bytes_received += recv_size * sizeof(T);
     // Transform the received portion.
     double recv_trans_start = get_time();
     recv_trans(recv_buf, recv_view);
     ag_recv_trans_time += get_time() - recv_trans_start;
-    comm->wait<T>(req);
+    if (var_recv) {
+      comm->wait<T>(req);
+    } else {
+      comm->wait_persistent(preq);
+    }
     // Swap so we forward the data we just received.
     swap_bufs(send_buf, recv_buf);
     send_size = recv_size;
@@ -522,6 +982,123 @@ void lbann_quantizer::intermodel_ring_allgather(
   ag_time += get_time() - ag_start;
 }
 
+template <typename T>
+void lbann_quantizer::intermodel_recursive_reduce_scatter(
+  lbann_comm* comm, Mat& mat, bool var_recv,
+  std::function<T*(Mat&, IR, IR, int&)> send_trans,
+  std::function<T*(Mat&, int&)> get_recv_buf,
+  std::function<void(T*, Mat&)> recv_trans) {
+  double rs_start = get_time();
+  const int rank = comm->get_model_rank();
+  const int nprocs = comm->get_num_models();
+  // Blocks [lo, hi) are the ones this model is still reducing.
+  int lo = 0;
+  int hi = nprocs;
+  for (int dist = nprocs / 2; dist > 0; dist /= 2) {
+    const int partner = rank ^ dist;
+    const int mid = (lo + hi) / 2;
+    // Keep the half containing our own block.
+    int send_lo = mid, send_hi = hi;
+    if (rank & dist) {
+      send_lo = lo;
+      send_hi = mid;
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+    const IR send_cols = get_block_cols(mat, nprocs, send_lo, send_hi);
+    auto accum_view = mat(IR(0, mat.Height()),
+                          get_block_cols(mat, nprocs, lo, hi));
+    // Transform the half to send.
+    int send_size;
+    double send_trans_start = get_time();
+    T* send_buf = send_trans(mat, IR(0, mat.Height()), send_cols, send_size);
+    rs_send_trans_time += get_time() - send_trans_start;
+    // Send.
+    lbann_mpi_req<T> req;
+    lbann_persistent_req preq = nullptr;
+    if (var_recv) {
+      comm->nb_send_var(send_buf, send_size, partner, comm_tag, req);
+    } else {
+      preq = comm->persistent_send(send_buf, send_size, partner);
+    }
+    rs_bytes_sent += send_size * sizeof(T);
+    // Get receive buffer.
+    double recv_buf_start = get_time();
+    int recv_size = 0;
+    lbann_matched_msg msg;
+    if (var_recv) {
+      recv_size = comm->probe_var<T>(partner, comm_tag, msg);
+    }
+    T* recv_buf = get_recv_buf(accum_view, recv_size);
+    rs_recv_buf_time += get_time() - recv_buf_start;
+    // Receive.
+    if (var_recv) {
+      comm->recv_var(recv_buf, recv_size, msg);
+    } else {
+      comm->wait_persistent(comm->persistent_recv(recv_buf, recv_size,
+                                                  partner));
+    }
+    rs_bytes_received += recv_size * sizeof(T);
+    // Accumulate the partner's contribution to our half.
+    double recv_trans_start = get_time();
+    recv_trans(recv_buf, accum_view);
+    rs_recv_trans_time += get_time() - recv_trans_start;
+    if (var_recv) {
+      comm->wait<T>(req);
+    } else {
+      comm->wait_persistent(preq);
+    }
+  }
+  rs_time += get_time() - rs_start;
+}
+
+template <typename T>
+void lbann_quantizer::intermodel_recursive_allgather(
+  lbann_comm* comm, Mat& mat,
+  std::function<void(Mat&)> reduced_trans,
+  std::function<T*(IR, int&)> get_range_buf,
+  std::function<void(T*, Mat&)> recv_trans) {
+  double ag_start = get_time();
+  const int rank = comm->get_model_rank();
+  const int nprocs = comm->get_num_models();
+  // Transform the reduced data.
+  double reduced_start = get_time();
+  auto reduced = mat(IR(0, mat.Height()),
+                     get_block_cols(mat, nprocs, rank, rank + 1));
+  reduced_trans(reduced);
+  ag_reduced_trans_time += get_time() - reduced_start;
+  // Blocks [lo, lo + dist) are the ones this model has.
+  int lo = rank;
+  for (int dist = 1; dist < nprocs; dist *= 2) {
+    const int partner = rank ^ dist;
+    const int partner_lo = lo ^ dist;
+    // Send everything we have.
+    int send_size;
+    T* send_buf = get_range_buf(get_block_cols(mat, nprocs, lo, lo + dist),
+                                send_size);
+    lbann_persistent_req preq = comm->persistent_send(send_buf, send_size,
+                                                      partner);
+    ag_bytes_sent += send_size * sizeof(T);
+    // Receive everything the partner has.
+    double recv_buf_start = get_time();
+    const IR recv_cols = get_block_cols(mat, nprocs, partner_lo,
+                                        partner_lo + dist);
+    auto recv_view = mat(IR(0, mat.Height()), recv_cols);
+    int recv_size;
+    T* recv_buf = get_range_buf(recv_cols, recv_size);
+    ag_recv_buf_time += get_time() - recv_buf_start;
+    comm->wait_persistent(comm->persistent_recv(recv_buf, recv_size, partner));
+    ag_bytes_received += recv_size * sizeof(T);
+    double recv_trans_start = get_time();
+    recv_trans(recv_buf, recv_view);
+    ag_recv_trans_time += get_time() - recv_trans_start;
+    comm->wait_persistent(preq);
+    lo = std::min(lo, partner_lo);
+  }
+  ag_time += get_time() - ag_start;
+}
+
 }  // namespace lbann
 
 #endif  // LBANN_QUANTIZER_HPP_INCLUDED
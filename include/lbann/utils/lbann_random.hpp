@@ -45,15 +45,29 @@ rng_gen& get_generator();
  * @todo Support saving/restoring the generator's state. This is directly
  * supported via the >> and << operators on the generator (reading/writing
  * from/to a stream).
+ * This also resets the counter-based generator used by the matrix fills below;
+ * every rank must call it with the same seed before filling matrices. When no
+ * seed is given, rank 0's random seed is broadcast to every rank.
  */
 void init_random(int seed = -1);
 
+/**
+ * Reseed only this rank's generator (and Elemental's, if selected) with seed,
+ * e.g. to make dropout differ between ranks. The counter-based matrix fills
+ * are left alone, so they stay identical across ranks.
+ */
+void init_local_random(int seed);
+
 /**
  * Make mat into an m x n matrix where each entry is independently drawn from
  * a Gaussian distribution with given mean and standard deviation.
  * Unless selected so at compile-time, this ensures the entries of the matrix do
  * not change as the grid it is distributed over changes; that is, it will have
  * the same entries when mat spans any number of processes.
+ * Entries are generated by a counter-based generator keyed on the seed, the
+ * number of fills since init_random, and the entry's global row and column, so
+ * each rank fills only its local entries and no communication is needed. All
+ * ranks must perform the same sequence of fills.
  */
 void gaussian_fill(ElMat& mat, El::Int m, El::Int n, DataType mean = 0.0f,
                    DataType stddev = 1.0f);
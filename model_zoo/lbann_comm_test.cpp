@@ -114,6 +114,34 @@ void test_intermodel_sum_matrix() {
   fini_comm(comm);
 }
 
+/**
+ * Verify non-blocking inter-model sums of a view that skips its last row
+ * (LDim != Height) work by packing.
+ */
+void test_nb_intermodel_sum_view() {
+  lbann_comm* comm = init_comm();
+  Mat mat;
+  El::Ones(mat, LBANN_COMM_TEST_NROWS + 1, LBANN_COMM_TEST_NCOLS);
+  for (int col = 0; col < mat.Width(); ++col) {
+    mat.Set(LBANN_COMM_TEST_NROWS, col, 7.0f);
+  }
+  Mat view = mat(El::IR(0, LBANN_COMM_TEST_NROWS), El::ALL);
+  ASSERT_NEQ(view.LDim(), view.Height());
+  std::vector<DataType> buf;
+  lbann_mpi_req<DataType> req;
+  comm->nb_intermodel_sum_matrices({&view}, buf, req);
+  comm->wait<DataType>(req);
+  comm->unpack_matrices({&view}, buf);
+  for (int col = 0; col < mat.Width(); ++col) {
+    for (int row = 0; row < LBANN_COMM_TEST_NROWS; ++row) {
+      ASSERT_EQ(mat.Get(row, col), (float) LBANN_COMM_TEST_NUM_MODELS);
+    }
+    // The skipped row is left alone.
+    ASSERT_EQ(mat.Get(LBANN_COMM_TEST_NROWS, col), 7.0f);
+  }
+  fini_comm(comm);
+}
+
 /** Verify inter-model matrix broadcast works. */
 void test_intermodel_broadcast_matrix() {
   lbann_comm* comm = init_comm();
@@ -210,6 +238,33 @@ void test_broadcast_mat() {
   fini_comm(comm);
 }
 
+/** Verify pipelined broadcasts and cached communicators work. */
+void test_broadcast_pipelined() {
+  lbann_comm* comm = init_comm();
+  // Small chunks so the broadcast is pipelined.
+  comm->set_bcast_chunk_bytes(16 * sizeof(int));
+  std::vector<int> data(1000);
+  std::vector<int> dests(3);
+  dests[0] = comm->get_world_rank(1, comm->get_rank_in_model());
+  dests[1] = comm->get_world_rank(2, comm->get_rank_in_model());
+  dests[2] = comm->get_world_rank(3, comm->get_rank_in_model());
+  for (int iter = 0; iter < 3; ++iter) {
+    for (size_t i = 0; i < data.size(); ++i) {
+      data[i] = comm->get_model_rank() == 0 ? (int) i + iter : -1;
+    }
+    comm->broadcast(data.data(), data.size(), dests,
+                    comm->get_world_rank(0, comm->get_rank_in_model()));
+    for (size_t i = 0; i < data.size(); ++i) {
+      ASSERT_EQ(data[i], (int) i + iter);
+    }
+    // The same set of processes reuses one communicator.
+    ASSERT_EQ(comm->get_num_cached_bcast_comms(), 1u);
+  }
+  comm->clear_bcast_comm_cache();
+  ASSERT_EQ(comm->get_num_cached_bcast_comms(), 0u);
+  fini_comm(comm);
+}
+
 // Run with srun -n8 --tasks-per-node=12 
 int main(int argc, char** argv) {
   El::Initialize(argc, argv);
@@ -220,11 +275,13 @@ int main(int argc, char** argv) {
     test_grid();
     test_mat();
     test_intermodel_sum_matrix();
+    test_nb_intermodel_sum_view();
     test_intermodel_broadcast_matrix();
     test_send_recv_blob();
     test_send_recv_mat();
     test_broadcast_blob();
     test_broadcast_mat();
+    test_broadcast_pipelined();
     El::mpi::Barrier(El::mpi::COMM_WORLD);
     if (El::mpi::Rank(El::mpi::COMM_WORLD) == 0) {
       std::cout << "All tests passed" << std::endl;
@@ -29,6 +29,7 @@
 #include "lbann/lbann.hpp"
 #include "lbann/data_readers/lbann_data_reader_mnist.hpp"
 #include "lbann/callbacks/lbann_callback_imcomm.hpp"
+#include "lbann/callbacks/lbann_callback_easgd.hpp"
 
 using namespace std;
 using namespace lbann;
@@ -87,6 +88,9 @@ int main(int argc, char* argv[])
 
     // Set up the communicator and get the grid.
     comm = new lbann_comm(trainParams.ProcsPerModel);
+    if (!trainParams.CommProfile.empty()) {
+      comm->enable_profiling(trainParams.CommProfile);
+    }
     Grid& grid = comm->get_model_grid();
     if (comm->am_world_master()) {
       cout << "Number of models: " << comm->get_num_models() << 
@@ -221,7 +225,34 @@ int main(int argc, char* argv[])
       static_cast<lbann_callback_imcomm::comm_type>(
         trainParams.IntermodelCommMethod),
       {fcidx1, fcidx2, fcidx3, smidx}, &summarizer);
+    imcomm_cb.set_averaging_params(trainParams.IntermodelAveragingPeriod,
+                                   trainParams.IntermodelSlowMomentum);
+    if (trainParams.WeightQuantization >= 0) {
+      imcomm_cb.set_averaging_quantization(
+        trainParams.WeightQuantization == 0 ?
+        lbann_callback_imcomm::ONEBIT_QUANTIZATION :
+        lbann_callback_imcomm::ADAPTIVE_THRESH_QUANTIZATION,
+        trainParams.WeightQuantization);
+    }
+    imcomm_cb.set_bucket_size(
+      static_cast<size_t>(trainParams.IntermodelBucketMB * 1024 * 1024));
+    imcomm_cb.set_deferred_updates(trainParams.IntermodelDeferUpdates);
+    imcomm_cb.set_overlap_sums(trainParams.IntermodelOverlapSums);
+    imcomm_cb.set_topk_proportion(trainParams.IntermodelTopKProportion);
+    imcomm_cb.set_qsgd_bits(trainParams.IntermodelQSGDBits);
+    imcomm_cb.set_adaptive_params(trainParams.IntermodelTargetBytes,
+                                  trainParams.IntermodelWarmupSteps);
     dnn.add_callback(&imcomm_cb);
+    // Elastic averaging between models (use with --imcomm 0).
+    lbann_callback_easgd easgd_cb(
+      std::max(trainParams.EASGDPeriod, 1), trainParams.EASGDAlpha,
+      {fcidx1, fcidx2, fcidx3, smidx}, &summarizer);
+    if (trainParams.WeightQuantization >= 0) {
+      easgd_cb.set_center_quantization(trainParams.WeightQuantization);
+    }
+    if (trainParams.EASGDPeriod > 0) {
+      dnn.add_callback(&easgd_cb);
+    }
     lbann_callback_acc_learning_rate lrsched(4, 0.1f);
     dnn.add_callback(&lrsched);
     // lbann_callback_io io_cb({0,4}); // Monitor layers 0 and 4
@@ -252,7 +283,7 @@ int main(int argc, char* argv[])
     dnn.setup();
 
     // Reinitialize the RNG differently for each rank.
-    init_random(comm->get_rank_in_world() + 1);
+    init_local_random(comm->get_rank_in_world() + 1);
 
     comm->global_barrier();
 
@@ -265,6 +296,9 @@ int main(int argc, char* argv[])
   catch (lbann_exception& e) { lbann_report_exception(e, comm); }
   catch (exception& e) { ReportException(e); }
 
+  // This writes the communication profile, if enabled.
+  delete comm;
+
   // free all resources by El and MPI
   Finalize();
 
@@ -0,0 +1,161 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+// lbann_imcomm_test.cpp - Tests inter-model gradient communication
+////////////////////////////////////////////////////////////////////////////////
+
+#include "lbann/lbann.hpp"
+#include "lbann/callbacks/lbann_callback_imcomm.hpp"
+#include "lbann/utils/lbann_random.hpp"
+#include "lbann_test_utils.hpp"
+
+using namespace lbann;
+
+// Configuration.
+#define LBANN_IMCOMM_TEST_MBSIZE 4
+#define LBANN_IMCOMM_TEST_NUM_FEATURES 6
+#define LBANN_IMCOMM_TEST_NUM_LABELS 3
+#define LBANN_IMCOMM_TEST_EPOCHS 3
+
+/** Synthetic data set whose entries depend only on the sample index. */
+class imcomm_test_data_reader : public DataReader {
+public:
+  imcomm_test_data_reader(int batch_size, int num_samples) :
+    DataReader(batch_size, false) {
+    for (int i = 0; i < num_samples; ++i) {
+      ShuffledIndices.push_back(i);
+    }
+  }
+
+  int fetch_data(Mat& X) {
+    if (!position_valid()) {
+      return 0;
+    }
+    int n = 0;
+    for (n = CurrentPos; n < CurrentPos + getBatchSize(); ++n) {
+      if (n >= (int) ShuffledIndices.size()) {
+        break;
+      }
+      const int index = ShuffledIndices[n];
+      for (int f = 0; f < LBANN_IMCOMM_TEST_NUM_FEATURES; ++f) {
+        X.Set(f, n - CurrentPos, std::sin(DataType(index * 7 + f)));
+      }
+    }
+    return n - CurrentPos;
+  }
+
+  int fetch_label(Mat& Y) {
+    if (!position_valid()) {
+      return 0;
+    }
+    int n = 0;
+    for (n = CurrentPos; n < CurrentPos + getBatchSize(); ++n) {
+      if (n >= (int) ShuffledIndices.size()) {
+        break;
+      }
+      const int index = ShuffledIndices[n];
+      Y.Set(index % LBANN_IMCOMM_TEST_NUM_LABELS, n - CurrentPos, 1);
+    }
+    return n - CurrentPos;
+  }
+
+  int getNumLabels() { return LBANN_IMCOMM_TEST_NUM_LABELS; }
+  int get_linearized_data_size() { return LBANN_IMCOMM_TEST_NUM_FEATURES; }
+  int get_linearized_label_size() { return LBANN_IMCOMM_TEST_NUM_LABELS; }
+};
+
+/**
+ * Train a small model whose gradients are summed between models with
+ * per-layer non-blocking sums and return copies of its layers' local weights.
+ */
+std::vector<Mat> train_model(lbann_comm* comm, bool defer) {
+  init_random(42);
+  imcomm_test_data_reader data_reader(
+    LBANN_IMCOMM_TEST_MBSIZE,
+    4 * comm->get_num_models() * LBANN_IMCOMM_TEST_MBSIZE);
+  std::map<execution_mode, DataReader*> data_readers = {
+    std::make_pair(execution_mode::training, &data_reader)};
+  Optimizer_factory* optimizer = new SGD_factory(comm, 0.1f, 0.9f, 0.0f,
+                                                 true);
+  layer_factory* lfac = new layer_factory();
+  std::vector<Mat> weights;
+  {
+    deep_neural_network dnn(LBANN_IMCOMM_TEST_MBSIZE, comm, lfac, optimizer);
+    dnn.add(new input_layer_distributed_minibatch(
+              comm, LBANN_IMCOMM_TEST_MBSIZE, data_readers));
+    uint fcidx1 = dnn.add("FullyConnected", 5, activation_type::SIGMOID,
+                          weight_initialization::glorot_uniform, {});
+    uint fcidx2 = dnn.add("FullyConnected", 4, activation_type::SIGMOID,
+                          weight_initialization::glorot_uniform, {});
+    uint smidx = dnn.add("Softmax", LBANN_IMCOMM_TEST_NUM_LABELS,
+                         activation_type::ID,
+                         weight_initialization::glorot_uniform, {});
+    dnn.add(new target_layer_distributed_minibatch(
+              comm, LBANN_IMCOMM_TEST_MBSIZE, data_readers, true));
+    lbann_callback_imcomm imcomm_cb(lbann_callback_imcomm::NORMAL,
+                                    {fcidx1, fcidx2, smidx});
+    imcomm_cb.set_deferred_updates(defer);
+    dnn.add_callback(&imcomm_cb);
+    dnn.setup();
+    dnn.train(LBANN_IMCOMM_TEST_EPOCHS);
+    // Make sure the deferred path actually ran.
+    if (defer && comm->get_num_models() > 1) {
+      ASSERT_TRUE(imcomm_cb.get_num_deferred_updates() > 0);
+    } else {
+      ASSERT_EQ(imcomm_cb.get_num_deferred_updates(), 0u);
+    }
+    for (uint idx : {fcidx1, fcidx2, smidx}) {
+      Layer* layer = dnn.get_layers()[idx];
+      ASSERT_FALSE(layer->has_pending_update());
+      weights.emplace_back();
+      Copy(layer->get_weights_biases().LockedMatrix(), weights.back());
+    }
+  }
+  delete optimizer;
+  return weights;
+}
+
+/**
+ * Deferring updates to the next mini-batch's forward propagation must give
+ * the same weights as updating at the end of each mini-batch.
+ */
+void test_deferred_updates(lbann_comm* comm) {
+  std::vector<Mat> expected = train_model(comm, false);
+  std::vector<Mat> deferred = train_model(comm, true);
+  ASSERT_EQ(deferred.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    ASSERT_MAT_EQ(deferred[i], expected[i]);
+  }
+}
+
+int main(int argc, char** argv) {
+  El::Initialize(argc, argv);
+  lbann_comm* comm = new lbann_comm(1);
+  // Compare against flat sums; hierarchical sums would not overlap.
+  comm->set_hierarchical_sum(false);
+  test_deferred_updates(comm);
+  delete comm;
+  El::Finalize();
+  return 0;
+}
@@ -0,0 +1,208 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_layer_test.cpp - Tests layers
+////////////////////////////////////////////////////////////////////////////////
+
+#include "lbann/lbann.hpp"
+#include "lbann/utils/lbann_random.hpp"
+#include "lbann_test_utils.hpp"
+
+using namespace lbann;
+
+// Configuration.
+#define LBANN_LAYER_TEST_MBSIZE 6
+
+/**
+ * Make X into an (height + 1) x width matrix of uniform entries with a bottom
+ * row of ones (the bias row).
+ */
+void make_input(ElMat& X, int height, int width) {
+  uniform_fill(X, height + 1, width, DataType(0), DataType(1));
+  for (int row = 0; row < X.LocalHeight(); ++row) {
+    if (X.GlobalRow(row) == height) {
+      for (int col = 0; col < X.LocalWidth(); ++col) {
+        X.SetLocal(row, col, DataType(1));
+      }
+    }
+  }
+}
+
+/**
+ * Check that folding bn's running statistics into layer (which has
+ * num_prev_neurons inputs, read from X) leaves the output unchanged, and that
+ * training again restores layer's weights.
+ */
+void check_fold(Layer* layer, batch_normalization* bn, ElMat& X,
+                int num_prev_neurons) {
+  layer->setup_fp_input(&X);
+  layer->setup(num_prev_neurons);
+  bn->setup_fp_input(layer->fp_output());
+  bn->setup(layer->NumNeurons);
+  // Use a scale and shift that differ between channels.
+  Mat& gamma_beta = bn->WB->Matrix();
+  for (int channel = 0; channel < gamma_beta.Height(); ++channel) {
+    gamma_beta.Set(channel, 0, DataType(0.5 + channel));
+    gamma_beta.Set(channel, 1, DataType(0.25 * channel - 0.5));
+  }
+  // Accumulate running statistics.
+  for (int step = 0; step < 5; ++step) {
+    make_input(X, num_prev_neurons, LBANN_LAYER_TEST_MBSIZE);
+    layer->forwardProp(0.0f);
+    bn->forwardProp(0.0f);
+  }
+  // Folding is rejected while training.
+  bool rejected = false;
+  try {
+    bn->fold();
+  } catch (const lbann_exception&) {
+    rejected = true;
+  }
+  ASSERT_TRUE(rejected);
+  ASSERT_FALSE(bn->is_folded());
+  layer->set_execution_mode(execution_mode::testing);
+  bn->set_execution_mode(execution_mode::testing);
+  make_input(X, num_prev_neurons, LBANN_LAYER_TEST_MBSIZE);
+  layer->forwardProp(0.0f);
+  bn->forwardProp(0.0f);
+  Mat expected;
+  Copy(bn->Acts->LockedMatrix(), expected);
+  Mat weights;
+  Copy(layer->WB->LockedMatrix(), weights);
+  ASSERT_TRUE(bn->fold());
+  ASSERT_TRUE(bn->is_folded());
+  // Folding stays in effect for evaluation.
+  bn->set_execution_mode(execution_mode::testing);
+  ASSERT_TRUE(bn->is_folded());
+  layer->forwardProp(0.0f);
+  bn->forwardProp(0.0f);
+  Mat folded;
+  Copy(bn->Acts->LockedMatrix(), folded);
+  ASSERT_MAT_EQ_TOL(folded, expected, 1e-4f);
+  // Training restores the original weights exactly.
+  layer->set_execution_mode(execution_mode::training);
+  bn->set_execution_mode(execution_mode::training);
+  ASSERT_FALSE(bn->is_folded());
+  Mat restored;
+  Copy(layer->WB->LockedMatrix(), restored);
+  ASSERT_MAT_EQ_TOL(restored, weights, 0.0f);
+}
+
+void test_fold_fully_connected(lbann_comm* comm) {
+  const int num_prev_neurons = 7;
+  const int num_neurons = 5;
+  DistMat X(comm->get_model_grid());
+  FullyConnectedLayer fc(1, num_prev_neurons, num_neurons,
+                         LBANN_LAYER_TEST_MBSIZE, activation_type::ID,
+                         weight_initialization::glorot_uniform, comm, nullptr);
+  batch_normalization bn(2, num_neurons, num_neurons, LBANN_LAYER_TEST_MBSIZE,
+                         activation_type::ID, matrix_format::MC_MR, comm,
+                         nullptr, &fc);
+  check_fold(&fc, &bn, X, num_prev_neurons);
+}
+
+void test_fold_convolutional(lbann_comm* comm) {
+  const int num_input_channels = 2;
+  const int num_output_channels = 3;
+  const int input_dims[] = {5, 5};
+  const int filter_dims[] = {3, 3};
+  const int conv_pads[] = {1, 1};
+  const int conv_strides[] = {1, 1};
+  StarVCMat X(comm->get_model_grid());
+  convolutional_layer conv(1, 2, num_input_channels, input_dims,
+                           num_output_channels, filter_dims, conv_pads,
+                           conv_strides, LBANN_LAYER_TEST_MBSIZE,
+                           activation_type::ID,
+                           weight_initialization::glorot_uniform, comm,
+                           nullptr, {});
+  batch_normalization bn(2, conv.NumNeurons, num_output_channels,
+                         LBANN_LAYER_TEST_MBSIZE, activation_type::ID,
+                         matrix_format::STAR_VC, comm, nullptr, &conv);
+  check_fold(&conv, &bn, X, num_input_channels * 5 * 5);
+  // A transform that varies within a channel cannot be folded.
+  Mat weights;
+  Copy(conv.WB->LockedMatrix(), weights);
+  std::vector<DataType> scale(conv.NumNeurons, DataType(2));
+  std::vector<DataType> shift(conv.NumNeurons, DataType(0));
+  scale[1] = DataType(3);
+  ASSERT_FALSE(conv.fold_output_affine(scale, shift));
+  scale[1] = DataType(2);
+  shift[1] = DataType(1);
+  ASSERT_FALSE(conv.fold_output_affine(scale, shift));
+  Mat unchanged;
+  Copy(conv.WB->LockedMatrix(), unchanged);
+  ASSERT_MAT_EQ_TOL(unchanged, weights, 0.0f);
+}
+
+/** The padding columns of a partial mini-batch must not affect statistics. */
+void test_partial_minibatch(lbann_comm* comm) {
+  const int num_neurons = 8;
+  const int num_samples = 4;
+  DistMat X(comm->get_model_grid());
+  batch_normalization bn(1, num_neurons, num_neurons, LBANN_LAYER_TEST_MBSIZE,
+                         activation_type::ID, matrix_format::MC_MR, comm,
+                         nullptr);
+  bn.setup_fp_input(&X);
+  bn.setup(num_neurons);
+  bn.set_cur_minibatch_size(num_samples);
+  make_input(X, num_neurons, LBANN_LAYER_TEST_MBSIZE);
+  bn.forwardProp(0.0f);
+  DistMat expected(comm->get_model_grid());
+  Copy(*bn.Acts, expected);
+  // Change the padding and normalize again.
+  for (int col = 0; col < X.LocalWidth(); ++col) {
+    if (X.GlobalCol(col) >= num_samples) {
+      for (int row = 0; row < X.LocalHeight(); ++row) {
+        if (X.GlobalRow(row) < num_neurons) {
+          X.SetLocal(row, col, DataType(100));
+        }
+      }
+    }
+  }
+  bn.forwardProp(0.0f);
+  DistMat output(comm->get_model_grid());
+  Copy(*bn.Acts, output);
+  for (int col = 0; col < output.LocalWidth(); ++col) {
+    if (output.GlobalCol(col) >= num_samples) {
+      continue;
+    }
+    for (int row = 0; row < output.LocalHeight(); ++row) {
+      ASSERT_TRUE(std::fabs(output.GetLocal(row, col) -
+                            expected.GetLocal(row, col)) <= 1e-5f);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  El::Initialize(argc, argv);
+  init_random(42);
+  lbann_comm* comm = new lbann_comm();
+  test_fold_fully_connected(comm);
+  test_fold_convolutional(comm);
+  test_partial_minibatch(comm);
+  delete comm;
+  El::Finalize();
+  return 0;
+}
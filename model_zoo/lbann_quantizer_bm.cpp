@@ -28,188 +28,201 @@
 
 #include "lbann/lbann.hpp"
 #include "lbann/utils/lbann_quantizer.hpp"
+#include "lbann/utils/lbann_random.hpp"
 #include "lbann/utils/lbann_timer.hpp"
+#include <fstream>
+#include <functional>
+#include <sstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-/** Number of times to run the quantization. */
-const int num_trials = 20;
+/** Number of times to run each benchmark. */
+int num_trials = 20;
 
 using namespace lbann;
 
-// Summarizers for different approaches.
-lbann_summary* normal_summarizer;
-lbann_summary* onebit_summarizer;
-lbann_summary* thresh_summarizer;
-lbann_summary* comp_thresh_summarizer;
-lbann_summary* adaptive_summarizer;
-lbann_summary* comp_adaptive_summarizer;
+/** One point in the benchmark sweep. */
+struct bm_config {
+  /** Name of the matrix shape ("square", "tall", "wide" or "column"). */
+  std::string shape;
+  Int height;
+  Int width;
+  int num_models;
+  int procs_per_model;
+  int threads;
+  /** Fraction of entries that are zero. */
+  double sparsity;
+};
 
-std::vector<double> test_normal(lbann_comm* comm, DistMat& mat) {
+/** Measurements of one method at one point in the sweep. */
+struct bm_result {
+  std::string method;
+  /** Time of each trial. */
   std::vector<double> times;
-  for (int trial = 0; trial < num_trials; ++trial) {
-    double start = get_time();
-    comm->intermodel_sum_matrix(mat);
-    double tot = get_time() - start;
-    times.push_back(tot);
-    normal_summarizer->reduce_scalar("time", tot, trial);
-    comm->global_barrier();
-  }
-  return times;
-}
+  /** Relative Frobenius norm error of one sum versus the exact sum. */
+  double rel_error = 0.0;
+  /** Per-trial bytes sent and received by this process. */
+  double bytes_sent = 0.0;
+  double bytes_received = 0.0;
+  /** Per-trial time spent in each phase of the quantized sums. */
+  double rs_time = 0.0;
+  double ag_time = 0.0;
+  double rs_send_trans_time = 0.0;
+  double rs_recv_trans_time = 0.0;
+  double ag_reduced_trans_time = 0.0;
+  double ag_recv_trans_time = 0.0;
+};
 
-void quantize_summary(lbann_summary* summarizer, lbann_quantizer& quantizer,
-                      int trial) {  
-  summarizer->reduce_scalar("bytes_sent",
-                            quantizer.get_bytes_sent(),
-                            trial);
-  summarizer->reduce_scalar("bytes_received",
-                            quantizer.get_bytes_received(),
-                            trial);
-  summarizer->reduce_scalar("rs_bytes_sent",
-                            quantizer.get_rs_bytes_sent(),
-                            trial);
-  summarizer->reduce_scalar("ag_bytes_sent",
-                            quantizer.get_ag_bytes_sent(),
-                            trial);
-  summarizer->reduce_scalar("rs_bytes_received",
-                            quantizer.get_rs_bytes_received(),
-                            trial);
-  summarizer->reduce_scalar("ag_bytes_received",
-                            quantizer.get_ag_bytes_received(),
-                            trial);
-  summarizer->reduce_scalar("rs_time",
-                            quantizer.get_rs_time(),
-                            trial);
-  summarizer->reduce_scalar("ag_time",
-                            quantizer.get_ag_time(),
-                            trial);
-  summarizer->reduce_scalar("rs_send_trans_time",
-                            quantizer.get_rs_send_trans_time(),
-                            trial);
-  summarizer->reduce_scalar("rs_recv_buf_time",
-                            quantizer.get_rs_recv_buf_time(),
-                            trial);
-  summarizer->reduce_scalar("rs_recv_trans_time",
-                            quantizer.get_rs_recv_trans_time(),
-                            trial);
-  summarizer->reduce_scalar("ag_reduced_trans_time",
-                            quantizer.get_ag_reduced_trans_time(),
-                            trial);
-  summarizer->reduce_scalar("ag_recv_buf_time",
-                            quantizer.get_ag_recv_buf_time(),
-                            trial);
-  summarizer->reduce_scalar("ag_recv_trans_time",
-                            quantizer.get_ag_recv_trans_time(),
-                            trial);
-  summarizer->reduce_scalar("pta_time",
-                            quantizer.get_pta_time(),
-                            trial);
-  summarizer->reduce_scalar("pta_pos_time",
-                            quantizer.get_pta_pos_time(),
-                            trial);
-  quantizer.reset_bytes_counters();
-  quantizer.reset_time_counters();
-}
+/** A method of summing a matrix over models. */
+struct sum_method {
+  std::string name;
+  std::function<void(lbann_comm*, lbann_quantizer&, DistMat&, Mat&, Mat&)>
+    sum;
+};
 
-std::vector<double> test_onebit(lbann_comm* comm, DistMat& mat) {
-  std::vector<double> times;
-  lbann_quantizer quantizer;
-  Mat qerror;
-  Mat im_qerror;
-  // Allocate here, prevents messing with timing.
-  Zeros(qerror, mat.LocalHeight(), mat.LocalWidth());
-  for (int trial = 0; trial < num_trials; ++trial) {
-    double start = get_time();
-    quantizer.intermodel_sum_quantized(comm, mat, qerror, im_qerror,
-                                       false);
-    double tot = get_time() - start;
-    times.push_back(tot);
-    onebit_summarizer->reduce_scalar("time", tot, trial);
-    quantize_summary(onebit_summarizer, quantizer, trial);
-    comm->global_barrier();
+/** Return the methods to benchmark with num_models models. */
+std::vector<sum_method> get_methods(int num_models) {
+  // Entries are uniform in [-4, 4].
+  const DataType thresh = 3.875f;
+  const int proportion = 64;
+  std::vector<sum_method> methods;
+  methods.push_back({"normal",
+        [] (lbann_comm* comm, lbann_quantizer&, DistMat& mat, Mat&, Mat&) {
+          comm->intermodel_sum_matrix(mat);
+        }});
+  methods.push_back({"onebit_ring",
+        [] (lbann_comm* comm, lbann_quantizer& quantizer, DistMat& mat,
+            Mat& qerror, Mat& im_qerror) {
+          quantizer.set_collective_algorithm(
+            lbann_quantizer::collective_algorithm::RING);
+          quantizer.intermodel_sum_quantized(comm, mat, qerror, im_qerror);
+        }});
+  // Recursive halving/doubling needs a power-of-two number of models.
+  if ((num_models & (num_models - 1)) == 0) {
+    methods.push_back({"onebit_recursive",
+          [] (lbann_comm* comm, lbann_quantizer& quantizer, DistMat& mat,
+              Mat& qerror, Mat& im_qerror) {
+            quantizer.set_collective_algorithm(
+              lbann_quantizer::collective_algorithm::RECURSIVE);
+            quantizer.intermodel_sum_quantized(comm, mat, qerror, im_qerror);
+          }});
   }
-  return times;
-}
-
-std::vector<double> test_thresh(lbann_comm* comm, DistMat& mat,
-                                float thresh) {
-  std::vector<double> times;
-  lbann_quantizer quantizer;
-  Mat qerror;
-  Mat im_qerror;
-  // Allocate here, prevents messing with timing.
-  Zeros(qerror, mat.LocalHeight(), mat.LocalWidth());
-  for (int trial = 0; trial < num_trials; ++trial) {
-    double start = get_time();
-    quantizer.intermodel_sum_threshold_quantized(
-      comm, mat, qerror, thresh, -thresh, im_qerror, false);
-    double tot = get_time() - start;
-    times.push_back(tot);
-    thresh_summarizer->reduce_scalar("time", tot, trial);
-    quantize_summary(thresh_summarizer, quantizer, trial);
-    comm->global_barrier();
+  for (int bits : {2, 4, 8}) {
+    methods.push_back({"qsgd" + std::to_string(bits),
+          [bits] (lbann_comm* comm, lbann_quantizer& quantizer, DistMat& mat,
+                  Mat& qerror, Mat& im_qerror) {
+            quantizer.intermodel_sum_qsgd(comm, mat, qerror, im_qerror, bits);
+          }});
   }
-  return times;
+  for (bool compress : {false, true}) {
+    const std::string prefix = compress ? "comp_" : "";
+    methods.push_back({prefix + "thresh",
+          [thresh, compress] (lbann_comm* comm, lbann_quantizer& quantizer,
+                              DistMat& mat, Mat& qerror, Mat& im_qerror) {
+            quantizer.intermodel_sum_threshold_quantized(
+              comm, mat, qerror, thresh, -thresh, im_qerror, compress);
+          }});
+    methods.push_back({prefix + "adaptive" + std::to_string(proportion),
+          [proportion, compress] (lbann_comm* comm, lbann_quantizer& quantizer,
+                                  DistMat& mat, Mat& qerror, Mat& im_qerror) {
+            quantizer.intermodel_sum_adaptive_threshold_quantized(
+              comm, mat, qerror, proportion, im_qerror, compress);
+          }});
+  }
+  methods.push_back({"topk" + std::to_string(proportion),
+        [proportion] (lbann_comm* comm, lbann_quantizer& quantizer,
+                      DistMat& mat, Mat& qerror, Mat&) {
+          quantizer.intermodel_sum_topk(comm, mat, qerror, proportion);
+        }});
+  return methods;
 }
 
-std::vector<double> test_comp_thresh(lbann_comm* comm, DistMat& mat,
-                                     float thresh) {
-  std::vector<double> times;
+/**
+ * Benchmark method on mat: measure the error of one sum from fresh
+ * quantization errors, then time num_trials sums of mat, keeping the errors
+ * between trials as training would.
+ */
+bm_result run_method(lbann_comm* comm, const sum_method& method,
+                     const DistMat& mat) {
+  bm_result result;
+  result.method = method.name;
   lbann_quantizer quantizer;
   Mat qerror;
   Mat im_qerror;
-  // Allocate here, prevents messing with timing.
-  Zeros(qerror, mat.LocalHeight(), mat.LocalWidth());
+  DistMat exact(mat);
+  comm->intermodel_sum_matrix(exact);
+  DistMat work(mat);
+  method.sum(comm, quantizer, work, qerror, im_qerror);
+  const DataType exact_norm = FrobeniusNorm(exact);
+  Axpy(DataType(-1), exact, work);
+  const DataType err_norm = FrobeniusNorm(work);
+  result.rel_error = exact_norm > 0.0f ? err_norm / exact_norm : err_norm;
+  quantizer.reset_bytes_counters();
+  quantizer.reset_time_counters();
+  comm->reset_stats_counters();
   for (int trial = 0; trial < num_trials; ++trial) {
-    double start = get_time();
-    quantizer.intermodel_sum_threshold_quantized(
-      comm, mat, qerror, thresh, -thresh, im_qerror, true);
-    double tot = get_time() - start;
-    times.push_back(tot);
-    comp_thresh_summarizer->reduce_scalar("time", tot, trial);
-    quantize_summary(comp_thresh_summarizer, quantizer, trial);
+    Copy(mat, work);
     comm->global_barrier();
+    double start = get_time();
+    method.sum(comm, quantizer, work, qerror, im_qerror);
+    result.times.push_back(get_time() - start);
   }
-  return times;
+  result.bytes_sent = double(comm->get_bytes_sent()) / num_trials;
+  result.bytes_received = double(comm->get_bytes_received()) / num_trials;
+  result.rs_time = quantizer.get_rs_time() / num_trials;
+  result.ag_time = quantizer.get_ag_time() / num_trials;
+  result.rs_send_trans_time = quantizer.get_rs_send_trans_time() / num_trials;
+  result.rs_recv_trans_time = quantizer.get_rs_recv_trans_time() / num_trials;
+  result.ag_reduced_trans_time =
+    quantizer.get_ag_reduced_trans_time() / num_trials;
+  result.ag_recv_trans_time = quantizer.get_ag_recv_trans_time() / num_trials;
+  // work is freed on return, so do not leave its buffers in comm's pool.
+  quantizer.release_buffers(comm, work);
+  return result;
 }
 
-std::vector<double> test_adaptive(lbann_comm* comm, DistMat& mat,
-                                  int proportion) {
+/** Time local one-bit quantization and unquantization with nthreads. */
+std::vector<double> test_onebit_kernels(DistMat& mat, int nthreads) {
   std::vector<double> times;
+#ifdef _OPENMP
+  const int prev_threads = omp_get_max_threads();
+  omp_set_num_threads(nthreads);
+#endif
   lbann_quantizer quantizer;
+  lbann_quantizer::QuantizedMatrix qmat;
   Mat qerror;
-  Mat im_qerror;
-  // Allocate here, prevents messing with timing.
   Zeros(qerror, mat.LocalHeight(), mat.LocalWidth());
+  Mat uqmat(mat.LocalHeight(), mat.LocalWidth());
   for (int trial = 0; trial < num_trials; ++trial) {
     double start = get_time();
-    quantizer.intermodel_sum_adaptive_threshold_quantized(
-      comm, mat, qerror, proportion, im_qerror, false);
-    double tot = get_time() - start;
-    times.push_back(tot);
-    adaptive_summarizer->reduce_scalar("time", tot, trial);
-    quantize_summary(adaptive_summarizer, quantizer, trial);
-    comm->global_barrier();
+    quantizer.quantize(mat, qmat, qerror);
+    quantizer.unquantize(qmat, uqmat);
+    times.push_back(get_time() - start);
   }
+#ifdef _OPENMP
+  omp_set_num_threads(prev_threads);
+#endif
   return times;
 }
 
-std::vector<double> test_comp_adaptive(lbann_comm* comm, DistMat& mat,
-                                       int proportion) {
+/** Time Golomb-Rice compression and uncompression of threshold output. */
+std::vector<double> test_thresh_codec(DistMat& mat, float thresh) {
   std::vector<double> times;
   lbann_quantizer quantizer;
+  lbann_quantizer::ThreshQuantized q;
   Mat qerror;
-  Mat im_qerror;
-  // Allocate here, prevents messing with timing.
   Zeros(qerror, mat.LocalHeight(), mat.LocalWidth());
+  quantizer.threshold_quantize(mat, q, qerror, thresh, -thresh, true);
+  lbann_quantizer::ThreshQuantized comp;
+  lbann_quantizer::ThreshQuantized uncomp;
   for (int trial = 0; trial < num_trials; ++trial) {
+    comp.clear();
+    uncomp.clear();
     double start = get_time();
-    quantizer.intermodel_sum_adaptive_threshold_quantized(
-      comm, mat, qerror, proportion, im_qerror, true);
-    double tot = get_time() - start;
-    times.push_back(tot);
-    comp_adaptive_summarizer->reduce_scalar("time", tot, trial);
-    quantize_summary(comp_adaptive_summarizer, quantizer, trial);
-    comm->global_barrier();
+    quantizer.compress_thresholds(q, comp);
+    quantizer.uncompress_thresholds(comp, uncomp);
+    times.push_back(get_time() - start);
   }
   return times;
 }
@@ -234,83 +247,270 @@ void print_stats(const std::vector<double>& times) {
   std::cout << std::endl;
 }
 
-void test_mat(lbann_comm* comm, DistMat& mat) {
-  DistMat normal_copy(mat);
-  auto normal_times = test_normal(comm, normal_copy);
-  if (comm->am_world_master()) {
-    std::cout << "Normal (" << mat.Height() << "x" << mat.Width() << "):" <<
-      std::endl;
-    print_stats(normal_times);
+/**
+ * Compare adaptive threshold estimators against the exact threshold, printing
+ * the time and relative threshold error of each.
+ */
+void test_threshold_estimators(lbann_comm* comm, DistMat& mat,
+                               int proportion) {
+  lbann_quantizer quantizer;
+  const Mat& local_mat = mat.LockedMatrix();
+  Mat qerror;
+  Zeros(qerror, mat.LocalHeight(), mat.LocalWidth());
+  const DataType exact_thresh = std::get<0>(
+    quantizer.proportion_threshold_average(local_mat, qerror, proportion,
+                                           false));
+  const std::vector<std::string> names = {
+    "Exact select", "Sampled select", "Histogram", "Refined histogram"};
+  for (size_t i = 0; i < names.size(); ++i) {
+    std::vector<double> times;
+    DataType thresh = 0.0f;
+    for (int trial = 0; trial < num_trials; ++trial) {
+      double start = get_time();
+      switch (i) {
+      case 0:
+      case 1:
+        thresh = std::get<0>(quantizer.proportion_threshold_average(
+                               local_mat, qerror, proportion, i == 1));
+        break;
+      default:
+        thresh = std::get<0>(quantizer.histogram_threshold_average(
+                               local_mat, qerror, proportion, i == 3));
+        break;
+      }
+      times.push_back(get_time() - start);
+    }
+    if (comm->am_world_master()) {
+      std::cout << names[i] << " threshold (" << mat.Height() << "x" <<
+        mat.Width() << "), relative error " <<
+        std::fabs(thresh - exact_thresh) / exact_thresh << ":" << std::endl;
+      print_stats(times);
+    }
   }
-  normal_copy.Empty();
-  DistMat onebit_copy(mat);
-  auto onebit_times = test_onebit(comm, onebit_copy);
-  if (comm->am_world_master()) {
-    std::cout << "Onebit (" << mat.Height() << "x" << mat.Width() << "):" <<
-      std::endl;
-    print_stats(onebit_times);
+}
+
+/** One report field: its name, its value, and whether the value is text. */
+struct report_field {
+  std::string name;
+  std::string value;
+  bool is_text;
+};
+
+/** Return the report fields for result at config. */
+std::vector<report_field> get_report_fields(const bm_config& config,
+                                            const bm_result& result) {
+  auto num = [] (double val) {
+    std::ostringstream ss;
+    ss.precision(9);
+    ss << val;
+    return ss.str();
+  };
+  const std::vector<double>& times = result.times;
+  const double mean = std::accumulate(times.begin(), times.end(), 0.0) /
+    times.size();
+  auto minmax = std::minmax_element(times.begin(), times.end());
+  return {
+    {"shape", config.shape, true},
+    {"height", num(config.height), false},
+    {"width", num(config.width), false},
+    {"num_models", num(config.num_models), false},
+    {"procs_per_model", num(config.procs_per_model), false},
+    {"threads", num(config.threads), false},
+    {"sparsity", num(config.sparsity), false},
+    {"method", result.method, true},
+    {"trials", num(times.size()), false},
+    {"mean_time", num(mean), false},
+    {"min_time", num(*minmax.first), false},
+    {"max_time", num(*minmax.second), false},
+    {"rel_error", num(result.rel_error), false},
+    {"bytes_sent", num(result.bytes_sent), false},
+    {"bytes_received", num(result.bytes_received), false},
+    {"rs_time", num(result.rs_time), false},
+    {"ag_time", num(result.ag_time), false},
+    {"rs_send_trans_time", num(result.rs_send_trans_time), false},
+    {"rs_recv_trans_time", num(result.rs_recv_trans_time), false},
+    {"ag_reduced_trans_time", num(result.ag_reduced_trans_time), false},
+    {"ag_recv_trans_time", num(result.ag_recv_trans_time), false},
+  };
+}
+
+/**
+ * Write the report to path: JSON if path ends in ".json", otherwise CSV with
+ * one row per method and point in the sweep.
+ */
+void write_report(
+  const std::string& path,
+  const std::vector<std::pair<bm_config, bm_result>>& records) {
+  std::ofstream out(path);
+  if (!out) {
+    throw lbann_exception("lbann_quantizer_bm: cannot write " + path);
   }
-  onebit_copy.Empty();
-  DistMat thresh_copy(mat);
-  auto thresh_times = test_thresh(comm, thresh_copy, 3.875f);
-  if (comm->am_world_master()) {
-    std::cout << "Thresh (" << mat.Height() << "x" << mat.Width() << "):" <<
-      std::endl;
-    print_stats(thresh_times);
+  const bool json = path.size() >= 5 &&
+    path.compare(path.size() - 5, 5, ".json") == 0;
+  if (json) {
+    out << "{\"benchmark\": \"lbann_quantizer_bm\", \"results\": [";
   }
-  thresh_copy.Empty();
-  DistMat comp_thresh_copy(mat);
-  auto comp_thresh_times = test_comp_thresh(comm, comp_thresh_copy, 3.875f);
-  if (comm->am_world_master()) {
-    std::cout << "Compressed thresh (" << mat.Height() << "x" << mat.Width() <<
-      "):" << std::endl;
-    print_stats(comp_thresh_times);
+  for (size_t i = 0; i < records.size(); ++i) {
+    const std::vector<report_field> fields =
+      get_report_fields(records[i].first, records[i].second);
+    if (json) {
+      out << (i == 0 ? "\n  {" : ",\n  {");
+      for (size_t f = 0; f < fields.size(); ++f) {
+        out << (f == 0 ? "" : ", ") << "\"" << fields[f].name << "\": ";
+        if (fields[f].is_text) {
+          out << "\"" << fields[f].value << "\"";
+        } else {
+          out << fields[f].value;
+        }
+      }
+      out << "}";
+      continue;
+    }
+    if (i == 0) {
+      for (size_t f = 0; f < fields.size(); ++f) {
+        out << (f == 0 ? "" : ",") << fields[f].name;
+      }
+      out << std::endl;
+    }
+    for (size_t f = 0; f < fields.size(); ++f) {
+      out << (f == 0 ? "" : ",") << fields[f].value;
+    }
+    out << std::endl;
   }
-  comp_thresh_copy.Empty();
-  DistMat adaptive_copy(mat);
-  auto adaptive_times = test_adaptive(comm, adaptive_copy, 64);
-  if (comm->am_world_master()) {
-    std::cout << "Adaptive 64 " << "(" << mat.Height() << "x" <<
-      mat.Width() << "):" << std::endl;
-    print_stats(adaptive_times);
+  if (json) {
+    out << "\n]}" << std::endl;
+  }
+}
+
+/** Fill mat with entries uniform in [-4, 4], a sparsity fraction of them 0. */
+void make_matrix(DistMat& mat, Int height, Int width, double sparsity) {
+  El::Uniform(mat, height, width, 0.0f, 4.0f);
+  if (sparsity <= 0.0) {
+    return;
+  }
+  std::bernoulli_distribution zero(sparsity);
+  Mat& local = mat.Matrix();
+  for (Int col = 0; col < local.Width(); ++col) {
+    for (Int row = 0; row < local.Height(); ++row) {
+      if (zero(get_generator())) {
+        local.Set(row, col, 0.0f);
+      }
+    }
   }
-  adaptive_copy.Empty();
-  DistMat comp_adaptive_copy(mat);
-  auto comp_adaptive_times = test_comp_adaptive(comm, comp_adaptive_copy, 64);
+}
+
+/** Time the local kernels on mat, printing the results. */
+void test_kernels(lbann_comm* comm, DistMat& mat) {
+  // Scaling of the local one-bit kernels with the number of threads.
+  int max_threads = 1;
+#ifdef _OPENMP
+  max_threads = omp_get_max_threads();
+#endif
+  for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    auto kernel_times = test_onebit_kernels(mat, nthreads);
+    if (comm->am_world_master()) {
+      std::cout << "Onebit kernels, " << nthreads << " threads (" <<
+        mat.Height() << "x" << mat.Width() << "):" << std::endl;
+      print_stats(kernel_times);
+    }
+  }
+  auto codec_times = test_thresh_codec(mat, 3.875f);
   if (comm->am_world_master()) {
-    std::cout << "Compressed adaptive 64 " << "(" << mat.Height() <<
-      "x" << mat.Width() << "):" << std::endl;
-    print_stats(comp_adaptive_times);
+    std::cout << "Thresh codec (" << mat.Height() << "x" << mat.Width() <<
+      "):" << std::endl;
+    print_stats(codec_times);
   }
-  comp_adaptive_copy.Empty();
+  test_threshold_estimators(comm, mat, 64);
 }
 
 int main(int argc, char** argv) {
   El::Initialize(argc, argv);
-  lbann_comm* comm = new lbann_comm(2);
-  normal_summarizer = new lbann_summary("qbm/normal", comm);
-  onebit_summarizer = new lbann_summary("qbm/onebit", comm);
-  thresh_summarizer = new lbann_summary("qbm/thresh", comm);
-  comp_thresh_summarizer = new lbann_summary("qbm/comp_thresh", comm);
-  adaptive_summarizer = new lbann_summary("qbm/adaptive", comm);
-  comp_adaptive_summarizer = new lbann_summary("qbm/comp_adaptive", comm);
-
-  if (comm->am_world_master()) {
-    std::cout << "Models: " << comm->get_num_models() << std::endl;
-    std::cout << "Procs per model: " << comm->get_procs_per_model() << std::endl;
+  int ret = 0;
+  try {
+    // Entries in each benchmarked matrix; a power of 4 keeps shapes even.
+    const int entries = Input("--entries", "Entries per matrix", 1 << 20);
+    num_trials = Input("--trials", "Trials per benchmark", num_trials);
+    const std::string report_path = Input(
+      "--report", "Report file (CSV, or JSON if it ends in .json)",
+      std::string("quantizer_bm.csv"));
+    ProcessInput();
+    PrintInputReport();
+    const Int side = std::lround(std::sqrt(entries));
+    const Int narrow = std::max(side / 16, Int(1));
+    // Conv layer gradients are often a single column.
+    const std::vector<std::tuple<std::string, Int, Int>> shapes = {
+      std::make_tuple(std::string("square"), side, side),
+      std::make_tuple(std::string("tall"), side * 16, narrow),
+      std::make_tuple(std::string("wide"), narrow, side * 16),
+      std::make_tuple(std::string("column"), side * side, Int(1))};
+    int max_threads = 1;
+#ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+#endif
+    const std::vector<int> thread_counts = max_threads > 1 ?
+      std::vector<int>{1, max_threads} : std::vector<int>{1};
+    const std::vector<double> sparsities = {0.0, 0.9, 0.99};
+    // Sweep the number of models through the ways to split the processes.
+    const int world_size = mpi::Size(mpi::COMM_WORLD);
+    const bool world_master = mpi::Rank(mpi::COMM_WORLD) == 0;
+    std::vector<std::pair<bm_config, bm_result>> records;
+    for (int procs_per_model = 1; procs_per_model <= world_size;
+         ++procs_per_model) {
+      if (world_size % procs_per_model != 0) {
+        continue;
+      }
+      lbann_comm* comm = new lbann_comm(procs_per_model);
+      const std::vector<sum_method> methods =
+        get_methods(comm->get_num_models());
+      for (const auto& shape : shapes) {
+        bm_config config;
+        std::tie(config.shape, config.height, config.width) = shape;
+        config.num_models = comm->get_num_models();
+        config.procs_per_model = procs_per_model;
+        for (double sparsity : sparsities) {
+          config.sparsity = sparsity;
+          DistMat mat(comm->get_model_grid());
+          make_matrix(mat, config.height, config.width, sparsity);
+          if (procs_per_model == 1 && sparsity == 0.0) {
+            test_kernels(comm, mat);
+          }
+          for (int threads : thread_counts) {
+            config.threads = threads;
+#ifdef _OPENMP
+            omp_set_num_threads(threads);
+#endif
+            for (const sum_method& method : methods) {
+              records.emplace_back(config, run_method(comm, method, mat));
+              const bm_result& result = records.back().second;
+              if (world_master) {
+                std::cout << config.shape << " " << config.height << "x" <<
+                  config.width << ", " << config.num_models << " models, " <<
+                  threads << " threads, sparsity " << sparsity << ", " <<
+                  result.method << ": mean " <<
+                  std::accumulate(result.times.begin(), result.times.end(),
+                                  0.0) / result.times.size() <<
+                  "s, relative error " << result.rel_error << ", " <<
+                  result.bytes_sent << " bytes sent" << std::endl;
+              }
+            }
+          }
+#ifdef _OPENMP
+          omp_set_num_threads(max_threads);
+#endif
+        }
+      }
+      delete comm;
+    }
+    if (world_master) {
+      write_report(report_path, records);
+    }
+  } catch (lbann_exception& e) {
+    lbann_report_exception(e);
+    ret = 1;
+  } catch (std::exception& e) {
+    ReportException(e);
+    ret = 1;
   }
-  for (int mat_size = 64; mat_size <= 32768; mat_size *= 2) {
-    DistMat mat(comm->get_model_grid());
-    El::Uniform(mat, mat_size, mat_size, 0.0f, 4.0f);
-    test_mat(comm, mat);
-  }
-
-  delete normal_summarizer;
-  delete onebit_summarizer;
-  delete thresh_summarizer;
-  delete comp_thresh_summarizer;
-  delete adaptive_summarizer;
-  delete comp_adaptive_summarizer;
-  delete comm;
   El::Finalize();
+  return ret;
 }
@@ -27,12 +27,30 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include <stdlib.h>
+#include <new>
+#include <random>
 #include "lbann/lbann_comm.hpp"
 #include "lbann/utils/lbann_quantizer.hpp"
 #include "lbann_test_utils.hpp"
 
 using namespace lbann;
 
+/** Allocations at least this large are counted in large_allocs. */
+static const size_t LARGE_ALLOC_BYTES = 16384;
+/** Number of large allocations made so far. */
+static size_t large_allocs = 0;
+
+void* operator new(size_t size) {
+  if (size >= LARGE_ALLOC_BYTES) ++large_allocs;
+  void* ptr = malloc(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
 /** Test quantization and unquantization. */
 void test_quantize() {
   Mat mat;
@@ -76,6 +94,28 @@ void test_2value_quantize() {
   ASSERT_MAT_EQ(mat, uqmat);
 }
 
+/**
+ * Test QSGD quantization and unquantization. With the quantization error,
+ * we should have the original matrix.
+ */
+void test_qsgd_quantize() {
+  lbann_quantizer quantizer;
+  for (int bits : {2, 4, 8}) {
+    Mat mat;
+    El::Uniform(mat, 37, 10, 0.0f, 10.0f);
+    lbann_quantizer::QuantizedMatrix qmat;
+    Mat qerror;
+    El::Zeros(qerror, mat.Height(), mat.Width());
+    quantizer.qsgd_quantize(mat, qmat, qerror, bits);
+    Mat uqmat(mat.Height(), mat.Width());
+    quantizer.qsgd_unquantize(qmat, uqmat, bits);
+    ASSERT_MAT_NEQ(mat, uqmat);
+    Mat with_qerror(uqmat);
+    with_qerror += qerror;
+    ASSERT_MAT_EQ(mat, with_qerror);
+  }
+}
+
 /** Test threshold_quantize/unquantize. */
 void test_threshold_quantize() {
   Mat mat;
@@ -110,6 +150,47 @@ void test_compression() {
   ASSERT_VECTOR_EQ(in, out);
 }
 
+/** Test that the compressed format does not change. */
+void test_compression_format() {
+  lbann_quantizer::ThreshQuantized in = {40, 0, 1, 2, 517, 137};
+  lbann_quantizer::ThreshQuantized expected = {
+    0xFFC82043, 0xFABFFFFF, 0xFFFFFF97};
+  lbann_quantizer::ThreshQuantized comp;
+  lbann_quantizer quantizer;
+  quantizer.compress_thresholds(in, comp);
+  ASSERT_VECTOR_EQ(comp, expected);
+  // Empty input.
+  lbann_quantizer::ThreshQuantized empty;
+  lbann_quantizer::ThreshQuantized empty_comp;
+  lbann_quantizer::ThreshQuantized empty_out;
+  quantizer.compress_thresholds(empty, empty_comp);
+  ASSERT_EQ(empty_comp.size(), 1u);
+  quantizer.uncompress_thresholds(empty_comp, empty_out);
+  ASSERT_VECTOR_EQ(empty, empty_out);
+}
+
+/** Test compression round-trips with random inputs of varying sizes. */
+void test_compression_fuzz() {
+  std::mt19937 gen(1234);
+  lbann_quantizer quantizer;
+  for (int trial = 0; trial < 1000; ++trial) {
+    // Mix small and occasional large deltas so quotients span many words.
+    std::uniform_int_distribution<unsigned> len_dist(0, 300);
+    std::uniform_int_distribution<unsigned> small_dist(0, 40);
+    std::uniform_int_distribution<unsigned> large_dist(0, 100000);
+    std::bernoulli_distribution large(trial % 2 ? 0.1 : 0.0);
+    lbann_quantizer::ThreshQuantized in(len_dist(gen));
+    for (auto& v : in) {
+      v = large(gen) ? large_dist(gen) : small_dist(gen);
+    }
+    lbann_quantizer::ThreshQuantized comp;
+    lbann_quantizer::ThreshQuantized out;
+    quantizer.compress_thresholds(in, comp);
+    quantizer.uncompress_thresholds(comp, out);
+    ASSERT_VECTOR_EQ(in, out);
+  }
+}
+
 /** Test threshold compression/uncompression. */
 void test_threshold_compression() {
   Mat mat;
@@ -254,6 +335,68 @@ void test_quantize_allreduce() {
   delete comm;
 }
 
+/**
+ * Test the inter-model quantize-and-allreduce with a [*,*] matrix, where the
+ * processes in a model split the sum. Both a wide matrix and a column vector
+ * (which is split by rows) are checked.
+ */
+void test_quantize_allreduce_star() {
+  lbann_comm* comm = new lbann_comm(2);
+  for (int width : {10, 1}) {
+    StarMat mat(comm->get_model_grid());
+    El::Zeros(mat, 37, width);
+    // Each column has one positive and one negative value, so there should be
+    // no error.
+    Mat& local = mat.Matrix();
+    for (El::Int col = 0; col < local.Width(); ++col) {
+      for (El::Int row = 0; row < local.Height(); ++row) {
+        local.Set(row, col, (row + col) % 2 ? 1.0f : -1.0f);
+      }
+    }
+    Mat exact_sum(local);
+    comm->intermodel_sum_matrix(exact_sum);
+    Mat qerror;
+    Mat im_qerror;
+    lbann_quantizer quantizer;
+    quantizer.intermodel_sum_quantized(comm, mat, qerror, im_qerror);
+    ASSERT_MAT_EQ(mat.Matrix(), exact_sum);
+    quantizer.release_buffers(comm, mat);
+  }
+  delete comm;
+}
+
+/**
+ * Test the inter-model QSGD quantize-and-allreduce. Entries of +/-1 are
+ * exactly representable, so there should be no error.
+ */
+void test_qsgd_allreduce() {
+  lbann_comm* comm = new lbann_comm(2);
+  for (int bits : {2, 4, 8}) {
+    DistMat mat(comm->get_model_grid());
+    if (comm->get_model_rank() == 0) {
+      El::Rademacher(mat, 10, 10);
+      comm->intermodel_broadcast_matrix(mat, 0);
+    } else {
+      El::Zeros(mat, 10, 10);
+      comm->intermodel_broadcast_matrix(mat, 0);
+    }
+    if (comm->get_model_rank() % 2 == 1) {
+      El::Scale(-1, mat);
+    }
+    DistMat exact_sum(mat);
+    Mat qerror;
+    Mat im_qerror;
+    lbann_quantizer quantizer;
+    quantizer.intermodel_sum_qsgd(comm, mat, qerror, im_qerror, bits);
+    comm->intermodel_sum_matrix(exact_sum);
+    Mat z;
+    El::Zeros(z, mat.LocalHeight(), mat.LocalWidth());
+    ASSERT_MAT_EQ(qerror, z);
+    ASSERT_MAT_EQ(mat, exact_sum);
+  }
+  delete comm;
+}
+
 /** Test the inter-model threshold quantize-and-allreduce. */
 void test_threshold_quantize_allreduce() {
   lbann_comm* comm = new lbann_comm(2);
@@ -399,21 +542,199 @@ void test_compressed_adaptive_threshold_quantize_allreduce() {
   delete comm;
 }
 
+/**
+ * Test delta-quantized weight averaging and broadcasts, one-bit and adaptive
+ * threshold quantized. The differences are all +/-1, so both are exact.
+ */
+void test_delta_quantized_weight_sync() {
+  lbann_comm* comm = new lbann_comm(2);
+  lbann_quantizer quantizer;
+  Mat z;
+  El::Zeros(z, 10, 10);
+  for (int proportion : {0, 1}) {
+    // Every model shares ref.
+    Mat ref;
+    El::Rademacher(ref, 10, 10);
+    comm->intermodel_broadcast_matrix(ref, 0);
+    Mat diff;
+    El::Rademacher(diff, 10, 10);
+    comm->intermodel_broadcast_matrix(diff, 0);
+    // The differences cancel, so the average is ref.
+    Mat mat(ref);
+    El::Axpy(comm->get_model_rank() % 2 == 1 ? -1.0f : 1.0f, diff, mat);
+    Mat qerror;
+    Mat im_qerror;
+    quantizer.intermodel_average_delta_quantized(comm, mat, ref, qerror,
+                                                 im_qerror, proportion);
+    ASSERT_MAT_EQ(mat, ref);
+    ASSERT_MAT_EQ(qerror, z);
+    // Broadcasting the model 0 weights should update ref to them everywhere.
+    Mat weights(ref);
+    El::Axpy(1.0f, diff, weights);
+    Mat bcast_qerror;
+    quantizer.intermodel_broadcast_delta_quantized(comm, weights, ref,
+                                                   bcast_qerror, 0,
+                                                   proportion);
+    ASSERT_MAT_EQ(ref, weights);
+    if (comm->get_model_rank() == 0) {
+      ASSERT_MAT_EQ(bcast_qerror, z);
+    }
+    quantizer.release_buffers(comm, mat);
+    quantizer.release_buffers(comm, ref);
+  }
+  delete comm;
+}
+
+/**
+ * Test that delta-quantized weight averages leave every model with the same
+ * weights when the differences do not quantize exactly.
+ */
+void test_delta_quantized_average_consistent() {
+  lbann_comm* comm = new lbann_comm(2);
+  lbann_quantizer quantizer;
+  for (int proportion : {0, 4}) {
+    Mat ref;
+    El::Uniform(ref, 10, 10, 0.0f, 1.0f);
+    comm->intermodel_broadcast_matrix(ref, 0);
+    Mat qerror;
+    Mat im_qerror;
+    for (int step = 0; step < 3; ++step) {
+      Mat mat(ref);
+      Mat diff;
+      El::Uniform(diff, 10, 10, 0.0f, 1.0f);
+      El::Axpy(0.37f * (comm->get_model_rank() + 1), diff, mat);
+      quantizer.intermodel_average_delta_quantized(comm, mat, ref, qerror,
+                                                   im_qerror, proportion);
+      Mat model0_mat(mat);
+      comm->intermodel_broadcast_matrix(model0_mat, 0);
+      ASSERT_MAT_EQ_TOL(mat, model0_mat, 0.0f);
+      ref = mat;
+      quantizer.release_buffers(comm, mat);
+    }
+  }
+  delete comm;
+}
+
+/** Test the inter-model top-k sparse allreduce. */
+void test_topk_allreduce() {
+  lbann_comm* comm = new lbann_comm(2);
+  DistMat mat(comm->get_model_grid());
+  El::Uniform(mat, 10, 10, 0.0f, 10.0f);
+  if (comm->get_model_rank() % 2 == 1) {
+    El::Scale(-1, mat);
+  }
+  DistMat exact_sum(mat);
+  comm->intermodel_sum_matrix(exact_sum);
+  lbann_quantizer quantizer;
+  Mat z;
+  El::Zeros(z, mat.LocalHeight(), mat.LocalWidth());
+  // Proportion such that everything is sent.
+  DistMat all_copy(mat);
+  Mat all_qerror;
+  quantizer.intermodel_sum_topk(comm, all_copy, all_qerror, 1);
+  ASSERT_MAT_EQ(all_qerror, z);
+  ASSERT_MAT_EQ(all_copy, exact_sum);
+  // Sending only some entries leaves the rest in the error.
+  Mat qerror;
+  quantizer.intermodel_sum_topk(comm, mat, qerror, 4);
+  ASSERT_MAT_NEQ(qerror, z);
+  Mat with_qerror(mat.Matrix());
+  Mat summed_qerror(qerror);
+  comm->intermodel_sum_matrix(summed_qerror);
+  with_qerror += summed_qerror;
+  ASSERT_MAT_EQ(with_qerror, exact_sum.Matrix());
+  delete comm;
+}
+
+/**
+ * Test that threshold quantized sums work in reused buffers: once warmed up,
+ * further sums should make no large allocations.
+ */
+void test_threshold_allreduce_no_alloc() {
+  lbann_comm* comm = new lbann_comm(2);
+  DistMat mat(comm->get_model_grid());
+  El::Uniform(mat, 512, 512, 0.0f, 1.0f);
+  lbann_quantizer quantizer;
+  for (bool compress : {false, true}) {
+    Mat qerror;
+    Mat im_qerror;
+    for (int i = 0; i < 3; ++i) {
+      quantizer.intermodel_sum_threshold_quantized(comm, mat, qerror, 0.5f,
+                                                   -0.5f, im_qerror, compress);
+    }
+    const size_t warm_allocs = large_allocs;
+    for (int i = 0; i < 5; ++i) {
+      quantizer.intermodel_sum_threshold_quantized(comm, mat, qerror, 0.5f,
+                                                   -0.5f, im_qerror, compress);
+    }
+    ASSERT_EQ(large_allocs, warm_allocs);
+  }
+  delete comm;
+}
+
+/**
+ * Test that sums still work after releasing the buffers of the matrices
+ * summed before, including when a new matrix reuses their memory.
+ */
+void test_release_buffers() {
+  lbann_comm* comm = new lbann_comm(2);
+  lbann_quantizer quantizer;
+  for (int i = 0; i < 4; ++i) {
+    // Alternate shapes so stale buffers or requests would be the wrong size.
+    const int height = i % 2 ? 12 : 10;
+    for (int proportion : {0, 1}) {
+      DistMat mat(comm->get_model_grid());
+      if (comm->get_model_rank() == 0) {
+        El::Rademacher(mat, height, 10);
+      } else {
+        El::Zeros(mat, height, 10);
+      }
+      comm->intermodel_broadcast_matrix(mat, 0);
+      if (comm->get_model_rank() % 2 == 1) {
+        El::Scale(-1, mat);
+      }
+      DistMat exact_sum(mat);
+      comm->intermodel_sum_matrix(exact_sum);
+      Mat qerror;
+      Mat im_qerror;
+      if (proportion == 0) {
+        quantizer.intermodel_sum_quantized(comm, mat, qerror, im_qerror);
+      } else {
+        quantizer.intermodel_sum_adaptive_threshold_quantized(
+          comm, mat, qerror, proportion, im_qerror);
+      }
+      ASSERT_MAT_EQ(mat, exact_sum);
+      quantizer.release_buffers(comm, mat);
+    }
+  }
+  delete comm;
+}
+
 int main(int argc, char** argv) {
   El::Initialize(argc, argv);
   test_quantize();
   test_2value_quantize();
+  test_qsgd_quantize();
   test_threshold_quantize();
   test_compression();
+  test_compression_format();
+  test_compression_fuzz();
   test_threshold_compression();
   test_adaptive_threshold_quantize();
   test_adaptive_threshold_compression();
   test_quantize_allreduce2();
   test_quantize_allreduce();
+  test_quantize_allreduce_star();
+  test_qsgd_allreduce();
   test_threshold_quantize_allreduce();
   test_compressed_threshold_quantize_allreduce();
   test_adaptive_threshold_quantize_allreduce();
   test_compressed_adaptive_threshold_quantize_allreduce();
+  test_threshold_allreduce_no_alloc();
+  test_topk_allreduce();
+  test_delta_quantized_weight_sync();
+  test_delta_quantized_average_consistent();
+  test_release_buffers();
   El::Finalize();
   return 0;
 }
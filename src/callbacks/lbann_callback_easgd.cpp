@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_callback_easgd .hpp .cpp - Elastic averaging SGD between models
+////////////////////////////////////////////////////////////////////////////////
+
+#include "lbann/callbacks/lbann_callback_easgd.hpp"
+#include "lbann/utils/lbann_timer.hpp"
+#include "lbann/utils/lbann_exception.hpp"
+
+namespace lbann {
+
+lbann_callback_easgd::lbann_callback_easgd(uint period, float alpha,
+                                           lbann_summary* _summarizer) :
+  lbann_callback(1, _summarizer), period(period), alpha(alpha),
+  exchange_pending(false), quantize_center(false), center_proportion(0) {
+  if (period == 0) {
+    throw lbann_exception("lbann_callback_easgd: period must be positive");
+  }
+}
+
+lbann_callback_easgd::lbann_callback_easgd(uint period, float alpha,
+                                           std::unordered_set<uint> _layers,
+                                           lbann_summary* _summarizer) :
+  lbann_callback(1, _summarizer), period(period), alpha(alpha),
+  exchange_pending(false), quantize_center(false), center_proportion(0),
+  layer_indices(_layers) {
+  if (period == 0) {
+    throw lbann_exception("lbann_callback_easgd: period must be positive");
+  }
+}
+
+void lbann_callback_easgd::set_center_quantization(int proportion) {
+  if (proportion < 0) {
+    throw lbann_exception(
+      "lbann_callback_easgd: center proportion must not be negative");
+  }
+  quantize_center = true;
+  center_proportion = proportion;
+}
+
+void lbann_callback_easgd::setup(model* m) {
+  lbann_comm* comm = m->get_comm();
+  if (alpha == 0.0f) {
+    alpha = 0.9f / comm->get_num_models();
+  }
+  bool add = layer_indices.size() == 0;
+  std::vector<Layer*>& layers = m->get_layers();
+  for (Layer* layer : layers) {
+    uint idx = layer->get_index();
+    if (add || layer_indices.find(idx) != layer_indices.end()) {
+      layer_indices.insert(idx);
+      // The master's weights are the initial center.
+      Mat& weights = layer->get_weights_biases().Matrix();
+      Copy(weights, centers[idx]);
+      Zeros(diffs[idx], weights.Height(), weights.Width());
+      // Every model starts with the same center, which quantized broadcasts
+      // also need since they only send changes to it.
+      comm->intermodel_broadcast_matrix(centers[idx],
+                                        comm->get_intermodel_master());
+      if (am_center_holder(comm)) {
+        Copy(centers[idx], shared_centers[idx]);
+        if (quantize_center) {
+          center_errors.emplace(idx, Mat{});
+        }
+      }
+      if (am_center_holder(comm)) {
+        std::vector<Mat>& bufs = recv_diffs[idx];
+        bufs.resize(comm->get_num_models() - 1);
+        for (Mat& buf : bufs) {
+          Zeros(buf, weights.Height(), weights.Width());
+        }
+        reqs[idx].resize(comm->get_num_models() - 1);
+      } else {
+        reqs[idx].resize(1);
+      }
+    }
+  }
+}
+
+void lbann_callback_easgd::on_batch_end(model* m) {
+  lbann_comm* comm = m->get_comm();
+  if (comm->get_num_models() == 1 ||
+      m->get_execution_mode() != execution_mode::training) {
+    return;  // No point with only one model.
+  }
+  if (m->get_cur_step() % period == 0) {
+    exchange(m);
+  }
+}
+
+void lbann_callback_easgd::on_train_end(model* m) {
+  complete_exchange(m);
+}
+
+void lbann_callback_easgd::exchange(model* m) {
+  lbann_comm* comm = m->get_comm();
+  double start_time = get_time();
+  // Fold the previous exchange into the center and receive its broadcast.
+  complete_exchange(m);
+  const int master = comm->get_intermodel_master();
+  std::vector<Layer*>& layers = m->get_layers();
+  for (size_t l = 0; l < layers.size(); ++l) {
+    const uint idx = layers[l]->get_index();
+    if (layer_indices.find(idx) == layer_indices.end()) {
+      continue;
+    }
+    Mat& weights = layers[l]->get_weights_biases().Matrix();
+    Mat& center = centers[idx];
+    Mat& shared = get_shared_center(comm, idx);
+    Mat& diff = diffs[idx];
+    // Elastic difference; move the weights toward the center.
+    for (Int col = 0; col < weights.Width(); ++col) {
+      for (Int row = 0; row < weights.Height(); ++row) {
+        const DataType w = weights.Get(row, col);
+        const DataType d = alpha * (w - shared.Get(row, col));
+        diff.Set(row, col, d);
+        weights.Set(row, col, w - d);
+      }
+    }
+    // Send the difference to the master; it is applied at the next exchange.
+    std::vector<lbann_mpi_req<DataType>>& layer_reqs = reqs[idx];
+    if (am_center_holder(comm)) {
+      std::vector<Mat>& bufs = recv_diffs[idx];
+      for (int model = 0, i = 0; model < comm->get_num_models(); ++model) {
+        if (model == comm->get_model_rank()) {
+          continue;
+        }
+        comm->nb_recv(bufs[i], model, layer_reqs[i]);
+        ++i;
+      }
+    } else {
+      comm->nb_send(diff, master, layer_reqs[0]);
+    }
+    // Send out the current center, which is pulled toward at the next
+    // exchange. Other models reconstruct it in place.
+    if (!quantize_center) {
+      if (am_center_holder(comm)) {
+        Copy(center, shared);
+      }
+      comm->nb_intermodel_broadcast_matrix(shared, master, center_reqs[idx]);
+    } else if (center_proportion == 0) {
+      quantizer.nb_intermodel_broadcast_delta_quantized(
+        comm, center, shared, center_errors[idx], master,
+        quantized_centers[idx], quantized_center_reqs[idx]);
+    } else {
+      quantizer.intermodel_broadcast_delta_quantized(
+        comm, center, shared, center_errors[idx], master, center_proportion);
+    }
+  }
+  exchange_pending = true;
+  if (summarizer != nullptr) {
+    summarizer->reduce_scalar("easgd_time", get_time() - start_time,
+                              m->get_cur_step());
+  }
+}
+
+void lbann_callback_easgd::complete_exchange(model* m) {
+  if (!exchange_pending) {
+    return;
+  }
+  lbann_comm* comm = m->get_comm();
+  std::vector<Layer*>& layers = m->get_layers();
+  for (size_t l = 0; l < layers.size(); ++l) {
+    const uint idx = layers[l]->get_index();
+    if (layer_indices.find(idx) == layer_indices.end()) {
+      continue;
+    }
+    for (lbann_mpi_req<DataType>& req : reqs[idx]) {
+      comm->wait<DataType>(req);
+    }
+    if (!quantize_center) {
+      comm->wait<DataType>(center_reqs[idx]);
+    } else if (center_proportion == 0) {
+      quantizer.complete_broadcast_delta_quantized(
+        comm, quantized_centers[idx], get_shared_center(comm, idx),
+        quantized_center_reqs[idx]);
+    }
+    if (am_center_holder(comm)) {
+      Mat& center = centers[idx];
+      Axpy(DataType(1), diffs[idx], center);
+      for (Mat& buf : recv_diffs[idx]) {
+        Axpy(DataType(1), buf, center);
+      }
+    }
+  }
+  exchange_pending = false;
+}
+
+}  // namespace lbann
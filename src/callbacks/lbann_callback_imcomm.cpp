@@ -26,26 +26,188 @@
 // lbann_callback_imcomm .hpp .cpp - Send gradient updates between models
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
 #include "lbann/callbacks/lbann_callback_imcomm.hpp"
 #include "lbann/utils/lbann_timer.hpp"
 #include "lbann/utils/lbann_exception.hpp"
 
 namespace lbann {
 
+namespace {
+
+/**
+ * ADAPTIVE keeps layers exact when their warm-up sum time is within this
+ * factor of the fastest layer's, since their sums are latency-bound.
+ */
+const double ADAPTIVE_LATENCY_FACTOR = 2.0;
+/** Fraction of zero entries above which a gradient is considered sparse. */
+const double ADAPTIVE_SPARSE_FRACTION = 0.5;
+/** Proportions at or above which thresholded entries are compressed. */
+const int ADAPTIVE_COMPRESS_PROPORTION = 32;
+/**
+ * Without a target, ADAPTIVE aims to send this many times fewer bytes than
+ * exact sums.
+ */
+const double ADAPTIVE_DEFAULT_REDUCTION = 8.0;
+/** Relative error in bytes sent that ADAPTIVE does not adjust for. */
+const double ADAPTIVE_TOLERANCE = 0.1;
+
+/**
+ * Return true if mat's local entries are contiguous. Views that skip rows
+ * (e.g. fully-connected gradients without the bias row) are not.
+ */
+bool is_contiguous(const Mat& mat) {
+  return mat.Width() <= 1 || mat.LDim() == mat.Height();
+}
+
+/** Return the bytes each process sends in a ring allreduce of bytes. */
+double allreduce_bytes(double bytes, int num_models) {
+  return 2.0 * (num_models - 1) * bytes / num_models;
+}
+
+/**
+ * If layer's optimizer is AdaGrad on matrices of type DistMatType, replace it
+ * with SGD (one-bit quantized sums do the AdaGrad scaling) and return true.
+ */
+template <typename DistMatType>
+bool replace_adagrad(Layer* layer) {
+  if (typeid(*(layer->optimizer)) != typeid(Adagrad<DistMatType>)) {
+    return false;
+  }
+  // TODO: This leaks the old optimizer.
+  layer->optimizer = new SGD<DistMatType>(
+    layer->comm, layer->optimizer->get_learning_rate(), 0.0f, 0.0f, false);
+  layer->optimizer->setup(layer->WB->Width(), layer->WB->Height());
+  return true;
+}
+
+/** Return the fraction of entries of mat that are zero. */
+double zero_fraction(const Mat& mat) {
+  const Int height = mat.Height();
+  const Int width = mat.Width();
+  if (height * width == 0) {
+    return 0.0;
+  }
+  size_t zeros = 0;
+  for (Int col = 0; col < width; ++col) {
+    const DataType* col_buf = mat.LockedBuffer() + col * mat.LDim();
+    for (Int row = 0; row < height; ++row) {
+      zeros += col_buf[row] == 0.0f;
+    }
+  }
+  return ((double) zeros) / (height * width);
+}
+
+}  // namespace
+
 lbann_callback_imcomm::lbann_callback_imcomm(lbann_callback_imcomm::comm_type ct,
                                              lbann_summary* _summarizer) :
-  lbann_callback(1, _summarizer), ct(ct) {
+  lbann_callback(1, _summarizer), ct(ct), averaging_period(1),
+  slow_momentum(0.0f), outer_lr(1.0f), nesterov(false), averaging_ct(NORMAL),
+  averaging_proportion(0), last_averaging_step(0), topk_proportion(100),
+  qsgd_bits(4), defer_updates(false), num_deferred_updates(0),
+  overlap_sums(false), bucket_bytes(0), num_started_buckets(0),
+  target_bytes(0), warmup_steps(10), adaptive_steps(0) {
   
 }
 
 lbann_callback_imcomm::lbann_callback_imcomm(lbann_callback_imcomm::comm_type ct,
                                              std::unordered_set<uint> _layers,
                                              lbann_summary* _summarizer) :
-  lbann_callback(1, _summarizer), ct(ct), layer_indices(_layers) {
+  lbann_callback(1, _summarizer), ct(ct), averaging_period(1),
+  slow_momentum(0.0f), outer_lr(1.0f), nesterov(false), averaging_ct(NORMAL),
+  averaging_proportion(0), last_averaging_step(0), topk_proportion(100),
+  qsgd_bits(4), layer_indices(_layers), defer_updates(false),
+  num_deferred_updates(0), overlap_sums(false), bucket_bytes(0),
+  num_started_buckets(0), target_bytes(0), warmup_steps(10),
+  adaptive_steps(0) {
 
 }
 
+void lbann_callback_imcomm::set_averaging_params(uint _averaging_period,
+                                                 float _slow_momentum,
+                                                 float _outer_lr,
+                                                 bool _nesterov) {
+  if (_averaging_period == 0) {
+    throw lbann_exception(
+      "lbann_callback_imcomm: averaging period must be positive");
+  }
+  averaging_period = _averaging_period;
+  slow_momentum = _slow_momentum;
+  outer_lr = _outer_lr;
+  nesterov = _nesterov;
+}
+
+void lbann_callback_imcomm::set_averaging_quantization(comm_type type,
+                                                       int proportion) {
+  if (type != NORMAL && type != ONEBIT_QUANTIZATION &&
+      type != ADAPTIVE_THRESH_QUANTIZATION) {
+    throw lbann_exception(
+      "lbann_callback_imcomm: unsupported weight averaging quantization");
+  }
+  if (type == ADAPTIVE_THRESH_QUANTIZATION && proportion <= 0) {
+    throw lbann_exception(
+      "lbann_callback_imcomm: averaging proportion must be positive");
+  }
+  averaging_ct = type;
+  // The quantizer uses one-bit quantization for a proportion of 0.
+  averaging_proportion = type == ADAPTIVE_THRESH_QUANTIZATION ? proportion : 0;
+}
+
+void lbann_callback_imcomm::set_bucket_size(size_t _bucket_bytes) {
+  bucket_bytes = _bucket_bytes;
+}
+
+void lbann_callback_imcomm::set_topk_proportion(int proportion) {
+  if (proportion <= 0) {
+    throw lbann_exception(
+      "lbann_callback_imcomm: top-k proportion must be positive");
+  }
+  topk_proportion = proportion;
+}
+
+void lbann_callback_imcomm::set_qsgd_bits(int bits) {
+  if (bits != 2 && bits != 4 && bits != 8) {
+    throw lbann_exception(
+      "lbann_callback_imcomm: QSGD supports only 2, 4, or 8 bits");
+  }
+  qsgd_bits = bits;
+}
+
+void lbann_callback_imcomm::set_deferred_updates(bool defer) {
+  defer_updates = defer;
+}
+
+void lbann_callback_imcomm::set_overlap_sums(bool overlap) {
+  overlap_sums = overlap;
+}
+
+void lbann_callback_imcomm::set_adaptive_params(size_t _target_bytes,
+                                                uint _warmup_steps) {
+  if (_warmup_steps == 0) {
+    throw lbann_exception(
+      "lbann_callback_imcomm: adaptive warm-up must be positive");
+  }
+  target_bytes = _target_bytes;
+  warmup_steps = _warmup_steps;
+}
+
 void lbann_callback_imcomm::setup(model* m) {
+  lbann_comm* comm = m->get_comm();
+  if (defer_updates && (ct != NORMAL || bucket_bytes > 0)) {
+    throw lbann_exception(
+      "lbann_callback_imcomm: deferred updates need NORMAL sums without "
+      "buckets");
+  }
+  if (ct == NORMAL && comm->get_num_models() > 1 && !overlaps_sums(comm) &&
+      comm->am_world_master()) {
+    std::cout << "lbann_callback_imcomm: models share a node, so gradients "
+      "are summed with blocking hierarchical sums after backprop (use "
+      "set_overlap_sums to overlap them with backprop)" << std::endl;
+  }
   if (ct != NONE) {
     bool add = layer_indices.size() == 0;
     std::vector<Layer*>& layers = m->get_layers();
@@ -54,29 +216,46 @@ void lbann_callback_imcomm::setup(model* m) {
       if (add || layer_indices.find(idx) != layer_indices.end()) {
         // Ensure index is present (overwrites if already there).
         layer_indices.insert(idx);
+        if (ct == LOCAL_SGD) {
+          // Models step independently, so the mini-batch size is unchanged.
+          Mat& weights = layer->get_weights_biases().Matrix();
+          if (averaging_ct != NORMAL) {
+            // Quantized averages are relative to the previous average, so
+            // every model must start from the same weights.
+            comm->intermodel_sum_matrix(weights);
+            Scale(DataType(1) / comm->get_num_models(), weights);
+            quantization_errors.emplace(idx, Mat{});
+            im_quantization_errors.emplace(idx, Mat{});
+          }
+          if (keeps_averaged_weights()) {
+            Copy(weights, averaged_weights[idx]);
+          }
+          if (uses_outer_update()) {
+            Zeros(slow_momenta[idx], weights.Height(), weights.Width());
+          }
+          continue;
+        }
         // Update the layer's effective mini-batch size so it averages properly.
         layer->set_effective_minibatch_size(
           layer->get_minibatch_size() * m->get_comm()->get_num_models());
         // Skip adding matrices when we don't need to.
         if (!ct_does_quantization()) continue;
-        // TODO: handle case where WB_D is in other matrix distribution
-        DistMat& WB_D = (DistMat&) layer->get_weights_biases_gradient();
         quantization_errors.emplace(idx, Mat{});
         im_quantization_errors.emplace(idx, Mat{});
+        if (ct == ADAPTIVE) {
+          policies.emplace(idx, adaptive_policy{});
+        }
         if (ct == ONEBIT_QUANTIZATION) {
           // Set up gradient history and SGD optimizer for one-bit quantization.
           gradhistories.emplace(idx, Mat{});
-          if (layer->optimizer != nullptr) {
-            if (typeid(*(layer->optimizer)) != typeid(Adagrad<DistMat>)) {
-              throw lbann_exception(
-                "lbann_callback_imcomm: Cannot do one-bit quantization for "
-                "layer that does not use Adagrad");
-            }
-            // TODO: This leaks the old optimizer.
-            layer->optimizer = new SGD<DistMat>(
-              layer->comm, layer->optimizer->get_learning_rate(),
-              0.0f, 0.0f, false);
-            layer->optimizer->setup(layer->WB->Width(), layer->WB->Height());
+          if (layer->optimizer != nullptr &&
+              !replace_adagrad<DistMat>(layer) &&
+              !replace_adagrad<CircMat>(layer) &&
+              !replace_adagrad<StarMat>(layer) &&
+              !replace_adagrad<StarVCMat>(layer)) {
+            throw lbann_exception(
+              "lbann_callback_imcomm: Cannot do one-bit quantization for "
+              "layer that does not use Adagrad");
           }
         }
       }
@@ -90,17 +269,25 @@ void lbann_callback_imcomm::on_epoch_end(model* m) {
       m->get_execution_mode() != execution_mode::training) {
     return;  // No point with only one model.
   }
+  if (ct == LOCAL_SGD && m->get_cur_step() != last_averaging_step) {
+    // Synchronize models at the end of each epoch, if evaluation has not.
+    average_weights(m);
+  }
   if (ct_does_quantization()) {
     std::vector<Layer*>& layers = m->get_layers();
     for (size_t l = 0; l < layers.size(); ++l) {
-      if (layer_indices.find(layers[l]->get_index()) == layer_indices.end()) {
-        continue;
+      if (layer_indices.find(layers[l]->get_index()) == layer_indices.end() ||
+          quantization_errors[l].Height() == 0) {
+        continue;  // Also skip layers ADAPTIVE does not quantize.
       }
       comm->intermodel_sum_matrix(quantization_errors[l]);
-      // TODO: handle case where WB_D is in other matrix distribution
-      DistMat& WB_D = (DistMat&) layers[l]->get_weights_biases_gradient();
-      Mat& local_mat = WB_D.Matrix();
-      local_mat = quantization_errors[l];
+      // The errors are for this process's share of the gradient.
+      ElMat& WB_D = layers[l]->get_weights_biases_gradient();
+      IR rows, cols;
+      quantizer.get_redundant_share(WB_D, rows, cols);
+      auto share = WB_D.Matrix()(rows, cols);
+      Copy(quantization_errors[l], share);
+      quantizer.combine_redundant_shares(WB_D, rows, cols);
       // Apply optimizer update again.
       layers[l]->update();
       quantization_errors[l].Empty();
@@ -108,102 +295,561 @@ void lbann_callback_imcomm::on_epoch_end(model* m) {
   }
 }
 
-void lbann_callback_imcomm::on_backward_prop_end(model* m) {
+bool lbann_callback_imcomm::do_gradient_updates(model* m) const {
+  return m->get_comm()->get_num_models() > 1 &&
+    m->get_execution_mode() == execution_mode::training &&
+    ct != NONE && ct != LOCAL_SGD;
+}
+
+bool lbann_callback_imcomm::overlaps_sums(lbann_comm* comm) const {
+  return ct == NORMAL &&
+    (overlap_sums || defer_updates || !comm->uses_hierarchical_sum());
+}
+
+void lbann_callback_imcomm::progress_sums(lbann_comm* comm) {
+  for (Layer* layer : pending_sums) {
+    comm->test<DataType>(sum_reqs[layer->get_index()]);
+  }
+  for (size_t i = 0; i < num_started_buckets; ++i) {
+    comm->test<DataType>(buckets[i].req);
+  }
+}
+
+void lbann_callback_imcomm::complete_sum(model* m, Layer* layer) {
+  double start_time = get_time();
   lbann_comm* comm = m->get_comm();
-  if (comm->get_num_models() == 1 ||
-      m->get_execution_mode() != execution_mode::training) {
+  comm->wait<DataType>(sum_reqs[layer->get_index()]);
+  Mat& local = layer->get_weights_biases_gradient().Matrix();
+  if (!is_contiguous(local)) {
+    comm->unpack_matrices({&local}, sum_bufs[layer->get_index()]);
+  }
+  summarize_update(m, layer, get_time() - start_time, NORMAL);
+}
+
+void lbann_callback_imcomm::start_bucket(lbann_comm* comm) {
+  if (num_started_buckets == buckets.size() ||
+      buckets[num_started_buckets].layers.empty()) {
+    return;
+  }
+  gradient_bucket& bucket = buckets[num_started_buckets];
+  comm->nb_intermodel_sum_matrices(bucket.mats, bucket.buf, bucket.req);
+  ++num_started_buckets;
+}
+
+void lbann_callback_imcomm::complete_buckets(model* m) {
+  lbann_comm* comm = m->get_comm();
+  for (size_t i = 0; i < num_started_buckets; ++i) {
+    gradient_bucket& bucket = buckets[i];
+    double start_time = get_time();
+    comm->wait<DataType>(bucket.req);
+    comm->unpack_matrices(bucket.mats, bucket.buf);
+    double im_time = get_time() - start_time;
+    if (summarizer != nullptr) {
+      std::string prefix = "bucket" + std::to_string(
+        static_cast<long long>(i)) + "/imcomm_";
+      summarizer->reduce_scalar(prefix + "time", im_time, m->get_cur_step());
+      summarizer->reduce_scalar(prefix + "bytes", bucket.bytes,
+                                m->get_cur_step());
+      summarizer->reduce_scalar(prefix + "num_layers", bucket.layers.size(),
+                                m->get_cur_step());
+    }
+    bucket.layers.clear();
+    bucket.mats.clear();
+    bucket.bytes = 0;
+  }
+  if (summarizer != nullptr) {
+    summarizer->reduce_scalar("imcomm_bucket_size", bucket_bytes,
+                              m->get_cur_step());
+    summarizer->reduce_scalar("imcomm_num_buckets", num_started_buckets,
+                              m->get_cur_step());
+  }
+  num_started_buckets = 0;
+}
+
+void lbann_callback_imcomm::on_forward_prop_begin(model* m, Layer* l) {
+  // Deferred sums complete as the layers are reached; keep the rest going.
+  if (!pending_sums.empty()) {
+    progress_sums(m->get_comm());
+  }
+}
+
+void lbann_callback_imcomm::on_backward_prop_begin(model* m, Layer* l) {
+  if (!pending_sums.empty() || num_started_buckets > 0) {
+    progress_sums(m->get_comm());
+  }
+}
+
+void lbann_callback_imcomm::on_backward_prop_end(model* m, Layer* l) {
+  if (!do_gradient_updates(m) || !overlaps_sums(m->get_comm()) ||
+      layer_indices.find(l->get_index()) == layer_indices.end()) {
+    return;
+  }
+  lbann_comm* comm = m->get_comm();
+  progress_sums(comm);
+  // The gradient is final once the layer's backward propagation ends.
+  // Every model distributes it the same way, so the local matrices line up.
+  ElMat& WB_D = l->get_weights_biases_gradient();
+  if (bucket_bytes == 0) {
+    const uint idx = l->get_index();
+    Mat& local = WB_D.Matrix();
+    if (is_contiguous(local)) {
+      comm->nb_intermodel_sum_matrix(local, sum_reqs[idx]);
+    } else {
+      // MPI needs a contiguous buffer, so sum a packed copy.
+      comm->nb_intermodel_sum_matrices({&local}, sum_bufs[idx], sum_reqs[idx]);
+    }
+    pending_sums.push_back(l);
+    return;
+  }
+  // Add to the current bucket and start it once it is full.
+  if (num_started_buckets == buckets.size()) {
+    buckets.emplace_back();
+  }
+  gradient_bucket& bucket = buckets[num_started_buckets];
+  bucket.layers.push_back(l);
+  bucket.mats.push_back(&WB_D.Matrix());
+  bucket.bytes += sizeof(DataType) * WB_D.LocalHeight() * WB_D.LocalWidth();
+  if (bucket.bytes >= bucket_bytes) {
+    start_bucket(comm);
+  }
+}
+
+void lbann_callback_imcomm::on_backward_prop_end(model* m) {
+  if (!do_gradient_updates(m)) {
     return;  // No point with only one model.
   }
+  lbann_comm* comm = m->get_comm();
+  if (ct == NORMAL && !overlaps_sums(comm)) {
+    // The shared-memory phases are blocking, so sum after backprop instead.
+    hierarchical_sum_gradients(m);
+    return;
+  }
+  if (ct == NORMAL && bucket_bytes > 0) {
+    // Start the last, partially-filled bucket and complete them all.
+    start_bucket(comm);
+    complete_buckets(m);
+    return;
+  }
+  if (ct == NORMAL) {
+    if (!defer_updates) {
+      // Complete the sums started during backward propagation.
+      for (Layer* layer : pending_sums) {
+        complete_sum(m, layer);
+      }
+      pending_sums.clear();
+      return;
+    }
+    // Complete each sum when the next forward propagation reaches its layer.
+    // Layers without an optimizer (e.g. input layers) have nothing to defer.
+    for (size_t i = 0; i < pending_sums.size();) {
+      Layer* layer = pending_sums[i];
+      if (layer->get_optimizer() == nullptr) {
+        complete_sum(m, layer);
+        pending_sums.erase(pending_sums.begin() + i);
+        continue;
+      }
+      layer->defer_update([this, m, layer] () {
+          complete_sum(m, layer);
+          pending_sums.erase(
+            std::find(pending_sums.begin(), pending_sums.end(), layer));
+        });
+      ++num_deferred_updates;
+      ++i;
+    }
+    return;
+  }
+  if (ct == ADAPTIVE) {
+    adaptive_sum_gradients(m);
+    return;
+  }
   std::vector<Layer*>& layers = m->get_layers();
   for (size_t l = 0; l < layers.size(); ++l) {
     if (layer_indices.find(layers[l]->get_index()) == layer_indices.end()) {
       continue;
     }
     double start_time = get_time();
-    // TODO: handle case where WB_D is in other matrix distribution
-    DistMat& WB_D = (DistMat&) layers[l]->get_weights_biases_gradient();
-    switch (ct) {
-    case NONE:
-      break;
-    case NORMAL:
-      comm->intermodel_sum_matrix(WB_D);
-      break;
-    case ONEBIT_QUANTIZATION:
-      quantizer.intermodel_sum_quantized(
-        comm, WB_D, quantization_errors[l], im_quantization_errors[l], true,
-        &(gradhistories[l]));
-      break;
-    case THRESH_QUANTIZATION:
-      // TODO: Don't hardcode thresholds.
-      quantizer.intermodel_sum_threshold_quantized(
-        comm, WB_D, quantization_errors[l], 0.01f, -0.01f,
-        im_quantization_errors[l], false);
-      break;
-    case COMPRESSED_THRESH_QUANTIZATION:
-      // TODO: Don't hardcode thresholds.
-      quantizer.intermodel_sum_threshold_quantized(
-        comm, WB_D, quantization_errors[l], 0.01f, -0.01f,
-        im_quantization_errors[l], true);
-      break;
-    case ADAPTIVE_THRESH_QUANTIZATION:
-      // TODO: Don't hardcode proportion.
-      quantizer.intermodel_sum_adaptive_threshold_quantized(
-        comm, WB_D, quantization_errors[l], 64,
-        im_quantization_errors[l], false);
-      break;
-    case COMPRESSED_ADAPTIVE_THRESH_QUANTIZATION:
-      // TODO: Don't hardcode proportion.
-      quantizer.intermodel_sum_adaptive_threshold_quantized(
-        comm, WB_D, quantization_errors[l], 64,
-        im_quantization_errors[l], true);
-      break;
+    ElMat& WB_D = layers[l]->get_weights_biases_gradient();
+    // TODO: Don't hardcode thresholds and proportion.
+    sum_gradient(comm, WB_D, l, ct, 64, 0.01f, -0.01f);
+    summarize_update(m, layers[l], get_time() - start_time, ct);
+  }
+}
+
+void lbann_callback_imcomm::sum_gradient(lbann_comm* comm, ElMat& WB_D,
+                                         size_t l, comm_type type,
+                                         int proportion, DataType pos_thresh,
+                                         DataType neg_thresh) {
+  switch (type) {
+  case NONE:
+  case LOCAL_SGD:
+  case ADAPTIVE:
+    break;
+  case NORMAL:
+    comm->intermodel_sum_matrix(WB_D.Matrix());
+    break;
+  case ONEBIT_QUANTIZATION:
+    // ADAPTIVE can't replace the layer's optimizer after setup, so only
+    // ONEBIT_QUANTIZATION itself does AdaGrad here.
+    quantizer.intermodel_sum_quantized(
+      comm, WB_D, quantization_errors[l], im_quantization_errors[l],
+      ct == ONEBIT_QUANTIZATION, &(gradhistories[l]));
+    break;
+  case THRESH_QUANTIZATION:
+    quantizer.intermodel_sum_threshold_quantized(
+      comm, WB_D, quantization_errors[l], pos_thresh, neg_thresh,
+      im_quantization_errors[l], false);
+    break;
+  case COMPRESSED_THRESH_QUANTIZATION:
+    quantizer.intermodel_sum_threshold_quantized(
+      comm, WB_D, quantization_errors[l], pos_thresh, neg_thresh,
+      im_quantization_errors[l], true);
+    break;
+  case ADAPTIVE_THRESH_QUANTIZATION:
+    quantizer.intermodel_sum_adaptive_threshold_quantized(
+      comm, WB_D, quantization_errors[l], proportion,
+      im_quantization_errors[l], false);
+    break;
+  case COMPRESSED_ADAPTIVE_THRESH_QUANTIZATION:
+    quantizer.intermodel_sum_adaptive_threshold_quantized(
+      comm, WB_D, quantization_errors[l], proportion,
+      im_quantization_errors[l], true);
+    break;
+  case TOPK_SPARSIFICATION:
+    quantizer.intermodel_sum_topk(comm, WB_D, quantization_errors[l],
+                                  topk_proportion);
+    break;
+  case QSGD_QUANTIZATION:
+    quantizer.intermodel_sum_qsgd(
+      comm, WB_D, quantization_errors[l], im_quantization_errors[l],
+      qsgd_bits);
+    break;
+  }
+}
+
+void lbann_callback_imcomm::adaptive_sum_gradients(model* m) {
+  lbann_comm* comm = m->get_comm();
+  const int num_models = comm->get_num_models();
+  std::vector<Layer*>& layers = m->get_layers();
+  const bool warmup = adaptive_steps < warmup_steps;
+  // Per-layer sum times and fractions of zeros while warming up, and bytes
+  // sent after. These are summed over models so every model makes the same
+  // choices (which the collectives require).
+  Mat stats;
+  Zeros(stats, 2, layers.size());
+  for (size_t l = 0; l < layers.size(); ++l) {
+    const uint idx = layers[l]->get_index();
+    if (layer_indices.find(idx) == layer_indices.end()) {
+      continue;
+    }
+    adaptive_policy& policy = policies[idx];
+    ElMat& WB_D = layers[l]->get_weights_biases_gradient();
+    if (warmup) {
+      stats.Set(1, l, zero_fraction(WB_D.LockedMatrix()));
+      policy.full_bytes = allreduce_bytes(
+        sizeof(DataType) * WB_D.LocalHeight() * WB_D.LocalWidth(), num_models);
     }
+    double start_time = get_time();
+    sum_gradient(comm, WB_D, l, policy.ct, policy.proportion,
+                 policy.pos_thresh, policy.neg_thresh);
     double im_time = get_time() - start_time;
-    if (summarizer != nullptr && ct != NONE) {
+    const double bytes = does_quantization(policy.ct) ?
+      quantizer.get_bytes_sent() : policy.full_bytes;
+    stats.Set(0, l, warmup ? im_time : bytes);
+    summarize_update(m, layers[l], im_time, policy.ct);
+    if (summarizer != nullptr) {
       std::string prefix = "layer" + std::to_string(
-        static_cast<long long>(layers[l]->get_index())) + "/imcomm_";
-      summarizer->reduce_scalar(prefix + "time",
-                                im_time, m->get_cur_step());
-      size_t bytes_sent = 0;
-      size_t bytes_received = 0;
-      if (ct_does_quantization()) {
-        bytes_sent = quantizer.get_bytes_sent();
-        bytes_received = quantizer.get_bytes_received();
-      } else {
-        // Use the same approximation the comm layer does.
-        bytes_sent = sizeof(DataType) * WB_D.LocalHeight() * WB_D.LocalWidth();
-        bytes_received = sizeof(DataType) * WB_D.LocalHeight() * WB_D.LocalWidth();
-      }
-      summarizer->reduce_scalar(prefix + "bytes_sent",
-                                bytes_sent, m->get_cur_step());
-      summarizer->reduce_scalar(prefix + "bytes_received",
-                                bytes_received, m->get_cur_step());
-      if (ct_does_quantization()) {
-        summarizer->reduce_scalar(prefix + "rs_bytes_sent",
-                                  quantizer.get_rs_bytes_sent(),
-                                  m->get_cur_step());
-        summarizer->reduce_scalar(prefix + "ag_bytes_sent",
-                                  quantizer.get_ag_bytes_sent(),
-                                  m->get_cur_step());
-        summarizer->reduce_scalar(prefix + "rs_bytes_received",
-                                  quantizer.get_rs_bytes_received(),
-                                  m->get_cur_step());
-        summarizer->reduce_scalar(prefix + "ag_bytes_received",
-                                  quantizer.get_ag_bytes_received(),
-                                  m->get_cur_step());
-        summarizer->reduce_scalar(prefix + "rs_send_trans_time",
-                                  quantizer.get_rs_send_trans_time(),
-                                  m->get_cur_step());
-        summarizer->reduce_scalar(prefix + "rs_recv_trans_time",
-                                  quantizer.get_rs_recv_trans_time(),
-                                  m->get_cur_step());
-        summarizer->reduce_scalar(prefix + "ag_recv_trans_time",
-                                  quantizer.get_ag_recv_trans_time(),
-                                  m->get_cur_step());
-        quantizer.reset_bytes_counters();
-        quantizer.reset_time_counters();
+        static_cast<long long>(idx)) + "/imcomm_";
+      summarizer->reduce_scalar(prefix + "policy", (int) policy.ct,
+                                m->get_cur_step());
+      summarizer->reduce_scalar(prefix + "proportion", policy.proportion,
+                                m->get_cur_step());
+      summarizer->reduce_scalar(prefix + "pos_thresh", policy.pos_thresh,
+                                m->get_cur_step());
+    }
+    quantizer.reset_bytes_counters();
+    quantizer.reset_time_counters();
+  }
+  comm->intermodel_sum_matrix(stats);
+  for (size_t l = 0; l < layers.size(); ++l) {
+    const uint idx = layers[l]->get_index();
+    if (layer_indices.find(idx) == layer_indices.end()) {
+      continue;
+    }
+    adaptive_policy& policy = policies[idx];
+    if (warmup) {
+      policy.time += stats.Get(0, l) / num_models;
+      policy.zeros += stats.Get(1, l) / num_models;
+    } else {
+      adjust_policy(policy, stats.Get(0, l) / num_models);
+    }
+  }
+  if (warmup && ++adaptive_steps == warmup_steps) {
+    choose_policies(m);
+  }
+}
+
+void lbann_callback_imcomm::choose_policies(model* m) {
+  const int num_models = m->get_comm()->get_num_models();
+  std::vector<Layer*>& layers = m->get_layers();
+  double min_time = std::numeric_limits<double>::max();
+  double total_bytes = 0.0;
+  for (const auto& p : policies) {
+    min_time = std::min(min_time, p.second.time);
+    total_bytes += p.second.full_bytes;
+  }
+  const double target = target_bytes > 0 ? target_bytes :
+    total_bytes / ADAPTIVE_DEFAULT_REDUCTION;
+  // Keep everything exact if it fits, and otherwise latency-bound layers,
+  // which quantizing would not speed up.
+  double fixed_bytes = 0.0;
+  double scaled_bytes = 0.0;
+  for (const auto& p : policies) {
+    if (total_bytes <= target ||
+        p.second.time <= ADAPTIVE_LATENCY_FACTOR * min_time) {
+      fixed_bytes += p.second.full_bytes;
+    } else {
+      scaled_bytes += p.second.full_bytes;
+    }
+  }
+  const double avail_bytes = std::max(target - fixed_bytes, 1.0);
+  for (size_t l = 0; l < layers.size(); ++l) {
+    const uint idx = layers[l]->get_index();
+    if (layer_indices.find(idx) == layer_indices.end()) {
+      continue;
+    }
+    adaptive_policy& policy = policies[idx];
+    policy.ct = NORMAL;
+    if (total_bytes <= target ||
+        policy.time <= ADAPTIVE_LATENCY_FACTOR * min_time) {
+      continue;
+    }
+    policy.budget = avail_bytes * policy.full_bytes / scaled_bytes;
+    if (policy.budget >= policy.full_bytes) {
+      continue;
+    }
+    // Quantized sums only send this process's share of the gradient.
+    ElMat& WB_D = layers[l]->get_weights_biases_gradient();
+    IR rows, cols;
+    quantizer.get_redundant_share(WB_D, rows, cols);
+    auto share = WB_D.LockedMatrix()(rows, cols);
+    const Int height = share.Height();
+    const Int width = share.Width();
+    // Each column is quantized to one bit per entry plus two averages.
+    const double onebit_bytes = allreduce_bytes(
+      sizeof(lbann_quantizer::qtype) * ((height + 31) / 32 + 2) * width,
+      num_models);
+    if (onebit_bytes <= policy.budget) {
+      policy.ct = ONEBIT_QUANTIZATION;
+      continue;
+    }
+    // Threshold quantization sends about one word per entry sent.
+    policy.proportion = std::max(
+      2, (int) std::ceil(policy.full_bytes / policy.budget));
+    const bool compress = policy.proportion >= ADAPTIVE_COMPRESS_PROPORTION;
+    if (policy.zeros / warmup_steps >= ADAPTIVE_SPARSE_FRACTION) {
+      // Fixed thresholds, starting from those for the proportion in the last
+      // (summed, so identical on every model) gradient, scaled back down.
+      policy.ct = compress ? COMPRESSED_THRESH_QUANTIZATION :
+        THRESH_QUANTIZATION;
+      Mat zero_qerror;
+      Zeros(zero_qerror, height, width);
+      auto thresholds = quantizer.histogram_threshold_average(
+        share, zero_qerror, policy.proportion);
+      policy.pos_thresh = std::get<0>(thresholds) / num_models;
+      policy.neg_thresh = std::get<1>(thresholds) / num_models;
+    } else {
+      policy.ct = compress ? COMPRESSED_ADAPTIVE_THRESH_QUANTIZATION :
+        ADAPTIVE_THRESH_QUANTIZATION;
+    }
+  }
+}
+
+void lbann_callback_imcomm::adjust_policy(adaptive_policy& policy,
+                                          double bytes) {
+  if (policy.budget <= 0.0 || bytes <= 0.0) {
+    return;
+  }
+  const double ratio = bytes / policy.budget;
+  if (std::abs(ratio - 1.0) <= ADAPTIVE_TOLERANCE) {
+    return;
+  }
+  // Damp the adjustment, since bytes sent vary from step to step.
+  const double scale = std::min(std::max(ratio, 0.5), 2.0);
+  switch (policy.ct) {
+  case ADAPTIVE_THRESH_QUANTIZATION:
+  case COMPRESSED_ADAPTIVE_THRESH_QUANTIZATION:
+    policy.proportion = std::max(
+      2, (int) std::lround(policy.proportion * scale));
+    break;
+  case THRESH_QUANTIZATION:
+  case COMPRESSED_THRESH_QUANTIZATION:
+    // Entries sent fall off faster than linearly in the threshold.
+    policy.pos_thresh *= std::sqrt(scale);
+    policy.neg_thresh *= std::sqrt(scale);
+    break;
+  default:
+    break;
+  }
+}
+
+void lbann_callback_imcomm::hierarchical_sum_gradients(model* m) {
+  lbann_comm* comm = m->get_comm();
+  std::vector<Layer*>& layers = m->get_layers();
+  std::vector<Layer*> sum_layers;
+  std::vector<Mat*> mats;
+  for (Layer* layer : layers) {
+    if (layer_indices.find(layer->get_index()) != layer_indices.end()) {
+      sum_layers.push_back(layer);
+      mats.push_back(&layer->get_weights_biases_gradient().Matrix());
+    }
+  }
+  const double rs_time = comm->get_hier_rs_time();
+  const double ar_time = comm->get_hier_ar_time();
+  const double ag_time = comm->get_hier_ag_time();
+  double start_time = get_time();
+  if (bucket_bytes > 0) {
+    comm->intermodel_sum_matrices(mats, bucket_bytes);
+  } else {
+    for (Mat* mat : mats) {
+      comm->intermodel_sum_matrix(*mat);
+    }
+  }
+  double im_time = get_time() - start_time;
+  if (summarizer != nullptr) {
+    summarizer->reduce_scalar("imcomm_time", im_time, m->get_cur_step());
+    summarizer->reduce_scalar("imcomm_hier_rs_time",
+                              comm->get_hier_rs_time() - rs_time,
+                              m->get_cur_step());
+    summarizer->reduce_scalar("imcomm_hier_ar_time",
+                              comm->get_hier_ar_time() - ar_time,
+                              m->get_cur_step());
+    summarizer->reduce_scalar("imcomm_hier_ag_time",
+                              comm->get_hier_ag_time() - ag_time,
+                              m->get_cur_step());
+    if (bucket_bytes > 0) {
+      summarizer->reduce_scalar("imcomm_bucket_size", bucket_bytes,
+                                m->get_cur_step());
+    }
+  }
+}
+
+void lbann_callback_imcomm::summarize_update(model* m, Layer* layer,
+                                             double im_time, comm_type type) {
+  if (summarizer == nullptr) {
+    return;
+  }
+  std::string prefix = "layer" + std::to_string(
+    static_cast<long long>(layer->get_index())) + "/imcomm_";
+  summarizer->reduce_scalar(prefix + "time",
+                            im_time, m->get_cur_step());
+  size_t bytes_sent = 0;
+  size_t bytes_received = 0;
+  if (does_quantization(type)) {
+    bytes_sent = quantizer.get_bytes_sent();
+    bytes_received = quantizer.get_bytes_received();
+  } else {
+    // Use the same approximation the comm layer does.
+    const ElMat& WB_D = layer->get_weights_biases_gradient();
+    bytes_sent = sizeof(DataType) * WB_D.LocalHeight() * WB_D.LocalWidth();
+    bytes_received = sizeof(DataType) * WB_D.LocalHeight() * WB_D.LocalWidth();
+  }
+  summarizer->reduce_scalar(prefix + "bytes_sent",
+                            bytes_sent, m->get_cur_step());
+  summarizer->reduce_scalar(prefix + "bytes_received",
+                            bytes_received, m->get_cur_step());
+  if (does_quantization(type)) {
+    summarizer->reduce_scalar(prefix + "rs_bytes_sent",
+                              quantizer.get_rs_bytes_sent(),
+                              m->get_cur_step());
+    summarizer->reduce_scalar(prefix + "ag_bytes_sent",
+                              quantizer.get_ag_bytes_sent(),
+                              m->get_cur_step());
+    summarizer->reduce_scalar(prefix + "rs_bytes_received",
+                              quantizer.get_rs_bytes_received(),
+                              m->get_cur_step());
+    summarizer->reduce_scalar(prefix + "ag_bytes_received",
+                              quantizer.get_ag_bytes_received(),
+                              m->get_cur_step());
+    summarizer->reduce_scalar(prefix + "rs_send_trans_time",
+                              quantizer.get_rs_send_trans_time(),
+                              m->get_cur_step());
+    summarizer->reduce_scalar(prefix + "rs_recv_trans_time",
+                              quantizer.get_rs_recv_trans_time(),
+                              m->get_cur_step());
+    summarizer->reduce_scalar(prefix + "ag_recv_trans_time",
+                              quantizer.get_ag_recv_trans_time(),
+                              m->get_cur_step());
+    quantizer.reset_bytes_counters();
+    quantizer.reset_time_counters();
+  }
+}
+
+void lbann_callback_imcomm::on_batch_end(model* m) {
+  lbann_comm* comm = m->get_comm();
+  if (ct != LOCAL_SGD || comm->get_num_models() == 1 ||
+      m->get_execution_mode() != execution_mode::training) {
+    return;
+  }
+  if (m->get_cur_step() % averaging_period == 0) {
+    average_weights(m);
+  }
+}
+
+void lbann_callback_imcomm::on_validation_begin(model* m) {
+  if (ct == LOCAL_SGD && m->get_cur_step() != last_averaging_step) {
+    // Evaluate every model on the same weights.
+    average_weights(m);
+  }
+}
+
+void lbann_callback_imcomm::on_test_begin(model* m) {
+  on_validation_begin(m);
+}
+
+void lbann_callback_imcomm::average_weights(model* m) {
+  lbann_comm* comm = m->get_comm();
+  if (comm->get_num_models() == 1) {
+    return;
+  }
+  last_averaging_step = m->get_cur_step();
+  const DataType scale = DataType(1) / comm->get_num_models();
+  std::vector<Layer*>& layers = m->get_layers();
+  for (size_t l = 0; l < layers.size(); ++l) {
+    const uint idx = layers[l]->get_index();
+    if (layer_indices.find(idx) == layer_indices.end()) {
+      continue;
+    }
+    double start_time = get_time();
+    // Every model uses the same grid, so the local matrices line up.
+    Mat& weights = layers[l]->get_weights_biases().Matrix();
+    if (averaging_ct == NORMAL) {
+      comm->intermodel_sum_matrix(weights);
+      Scale(scale, weights);
+    } else {
+      quantizer.intermodel_average_delta_quantized(
+        comm, weights, averaged_weights[idx], quantization_errors[idx],
+        im_quantization_errors[idx], averaging_proportion);
+    }
+    if (uses_outer_update()) {
+      Mat& prev_weights = averaged_weights[idx];
+      Mat& momentum = slow_momenta[idx];
+      for (Int col = 0; col < weights.Width(); ++col) {
+        for (Int row = 0; row < weights.Height(); ++row) {
+          const DataType prev = prev_weights.Get(row, col);
+          const DataType delta = prev - weights.Get(row, col);
+          const DataType u = slow_momentum * momentum.Get(row, col) + delta;
+          momentum.Set(row, col, u);
+          const DataType step = nesterov ? slow_momentum * u + delta : u;
+          weights.Set(row, col, prev - outer_lr * step);
+        }
       }
     }
+    if (keeps_averaged_weights()) {
+      Copy(weights, averaged_weights[idx]);
+    }
+    double im_time = get_time() - start_time;
+    // The weights are the same size as the gradients.
+    summarize_update(m, layers[l], im_time, averaging_ct);
   }
 }
 
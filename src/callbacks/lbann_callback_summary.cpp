@@ -58,6 +58,9 @@ void lbann_callback_summary::on_batch_end(model* m) {
                             m->get_cur_step());
   summarizer->reduce_scalar("global_barriers", global_barriers,
                             m->get_cur_step());
+  if (comm->get_profiler() != nullptr) {
+    comm->get_profiler()->summarize(*summarizer, m->get_cur_step());
+  }
 }
 
 void lbann_callback_summary::on_epoch_end(model* m) {
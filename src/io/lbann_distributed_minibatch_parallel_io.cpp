@@ -35,6 +35,7 @@ lbann::distributed_minibatch_parallel_io::distributed_minibatch_parallel_io(lban
   : comm(comm), m_num_parallel_readers_training(num_parallel_readers), m_num_parallel_readers_validating(num_parallel_readers), m_num_parallel_readers_testing(num_parallel_readers), m_mini_batch_size(mini_batch_size)
 {
   m_root = 0;
+  m_local_num_samples = 0;
 
   int training_data_set_size = 0;
   int validation_data_set_size = 0;
@@ -129,12 +130,13 @@ int lbann::distributed_minibatch_parallel_io::fetch_to_local_matrix(Mat& M_local
       }
       preprocess_data_samples(M_local, num_samples_in_batch);
       m_local_data_valid = data_valid;
+      m_local_num_samples = num_samples_in_batch;
     }
   }
   return num_samples_in_batch;
 }
 
-void lbann::distributed_minibatch_parallel_io::distribute_from_local_matrix(Mat& M_local, CircMat& Ms) {
+int lbann::distributed_minibatch_parallel_io::distribute_from_local_matrix(Mat& M_local, CircMat& Ms) {
   int num_parallel_readers = get_num_parallel_readers();
   Ms.SetRoot(m_root);
 
@@ -151,9 +153,12 @@ void lbann::distributed_minibatch_parallel_io::distribute_from_local_matrix(Mat&
   }
 
   comm->model_barrier();
-   
+
+  /// The readers fetch ahead, so only the root knows this mini-batch's size
+  int num_samples_in_batch = comm->model_broadcast(m_root, m_local_num_samples);
+
   m_root = (m_root + 1) % num_parallel_readers;
-  return;
+  return num_samples_in_batch;
 }
 
 bool lbann::distributed_minibatch_parallel_io::is_data_set_processed() {
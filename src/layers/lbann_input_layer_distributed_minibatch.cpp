@@ -83,6 +83,8 @@ void lbann::input_layer_distributed_minibatch::fp_linearity(
 
   comm->model_barrier();
 
+  set_cur_minibatch_size(comm->model_broadcast(m_root, num_samples_in_batch));
+
   Copy(Xs, *Acts);
 }
 
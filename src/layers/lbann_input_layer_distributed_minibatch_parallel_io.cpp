@@ -70,7 +70,7 @@ void lbann::input_layer_distributed_minibatch_parallel_io::fp_linearity(
   int num_samples_in_batch = fetch_to_local_matrix(X_local);
   input_layer::update_num_samples_processed(num_samples_in_batch);
 
-  distribute_from_local_matrix(X_local, Xs);
+  set_cur_minibatch_size(distribute_from_local_matrix(X_local, Xs));
 
   Copy(Xs, *Acts);
 }
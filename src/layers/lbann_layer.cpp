@@ -29,6 +29,7 @@
 #include "lbann/layers/lbann_layer.hpp"
 #include "lbann/regularization/lbann_regularizer.hpp"
 #include "lbann/utils/lbann_timer.hpp"
+#include "lbann/utils/lbann_exception.hpp"
 #include <string>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -42,7 +43,7 @@ lbann::Layer::Layer(const uint index, lbann_comm* comm, Optimizer *optimizer,
                     std::vector<regularizer*> regs)
   : m_activation_type(activation), optimizer(optimizer), comm(comm),
     regularizers(regs), m_mini_batch_size(mbsize),
-    m_effective_mbsize(mbsize),
+    m_effective_mbsize(mbsize), m_cur_mbsize(mbsize),
     fp_time(0.0), bp_time(0.0)
 {
     Index = index;
@@ -89,6 +90,24 @@ DataType lbann::Layer::forwardProp(DataType prev_WBL2NormSum) {
   return prev_WBL2NormSum;
 }
 
+void lbann::Layer::defer_update(std::function<void()> wait) {
+  if (has_pending_update()) {
+    throw lbann_exception("Layer: update is already deferred");
+  }
+  m_pending_update_wait = std::move(wait);
+}
+
+void lbann::Layer::complete_pending_update() {
+  if (!has_pending_update()) {
+    return;
+  }
+  // Clear the wait before calling it so it runs only once.
+  std::function<void()> wait = std::move(m_pending_update_wait);
+  m_pending_update_wait = nullptr;
+  wait();
+  update();
+}
+
 void lbann::Layer::backProp() {
   double bp_start = get_time();
 
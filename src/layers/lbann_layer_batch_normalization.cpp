@@ -0,0 +1,392 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_layer_batch_normalization .hpp .cpp - Batch normalization layer
+////////////////////////////////////////////////////////////////////////////////
+
+#include "lbann/layers/lbann_layer_batch_normalization.hpp"
+#include "lbann/utils/lbann_exception.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace El;
+using namespace lbann;
+
+batch_normalization::batch_normalization(const uint index,
+                                         const int num_neurons,
+                                         const int num_channels,
+                                         const uint mini_batch_size,
+                                         const activation_type activation,
+                                         const matrix_format format,
+                                         lbann_comm* comm,
+                                         Optimizer* optimizer,
+                                         Layer* fold_layer,
+                                         const DataType decay,
+                                         const DataType epsilon)
+  : Layer(index, comm, optimizer, mini_batch_size, activation, {}),
+    m_format(format),
+    m_num_channels(num_channels),
+    m_channel_size(num_channels > 0 ? num_neurons / num_channels : 0),
+    m_decay(decay),
+    m_epsilon(epsilon),
+    m_fold_layer(fold_layer),
+    m_folded(false)
+{
+
+  NumNeurons = num_neurons;
+  if(num_channels <= 0 || num_neurons % num_channels != 0) {
+    throw lbann_exception("lbann_layer_batch_normalization: number of neurons must be a multiple of the number of channels");
+  }
+
+  // Scale and shift are replicated on every process
+  delete WB;
+  delete WB_D;
+  WB = new StarMat(comm->get_model_grid());
+  WB_D = new StarMat(comm->get_model_grid());
+
+  // Activations are in the same distribution as the previous layer's
+  switch(format) {
+  case matrix_format::MC_MR:
+    break;
+  case matrix_format::STAR_VC:
+    delete Zs;
+    delete Ds;
+    delete Ds_Temp;
+    delete Acts;
+    Zs = new StarVCMat(comm->get_model_grid());
+    Ds = new StarVCMat(comm->get_model_grid());
+    Ds_Temp = new StarVCMat(comm->get_model_grid());
+    Acts = new StarVCMat(comm->get_model_grid());
+    break;
+  default:
+    throw lbann_exception("lbann_layer_batch_normalization: unsupported matrix format");
+  }
+
+  // Initialize statistics
+  m_mean.assign(m_num_channels, DataType(0));
+  m_inv_stdev.assign(m_num_channels, DataType(1));
+  m_running_mean.assign(m_num_channels, DataType(0));
+  m_running_var.assign(m_num_channels, DataType(1));
+  m_local_sums.assign(2*m_num_channels, 0.0);
+  m_global_sums.assign(2*m_num_channels, 0.0);
+
+}
+
+batch_normalization::~batch_normalization() {}
+
+void batch_normalization::setup(const int num_prev_neurons)
+{
+  Layer::setup(num_prev_neurons);
+
+  if(num_prev_neurons != (int) NumNeurons) {
+    throw lbann_exception("lbann_layer_batch_normalization: unexpected number of input neurons");
+  }
+  if(m_fold_layer && m_fold_layer->NumNeurons != NumNeurons) {
+    throw lbann_exception("lbann_layer_batch_normalization: fold layer has unexpected number of neurons");
+  }
+
+  if(optimizer != NULL) {
+    optimizer->setup(2, m_num_channels);
+  }
+
+  // Initialize scale (gamma) to one and shift (beta) to zero
+  Zeros(*WB, m_num_channels, 2);
+  Mat& WBLocal = WB->Matrix();
+  for(int channel = 0; channel < m_num_channels; ++channel) {
+    WBLocal.Set(channel, 0, DataType(1));
+  }
+
+  // Initialize other matrices
+  Zeros(*WB_D, m_num_channels, 2);
+  Ones(*Zs, NumNeurons+1, m_mini_batch_size);
+  Zeros(*Ds, NumNeurons+1, m_mini_batch_size);
+  Zeros(*Ds_Temp, NumNeurons+1, m_mini_batch_size);
+  Ones(*Acts, NumNeurons+1, m_mini_batch_size);
+
+}
+
+void batch_normalization::fp_linearity(ElMat& _WB,
+                                       ElMat& _X,
+                                       ElMat& _Z,
+                                       ElMat& _Y) {
+
+  // Convert input to the layer's distribution
+  if(m_format == matrix_format::STAR_VC) {
+    DistMatrixReadProxy<DataType,DataType,STAR,VC> XProxy(_X);
+    fp_local(XProxy.Get(), _Z);
+  }
+  else {
+    DistMatrixReadProxy<DataType,DataType,MC,MR> XProxy(_X);
+    fp_local(XProxy.Get(), _Z);
+  }
+
+  // Z and Y are identical after fp linearity step
+  Copy(_Z, _Y);
+
+}
+
+Int batch_normalization::get_num_samples() const {
+  return std::max(get_cur_minibatch_size(), 1u);
+}
+
+Int batch_normalization::get_local_samples(const ElMat& X) const {
+  // Samples are the first columns; the rest of a partial mini-batch is padding
+  const Int num_samples = get_num_samples();
+  Int local_samples = 0;
+  while(local_samples < X.LocalWidth()
+        && X.GlobalCol(local_samples) < num_samples) {
+    ++local_samples;
+  }
+  return local_samples;
+}
+
+void batch_normalization::fp_local(const ElMat& X, ElMat& Z) {
+
+  // Get local matrices
+  const Mat& XLocal = X.LockedMatrix();
+  Mat& ZLocal = Z.Matrix();
+  const Int local_height = XLocal.Height();
+  const Int local_width = XLocal.Width();
+
+  // Statistics are already applied by the folded layer
+  if(m_folded) {
+    Copy(XLocal, ZLocal);
+    return;
+  }
+
+  // Channel of each local row (-1 for the bias row)
+  m_local_channels.resize(local_height);
+  for(Int row = 0; row < local_height; ++row) {
+    const Int neuron = X.GlobalRow(row);
+    m_local_channels[row] = neuron < (Int) NumNeurons ? neuron / m_channel_size : -1;
+  }
+
+  if(m_execution_mode == execution_mode::training) {
+
+    // Compute local sums and sums of squares for each channel
+    const Int local_samples = get_local_samples(X);
+    std::fill(m_local_sums.begin(), m_local_sums.end(), 0.0);
+    for(Int col = 0; col < local_samples; ++col) {
+      const DataType* __restrict__ x = XLocal.LockedBuffer(0, col);
+      for(Int row = 0; row < local_height; ++row) {
+        const int channel = m_local_channels[row];
+        if(channel >= 0) {
+          m_local_sums[channel] += x[row];
+          m_local_sums[m_num_channels + channel] += x[row] * x[row];
+        }
+      }
+    }
+
+    // Single allreduce for both sums
+    comm->model_allreduce(m_local_sums.data(), 2*m_num_channels,
+                          m_global_sums.data());
+
+    // Compute mini-batch statistics and update running statistics
+    const double count = double(get_num_samples()) * m_channel_size;
+    for(int channel = 0; channel < m_num_channels; ++channel) {
+      const double mean = m_global_sums[channel] / count;
+      const double sqmean = m_global_sums[m_num_channels + channel] / count;
+      const double var = std::max(sqmean - mean * mean, 0.0);
+      m_mean[channel] = mean;
+      m_inv_stdev[channel] = 1.0 / std::sqrt(var + m_epsilon);
+      m_running_mean[channel] = m_decay * m_running_mean[channel]
+        + (1 - m_decay) * mean;
+      m_running_var[channel] = m_decay * m_running_var[channel]
+        + (1 - m_decay) * var;
+    }
+
+  }
+  else {
+
+    // Use running statistics
+    for(int channel = 0; channel < m_num_channels; ++channel) {
+      m_mean[channel] = m_running_mean[channel];
+      m_inv_stdev[channel] = 1.0 / std::sqrt(m_running_var[channel] + m_epsilon);
+    }
+
+  }
+
+  // Normalize, scale, and shift
+  const Mat& WBLocal = WB->LockedMatrix();
+  for(Int col = 0; col < local_width; ++col) {
+    const DataType* __restrict__ x = XLocal.LockedBuffer(0, col);
+    DataType* __restrict__ z = ZLocal.Buffer(0, col);
+    for(Int row = 0; row < local_height; ++row) {
+      const int channel = m_local_channels[row];
+      if(channel >= 0) {
+        const DataType scale = WBLocal.Get(channel, 0) * m_inv_stdev[channel];
+        const DataType shift = WBLocal.Get(channel, 1) - scale * m_mean[channel];
+        z[row] = scale * x[row] + shift;
+      }
+      else {
+        z[row] = DataType(1);
+      }
+    }
+  }
+
+}
+
+void batch_normalization::bp_linearity() {
+
+  // Convert input to the layer's distribution
+  if(m_format == matrix_format::STAR_VC) {
+    DistMatrixReadProxy<DataType,DataType,STAR,VC> XProxy(*fp_input); // TODO: store from fp step
+    bp_local(XProxy.Get());
+  }
+  else {
+    DistMatrixReadProxy<DataType,DataType,MC,MR> XProxy(*fp_input); // TODO: store from fp step
+    bp_local(XProxy.Get());
+  }
+
+}
+
+void batch_normalization::bp_local(const ElMat& X) {
+
+  // Get local matrices
+  const Mat& XLocal = X.LockedMatrix();
+  const Mat& DsLocal = Ds->LockedMatrix();
+  Mat& DsTempLocal = Ds_Temp->Matrix();
+  const Int local_height = XLocal.Height();
+  const Int local_width = XLocal.Width();
+
+  // Compute local sums of dy and dy * xhat for each channel
+  const Int local_samples = get_local_samples(X);
+  std::fill(m_local_sums.begin(), m_local_sums.end(), 0.0);
+  for(Int col = 0; col < local_samples; ++col) {
+    const DataType* __restrict__ x = XLocal.LockedBuffer(0, col);
+    const DataType* __restrict__ dy = DsLocal.LockedBuffer(0, col);
+    for(Int row = 0; row < local_height; ++row) {
+      const int channel = m_local_channels[row];
+      if(channel >= 0) {
+        const DataType xhat = (x[row] - m_mean[channel]) * m_inv_stdev[channel];
+        m_local_sums[channel] += dy[row];
+        m_local_sums[m_num_channels + channel] += dy[row] * xhat;
+      }
+    }
+  }
+
+  // Single allreduce for both sums
+  comm->model_allreduce(m_local_sums.data(), 2*m_num_channels,
+                        m_global_sums.data());
+
+  // Gradients w.r.t. scale and shift
+  // Note: these are replicated, so no further communication is needed
+  Mat& WBDLocal = WB_D->Matrix();
+  const DataType mbsize = get_effective_minibatch_size();
+  for(int channel = 0; channel < m_num_channels; ++channel) {
+    WBDLocal.Set(channel, 0, m_global_sums[m_num_channels + channel] / mbsize);
+    WBDLocal.Set(channel, 1, m_global_sums[channel] / mbsize);
+  }
+
+  // Gradient w.r.t. input
+  const Mat& WBLocal = WB->LockedMatrix();
+  const double count = double(get_num_samples()) * m_channel_size;
+  for(Int col = 0; col < local_width; ++col) {
+    const DataType* __restrict__ x = XLocal.LockedBuffer(0, col);
+    const DataType* __restrict__ dy = DsLocal.LockedBuffer(0, col);
+    DataType* __restrict__ dx = DsTempLocal.Buffer(0, col);
+    for(Int row = 0; row < local_height; ++row) {
+      const int channel = m_local_channels[row];
+      if(channel >= 0) {
+        const DataType inv_stdev = m_inv_stdev[channel];
+        const DataType xhat = (x[row] - m_mean[channel]) * inv_stdev;
+        const DataType dy_mean = m_global_sums[channel] / count;
+        const DataType dy_xhat_mean = m_global_sums[m_num_channels + channel] / count;
+        dx[row] = WBLocal.Get(channel, 0) * inv_stdev
+          * (dy[row] - dy_mean - xhat * dy_xhat_mean);
+      }
+      else {
+        dx[row] = DataType(0);
+      }
+    }
+  }
+
+}
+
+bool batch_normalization::update()
+{
+  if(m_execution_mode == execution_mode::training && optimizer != NULL) {
+    optimizer->update_weight_bias_matrix(*WB_D, *WB);
+  }
+  return true;
+}
+
+void batch_normalization::set_execution_mode(execution_mode mode)
+{
+  // Set the mode first, since fold() is rejected in training mode
+  Layer::set_execution_mode(mode);
+  if(mode == execution_mode::prediction && !m_folded) {
+    fold();
+  }
+  else if(mode == execution_mode::training && m_folded) {
+    unfold();
+  }
+}
+
+bool batch_normalization::fold()
+{
+  if(m_execution_mode == execution_mode::training) {
+    throw lbann_exception("lbann_layer_batch_normalization: cannot fold in training mode");
+  }
+  if(m_folded) {
+    return true;
+  }
+  if(m_fold_layer == NULL) {
+    return false;
+  }
+
+  // Per-neuron affine transform equivalent to normalizing with the running
+  // statistics, then scaling and shifting
+  std::vector<DataType> scale(NumNeurons), shift(NumNeurons);
+  const Mat& WBLocal = WB->LockedMatrix();
+  for(int channel = 0; channel < m_num_channels; ++channel) {
+    const DataType channel_scale = WBLocal.Get(channel, 0)
+      / std::sqrt(m_running_var[channel] + m_epsilon);
+    const DataType channel_shift = WBLocal.Get(channel, 1)
+      - channel_scale * m_running_mean[channel];
+    for(int neuron = channel * m_channel_size;
+        neuron < (channel + 1) * m_channel_size;
+        ++neuron) {
+      scale[neuron] = channel_scale;
+      shift[neuron] = channel_shift;
+    }
+  }
+
+  // Keep the original weights so they can be restored exactly
+  Copy(m_fold_layer->WB->LockedMatrix(), m_fold_backup);
+  m_folded = m_fold_layer->fold_output_affine(scale, shift);
+  if(!m_folded) {
+    m_fold_backup.Empty();
+  }
+  return m_folded;
+}
+
+void batch_normalization::unfold()
+{
+  Copy(m_fold_backup, m_fold_layer->WB->Matrix());
+  m_fold_backup.Empty();
+  m_folded = false;
+}
@@ -604,7 +604,9 @@ void lbann::convolutional_layer::bp_linearity() {
   }
 
   // Obtain filter gradient with reduction and scaling
-  AllReduce(*WB_D, mpi::COMM_WORLD);  
+  // Only sum within the model; sums across models are done by the imcomm
+  // callback (possibly quantized), as with other layers.
+  AllReduce(*WB_D, WB_D->Grid().Comm());
   *WB_D *= 1.0/get_effective_minibatch_size();
 
 }
@@ -617,3 +619,49 @@ bool convolutional_layer::update()
   return true;
 }
 
+bool convolutional_layer::fold_output_affine(const std::vector<DataType>& scale,
+                                             const std::vector<DataType>& shift)
+{
+  if(m_activation_type != activation_type::ID) {
+    return false;
+  }
+
+  // Weights are replicated, so every process updates its local copy
+  Mat& WBLocal = WB->Matrix();
+  const int current_filter_size = m_filter_size / m_num_output_channels;
+  const int output_channel_size = NumNeurons / m_num_output_channels;
+
+  // Each output channel shares a filter, so the transform must be constant
+  // within each channel
+  for(int output_channel = 0;
+      output_channel < m_num_output_channels;
+      ++output_channel) {
+    const int start = output_channel*output_channel_size;
+    for(int neuron = start; neuron < start + output_channel_size; ++neuron) {
+      if(scale[neuron] != scale[start] || shift[neuron] != shift[start]) {
+        return false;
+      }
+    }
+  }
+
+  // Scale each output channel's filter
+  for(int output_channel = 0;
+      output_channel < m_num_output_channels;
+      ++output_channel) {
+    const DataType channel_scale = scale[output_channel*output_channel_size];
+    for(int i = output_channel*current_filter_size;
+        i < (output_channel+1)*current_filter_size;
+        ++i) {
+      WBLocal.Set(i, 0, channel_scale * WBLocal.Get(i, 0));
+    }
+  }
+
+  // Scale and shift each neuron's bias
+  for(int neuron = 0; neuron < NumNeurons; ++neuron) {
+    const int i = m_filter_size + neuron;
+    WBLocal.Set(i, 0, scale[neuron] * WBLocal.Get(i, 0) + shift[neuron]);
+  }
+
+  return true;
+}
+
@@ -207,6 +207,32 @@ bool lbann::FullyConnectedLayer::update()
   return true;
 }
 
+bool lbann::FullyConnectedLayer::fold_output_affine(const std::vector<DataType>& scale,
+                                                    const std::vector<DataType>& shift)
+{
+  if(m_activation_type != activation_type::ID) {
+    return false;
+  }
+  // Scale each neuron's weights and bias, then shift its bias
+  // Note: the bottom row of WB is left alone
+  const Int local_height = WB->LocalHeight();
+  const Int local_width = WB->LocalWidth();
+  for(Int row = 0; row < local_height; ++row) {
+    const Int neuron = WB->GlobalRow(row);
+    if(neuron >= (Int) NumNeurons) {
+      continue;
+    }
+    for(Int col = 0; col < local_width; ++col) {
+      DataType w = WB->GetLocal(row, col) * scale[neuron];
+      if(WB->GlobalCol(col) == WB->Width() - 1) {
+        w += shift[neuron];
+      }
+      WB->SetLocal(row, col, w);
+    }
+  }
+  return true;
+}
+
 DataType lbann::FullyConnectedLayer::checkGradient(Layer& PrevLayer, const DataType Epsilon)
 {
     DistMat WB_E1(WB->Grid());
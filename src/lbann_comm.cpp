@@ -28,15 +28,22 @@
 
 #include "lbann/lbann_comm.hpp"
 #include "lbann/utils/lbann_exception.hpp"
+#include "lbann/utils/lbann_timer.hpp"
 #include "mpi.h"
+#include <algorithm>
+#include <limits>
 
 using namespace std;
 using namespace El;
 
 lbann::lbann_comm::lbann_comm(int _procs_per_model) :
+  hierarchical_available(false), hierarchical_sum(false),
+  sum_win(MPI_WIN_NULL), sum_win_count(0),
   procs_per_model(_procs_per_model), num_model_barriers(0),
   num_intermodel_barriers(0), num_global_barriers(0), bytes_sent(0),
-  bytes_received(0) {
+  bytes_received(0), hier_rs_time(0.0), hier_ar_time(0.0),
+  hier_ag_time(0.0), profiler(nullptr), bcast_comm_cache_size(64),
+  bcast_chunk_bytes(1 << 20) {
 
   // Initialize parameters
   int world_size = mpi::Size(mpi::COMM_WORLD);
@@ -58,6 +65,7 @@ lbann::lbann_comm::lbann_comm(int _procs_per_model) :
   // Initialize model and intermodel communicators
   mpi::Split(mpi::COMM_WORLD, model_rank, rank_in_model, model_comm);
   mpi::Split(mpi::COMM_WORLD, rank_in_model, model_rank, intermodel_comm);
+  mpi::Dup(intermodel_comm, var_intermodel_comm);
 
   // Initialize Elemental grid
   grid = new Grid(model_comm);
@@ -66,76 +74,380 @@ lbann::lbann_comm::lbann_comm(int _procs_per_model) :
   setup_node_comm();
   procs_per_node = mpi::Size(node_comm);
   rank_in_node = mpi::Rank(node_comm);
+
+  setup_hierarchical_comms();
   
 }
 
 lbann::lbann_comm::~lbann_comm() {
+  if (profiler != nullptr) {
+    if (!profile_json_prefix.empty()) {
+      profiler->dump_json(profile_json_prefix + "." +
+                          std::to_string(get_rank_in_world()) + ".json");
+    }
+    delete profiler;
+  }
+  clear_bcast_comm_cache();
+  free_persistent_requests();
+  if (sum_win != MPI_WIN_NULL) {
+    MPI_Win_unlock_all(sum_win);
+    MPI_Win_free(&sum_win);
+  }
+  mpi::Free(intermodel_shard_comm);
+  mpi::Free(intermodel_node_comm);
   delete grid;
   mpi::Free(model_comm);
+  mpi::Free(var_intermodel_comm);
   mpi::Free(intermodel_comm);
 }
 
+void lbann::lbann_comm::enable_profiling(const std::string& json_prefix) {
+  if (profiler == nullptr) {
+    profiler = new lbann_comm_profiler();
+  }
+  profile_json_prefix = json_prefix;
+}
+
 void lbann::lbann_comm::intermodel_sum_matrix(Mat& mat) {
-  bytes_sent += sizeof(DataType) * mat.Height() * mat.Width();
-  AllReduce(mat, intermodel_comm, mpi::SUM);
-  bytes_received += sizeof(DataType) * mat.Height() * mat.Width();
+  double start = profile_start();
+  if (hierarchical_sum) {
+    hierarchical_sum_matrix(mat);
+  } else {
+    bytes_sent += sizeof(DataType) * mat.Height() * mat.Width();
+    AllReduce(mat, intermodel_comm, mpi::SUM);
+    bytes_received += sizeof(DataType) * mat.Height() * mat.Width();
+  }
+  profile_end("intermodel_sum_matrix",
+              sizeof(DataType) * mat.Height() * mat.Width(), start);
 }
 
 void lbann::lbann_comm::intermodel_sum_matrix(DistMat& mat) {
-  bytes_sent += sizeof(DataType) * mat.LocalHeight() * mat.LocalWidth();
-  AllReduce(mat, intermodel_comm, mpi::SUM);
-  bytes_received += sizeof(DataType) * mat.LocalHeight() * mat.LocalWidth();
+  double start = profile_start();
+  if (hierarchical_sum) {
+    hierarchical_sum_matrix(mat.Matrix());
+  } else {
+    bytes_sent += sizeof(DataType) * mat.LocalHeight() * mat.LocalWidth();
+    AllReduce(mat, intermodel_comm, mpi::SUM);
+    bytes_received += sizeof(DataType) * mat.LocalHeight() * mat.LocalWidth();
+  }
+  profile_end("intermodel_sum_matrix",
+              sizeof(DataType) * mat.LocalHeight() * mat.LocalWidth(), start);
 }
 
-/*void lbann::lbann_comm::nb_intermodel_sum_matrix(Mat& mat, mpi::Request& req) {
+void lbann::lbann_comm::hierarchical_sum_matrix(Mat& mat) {
+  if (!hierarchical_available) {
+    throw lbann_exception("lbann_comm: hierarchical sum is not available");
+  }
+  const Int height = mat.Height();
+  const Int width = mat.Width();
+  const size_t count = height * width;
+  ensure_sum_window(count);
+  const int local_models = sum_win_segments.size();
+  const int local_rank = mpi::Rank(intermodel_node_comm);
+  // This process owns entries [shard_start, shard_end) of the sum.
+  const size_t shard_size = (count + local_models - 1) / local_models;
+  const size_t shard_start = std::min(count, local_rank * shard_size);
+  const size_t shard_end = std::min(count, shard_start + shard_size);
+
+  // Intra-node reduce-scatter: publish this model's matrix, then sum this
+  // process's shard across every segment on the node.
+  double rs_start = get_time();
+  DataType* own = sum_win_segments[local_rank];
+  for (Int col = 0; col < width; ++col) {
+    std::copy(mat.LockedBuffer(0, col), mat.LockedBuffer(0, col) + height,
+              own + col * height);
+  }
+  sync_sum_window();
+  for (int i = 0; i < local_models; ++i) {
+    if (i == local_rank) {
+      continue;
+    }
+    const DataType* other = sum_win_segments[i];
+    for (size_t j = shard_start; j < shard_end; ++j) {
+      own[j] += other[j];
+    }
+  }
+  hier_rs_time += get_time() - rs_start;
+
+  // Inter-node allreduce of the shard among its owners.
+  double ar_start = get_time();
+  const size_t shard_count = shard_end - shard_start;
+  if (mpi::Size(intermodel_shard_comm) > 1 && shard_count > 0) {
+    bytes_sent += sizeof(DataType) * shard_count;
+    mpi::AllReduce(own + shard_start, shard_count, mpi::SUM,
+                   intermodel_shard_comm);
+    bytes_received += sizeof(DataType) * shard_count;
+  }
+  hier_ar_time += get_time() - ar_start;
+
+  // Intra-node allgather: copy every shard from its owner's segment.
+  double ag_start = get_time();
+  sync_sum_window();
+  for (int i = 0; i < local_models; ++i) {
+    const DataType* owner = sum_win_segments[i];
+    const size_t start = std::min(count, i * shard_size);
+    const size_t end = std::min(count, start + shard_size);
+    if (mat.LDim() == height) {
+      std::copy(owner + start, owner + end, mat.Buffer() + start);
+    } else {
+      for (size_t j = start; j < end; ++j) {
+        mat.Set(j % height, j / height, owner[j]);
+      }
+    }
+  }
+  // Nobody may overwrite a segment until everyone has read it.
+  sync_sum_window();
+  hier_ag_time += get_time() - ag_start;
+}
+
+void lbann::lbann_comm::ensure_sum_window(size_t count) {
+  if (sum_win != MPI_WIN_NULL && count <= sum_win_count) {
+    return;
+  }
+  // Every process with this model rank has the same local matrix sizes, so
+  // the node-local processes all grow the window together.
+  if (sum_win != MPI_WIN_NULL) {
+    MPI_Win_unlock_all(sum_win);
+    MPI_Win_free(&sum_win);
+  }
+  sum_win_count = std::max(count, 2 * sum_win_count);
+  DataType* base;
+  MPI_Win_allocate_shared(sizeof(DataType) * sum_win_count, sizeof(DataType),
+                          MPI_INFO_NULL, intermodel_node_comm.comm, &base,
+                          &sum_win);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, sum_win);
+  sum_win_segments.resize(mpi::Size(intermodel_node_comm));
+  for (size_t i = 0; i < sum_win_segments.size(); ++i) {
+    MPI_Aint size;
+    int disp_unit;
+    MPI_Win_shared_query(sum_win, i, &size, &disp_unit,
+                         &(sum_win_segments[i]));
+  }
+}
+
+void lbann::lbann_comm::sync_sum_window() {
+  MPI_Win_sync(sum_win);
+  mpi::Barrier(intermodel_node_comm);
+  MPI_Win_sync(sum_win);
+}
+
+void lbann::lbann_comm::nb_intermodel_sum_matrix(
+  Mat& mat, lbann_mpi_req<DataType>& req) {
+  // MPI needs a contiguous buffer for the in-place reduction.
+  if (mat.Width() > 1 && mat.Height() > 0 && mat.LDim() != mat.Height()) {
+    throw lbann_exception(
+      "lbann_comm: nb_intermodel_sum_matrix requires a contiguous matrix");
+  }
+  double start = profile_start();
+  bytes_sent += sizeof(DataType) * mat.Height() * mat.Width();
   MPI_Iallreduce(MPI_IN_PLACE, mat.Buffer(),
                  mat.Height() * mat.Width(), DataTypeMPI, MPI_SUM,
-                 intermodel_comm.comm, &req);
+                 intermodel_comm.comm, raw_request(req));
+  bytes_received += sizeof(DataType) * mat.Height() * mat.Width();
+  profile_end("nb_intermodel_sum_matrix",
+              sizeof(DataType) * mat.Height() * mat.Width(), start);
 }
 
-void lbann::lbann_comm::nb_intermodel_sum_matrix(DistMat& mat,
-                                                 mpi::Request& req) {
-  // Note: This reaches into the Elemental internals where presently
-  // mpi::Request is a typedef of MPI_Request and the MPI communicator
-  // is mpi::Comm::comm.
-  MPI_Iallreduce(MPI_IN_PLACE, mat.Buffer(),
-                 mat.LocalHeight() * mat.LocalWidth(), DataTypeMPI, MPI_SUM,
-                 intermodel_comm.comm, &req);
-                 }*/
+void lbann::lbann_comm::nb_intermodel_sum_matrix(
+  DistMat& mat, lbann_mpi_req<DataType>& req) {
+  nb_intermodel_sum_matrix(mat.Matrix(), req);
+}
+
+namespace {
+// Copy the local matrices into buf back-to-back, column by column.
+size_t pack_matrices(const std::vector<Mat*>& mats,
+                     std::vector<DataType>& buf) {
+  size_t count = 0;
+  for (const Mat* mat : mats) {
+    count += mat->Height() * mat->Width();
+  }
+  if (buf.size() < count) {
+    buf.resize(count);
+  }
+  DataType* dst = buf.data();
+  for (const Mat* mat : mats) {
+    const Int height = mat->Height();
+    for (Int col = 0; col < mat->Width(); ++col) {
+      std::copy(mat->LockedBuffer(0, col), mat->LockedBuffer(0, col) + height,
+                dst);
+      dst += height;
+    }
+  }
+  return count;
+}
+}  // namespace
+
+void lbann::lbann_comm::intermodel_sum_matrices(const std::vector<Mat*>& mats,
+                                                size_t bucket_bytes) {
+  const size_t bucket_count = bucket_bytes / sizeof(DataType);
+  std::vector<Mat*> bucket;
+  size_t count = 0;
+  for (size_t i = 0; i <= mats.size(); ++i) {
+    const size_t mat_count =
+      i < mats.size() ? mats[i]->Height() * mats[i]->Width() : 0;
+    // Reduce the current bucket when it is full or there are no more matrices.
+    if (!bucket.empty() &&
+        (i == mats.size() || count + mat_count > bucket_count)) {
+      double start = profile_start();
+      pack_matrices(bucket, sum_bucket);
+      if (hierarchical_sum) {
+        Mat packed;
+        packed.Attach(count, 1, sum_bucket.data(), count);
+        hierarchical_sum_matrix(packed);
+      } else {
+        bytes_sent += sizeof(DataType) * count;
+        mpi::AllReduce(sum_bucket.data(), count, mpi::SUM, intermodel_comm);
+        bytes_received += sizeof(DataType) * count;
+      }
+      unpack_matrices(bucket, sum_bucket);
+      profile_end("intermodel_sum_matrices", sizeof(DataType) * count, start);
+      bucket.clear();
+      count = 0;
+    }
+    if (i == mats.size()) {
+      break;
+    }
+    if (mat_count > bucket_count) {
+      intermodel_sum_matrix(*mats[i]);
+    } else {
+      bucket.push_back(mats[i]);
+      count += mat_count;
+    }
+  }
+}
+
+void lbann::lbann_comm::nb_intermodel_sum_matrices(
+  const std::vector<Mat*>& mats, std::vector<DataType>& buf,
+  lbann_mpi_req<DataType>& req) {
+  double start = profile_start();
+  const size_t count = pack_matrices(mats, buf);
+  bytes_sent += sizeof(DataType) * count;
+  MPI_Iallreduce(MPI_IN_PLACE, buf.data(), count, DataTypeMPI, MPI_SUM,
+                 intermodel_comm.comm, raw_request(req));
+  bytes_received += sizeof(DataType) * count;
+  profile_end("nb_intermodel_sum_matrices", sizeof(DataType) * count, start);
+}
+
+void lbann::lbann_comm::unpack_matrices(const std::vector<Mat*>& mats,
+                                        const std::vector<DataType>& buf) {
+  const DataType* src = buf.data();
+  for (Mat* mat : mats) {
+    const Int height = mat->Height();
+    for (Int col = 0; col < mat->Width(); ++col) {
+      std::copy(src, src + height, mat->Buffer(0, col));
+      src += height;
+    }
+  }
+}
 
 void lbann::lbann_comm::intermodel_broadcast_matrix(Mat& mat, int root) {
+  double start = profile_start();
   Broadcast(mat, intermodel_comm, root);
+  profile_end("intermodel_broadcast_matrix",
+              sizeof(DataType) * mat.Height() * mat.Width(), start);
 }
 
 void lbann::lbann_comm::intermodel_broadcast_matrix(DistMat& mat, int root) {
+  double start = profile_start();
   Broadcast(mat, intermodel_comm, root);
+  profile_end("intermodel_broadcast_matrix",
+              sizeof(DataType) * mat.LocalHeight() * mat.LocalWidth(), start);
+}
+
+void lbann::lbann_comm::nb_intermodel_broadcast_matrix(
+  Mat& mat, int root, lbann_mpi_req<DataType>& req) {
+  if (mat.Width() > 1 && mat.Height() > 0 && mat.LDim() != mat.Height()) {
+    throw lbann_exception(
+      "lbann_comm: nb_intermodel_broadcast_matrix requires a contiguous "
+      "matrix");
+  }
+  nb_intermodel_broadcast(mat.Buffer(), mat.Height() * mat.Width(), root, req);
+}
+
+void lbann::lbann_comm::nb_intermodel_broadcast_matrix(
+  DistMat& mat, int root, lbann_mpi_req<DataType>& req) {
+  nb_intermodel_broadcast_matrix(mat.Matrix(), root, req);
+}
+
+lbann::lbann_persistent_req lbann::lbann_comm::start_persistent(
+  const void* data, int count, size_t type_size, MPI_Datatype type, int peer,
+  bool send) {
+  persistent_key key = {data, count, peer, send};
+  auto iter = persistent_reqs.find(key);
+  if (iter == persistent_reqs.end()) {
+    MPI_Request req;
+    if (send) {
+      MPI_Send_init(data, count, type, peer, PT2PT_TAG, mpi::COMM_WORLD.comm,
+                    &req);
+    } else {
+      MPI_Recv_init(const_cast<void*>(data), count, type, peer, PT2PT_TAG,
+                    mpi::COMM_WORLD.comm, &req);
+    }
+    iter = persistent_reqs.emplace(key, req).first;
+  }
+  MPI_Start(&(iter->second));
+  return &(iter->second);
+}
+
+void lbann::lbann_comm::wait_persistent(lbann_persistent_req req) {
+  double start = profile_start();
+  MPI_Wait(req, MPI_STATUS_IGNORE);
+  profile_wait("wait_persistent", start);
+}
+
+void lbann::lbann_comm::free_persistent_requests() {
+  for (auto& entry : persistent_reqs) {
+    MPI_Request_free(&(entry.second));
+  }
+  persistent_reqs.clear();
 }
 
-/*void lbann::lbann_comm::nb_intermodel_broadcast_matrix(Mat& mat, int root,
-                                                       mpi::Request& req) {
-  MPI_Ibcast(mat.Buffer(), mat.Height() * mat.Width(), DataTypeMPI, root,
-             intermodel_comm.comm, &req);
+void lbann::lbann_comm::free_persistent_requests(const void* buf,
+                                                 size_t bytes) {
+  const char* start = static_cast<const char*>(buf);
+  for (auto iter = persistent_reqs.begin(); iter != persistent_reqs.end();) {
+    const char* data = static_cast<const char*>(iter->first.data);
+    if (data >= start && data < start + bytes) {
+      MPI_Request_free(&(iter->second));
+      iter = persistent_reqs.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
 }
 
-void lbann::lbann_comm::nb_intermodel_broadcast_matrix(DistMat& mat, int root,
-                                                       mpi::Request& req) {
-  MPI_Ibcast(mat.Buffer(), mat.LocalHeight() * mat.LocalWidth(), DataTypeMPI,
-             root, intermodel_comm.comm, &req);
-             }*/
+void lbann::lbann_comm::release_pooled_buffers(const void* buf,
+                                               size_t bytes) {
+  const char* start = static_cast<const char*>(buf);
+  auto iter = buffer_pool.lower_bound(
+    std::make_pair(buf, std::numeric_limits<int>::min()));
+  while (iter != buffer_pool.end() &&
+         static_cast<const char*>(iter->first.first) < start + bytes) {
+    std::vector<uint64_t>& buf = iter->second;
+    free_persistent_requests(buf.data(), buf.size() * sizeof(uint64_t));
+    iter = buffer_pool.erase(iter);
+  }
+}
 
 void lbann::lbann_comm::intermodel_barrier() {
   ++num_intermodel_barriers;
+  double start = profile_start();
   mpi::Barrier(intermodel_comm);
+  profile_end("intermodel_barrier", 0, start);
 }
 
 void lbann::lbann_comm::model_barrier() {
   ++num_model_barriers;
+  double start = profile_start();
   mpi::Barrier(model_comm);
+  profile_end("model_barrier", 0, start);
 }
 
 void lbann::lbann_comm::global_barrier() {
   ++num_global_barriers;
+  double start = profile_start();
   mpi::Barrier(mpi::COMM_WORLD);
+  profile_end("global_barrier", 0, start);
 }
 
 void lbann::lbann_comm::send(Mat& mat, int model, int rank) {
@@ -200,6 +512,54 @@ void lbann::lbann_comm::broadcast(DistMat& mat,
   broadcast(mat.Buffer(), mat.LocalHeight() * mat.LocalWidth(), dests, root);
 }
 
+mpi::Comm lbann::lbann_comm::get_bcast_comm(const std::vector<int>& dests,
+                                            int root) {
+  std::vector<int> key(dests);
+  std::sort(key.begin(), key.end());
+  key.insert(key.begin(), root);
+  auto iter = bcast_comm_index.find(key);
+  if (iter != bcast_comm_index.end()) {
+    // Move to the front of the LRU list.
+    bcast_comms.splice(bcast_comms.begin(), bcast_comms, iter->second);
+    return iter->second->second;
+  }
+  if (bcast_comms.size() >= bcast_comm_cache_size) {
+    mpi::Free(bcast_comms.back().second);
+    bcast_comm_index.erase(bcast_comms.back().first);
+    bcast_comms.pop_back();
+  }
+  mpi::Group bcast_group;
+  mpi::Comm bcast_comm;
+  create_group(key, bcast_group);
+  // Elemental doesn't expose this, so we have to reach into its internals.
+  // This lets us create a communicator without involving all of COMM_WORLD.
+  // Use a tag of 0; should not matter unless we're multi-threaded.
+  MPI_Comm_create_group(mpi::COMM_WORLD.comm, bcast_group.group, 0,
+                        &(bcast_comm.comm));
+  mpi::Free(bcast_group);
+  bcast_comms.emplace_front(key, bcast_comm);
+  bcast_comm_index[key] = bcast_comms.begin();
+  return bcast_comm;
+}
+
+void lbann::lbann_comm::clear_bcast_comm_cache() {
+  for (auto& entry : bcast_comms) {
+    mpi::Free(entry.second);
+  }
+  bcast_comms.clear();
+  bcast_comm_index.clear();
+}
+
+void lbann::lbann_comm::set_bcast_comm_cache_size(size_t size) {
+  // The communicator in use must stay cached.
+  bcast_comm_cache_size = std::max(size, (size_t) 1);
+  while (bcast_comms.size() > bcast_comm_cache_size) {
+    mpi::Free(bcast_comms.back().second);
+    bcast_comm_index.erase(bcast_comms.back().first);
+    bcast_comms.pop_back();
+  }
+}
+
 void lbann::lbann_comm::setup_node_comm() {
  
   // Get string specifying compute node
@@ -232,3 +592,21 @@ void lbann::lbann_comm::setup_node_comm() {
   mpi::Split(hash_comm, hash, mpi::Rank(mpi::COMM_WORLD), node_comm);
 
 }
+
+void lbann::lbann_comm::setup_hierarchical_comms() {
+  // Identify the node by the world rank of its first process.
+  int node_leader = mpi::Rank(mpi::COMM_WORLD);
+  mpi::Broadcast(&node_leader, 1, 0, node_comm);
+  mpi::Split(intermodel_comm, node_leader, model_rank, intermodel_node_comm);
+  const int local_models = mpi::Size(intermodel_node_comm);
+  mpi::Split(intermodel_comm, mpi::Rank(intermodel_node_comm), model_rank,
+             intermodel_shard_comm);
+  // Shards only line up if every node has the same number of models.
+  const int min_local_models = mpi::AllReduce(local_models, mpi::MIN,
+                                              mpi::COMM_WORLD);
+  const int max_local_models = mpi::AllReduce(local_models, mpi::MAX,
+                                              mpi::COMM_WORLD);
+  hierarchical_available = max_local_models > 1 &&
+    min_local_models == max_local_models;
+  hierarchical_sum = hierarchical_available;
+}
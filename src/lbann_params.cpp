@@ -39,7 +39,13 @@ lbann::TrainingParams::TrainingParams(void)
     ActivationType(activation_type::SIGMOID), DropOut(-1), Lambda(0),
     DatasetRootDir("."), SaveImageDir("."), ParameterDir("."),
     SaveModel(false), LoadModel(false), Checkpoint(10), TrainFile(" "),
-    TestFile(" "), SummaryDir("."), IntermodelCommMethod(0), ProcsPerModel(0) {
+    TestFile(" "), SummaryDir("."), IntermodelCommMethod(0),
+    IntermodelAveragingPeriod(1), IntermodelSlowMomentum(0.0f),
+    IntermodelBucketMB(0.0f), IntermodelDeferUpdates(false),
+    IntermodelOverlapSums(false), IntermodelTopKProportion(100),
+    IntermodelQSGDBits(4), IntermodelTargetBytes(0), IntermodelWarmupSteps(10),
+    EASGDPeriod(0), EASGDAlpha(0.0f), WeightQuantization(-1), CommProfile(""),
+    ProcsPerModel(0) {
 }
 
 void lbann::TrainingParams::parse_params(void) {
@@ -78,6 +84,48 @@ void lbann::TrainingParams::parse_params(void) {
 
   IntermodelCommMethod = Input("--imcomm", "Type of inter-model communication",
                                IntermodelCommMethod);
+  IntermodelAveragingPeriod = Input("--imcomm-period",
+                                    "Steps between weight averaging with local SGD",
+                                    IntermodelAveragingPeriod);
+  IntermodelSlowMomentum = Input("--imcomm-slow-momentum",
+                                 "Slow momentum for weight averaging with local SGD",
+                                 IntermodelSlowMomentum);
+  IntermodelBucketMB = Input("--imcomm-bucket-mb",
+                             "MB of gradients to sum together (0 = per layer)",
+                             IntermodelBucketMB);
+  IntermodelDeferUpdates = Input("--imcomm-defer-updates",
+                                 "Overlap gradient sums with the next forward pass",
+                                 IntermodelDeferUpdates);
+  IntermodelOverlapSums = Input("--imcomm-overlap-sums",
+                                "Overlap gradient sums with backprop even if "
+                                "models share a node",
+                                IntermodelOverlapSums);
+  IntermodelTopKProportion = Input("--imcomm-topk-proportion",
+                                   "Send 1 in N gradient entries with top-k",
+                                   IntermodelTopKProportion);
+  IntermodelQSGDBits = Input("--imcomm-qsgd-bits",
+                             "Bits per entry for QSGD (2, 4, or 8)",
+                             IntermodelQSGDBits);
+  IntermodelTargetBytes = Input("--imcomm-target-bytes",
+                                "Bytes per step for adaptive communication "
+                                "(0 = automatic)",
+                                IntermodelTargetBytes);
+  IntermodelWarmupSteps = Input("--imcomm-warmup-steps",
+                                "Steps before adaptive communication adapts",
+                                IntermodelWarmupSteps);
+  EASGDPeriod = Input("--easgd-period",
+                      "Steps between elastic averaging exchanges (0 = off)",
+                      EASGDPeriod);
+  EASGDAlpha = Input("--easgd-alpha",
+                     "Elastic averaging moving rate (0 = 0.9 / num models)",
+                     EASGDAlpha);
+  WeightQuantization = Input("--weight-quant",
+                             "Quantize weight averaging and EASGD centers "
+                             "(-1 = off, 0 = one-bit, N = send 1 in N)",
+                             WeightQuantization);
+  CommProfile = Input("--comm-profile",
+                      "Prefix for per-process communication profile files",
+                      CommProfile);
   ProcsPerModel = Input("--procs-per-model",
                         "Number of processes per model (0 = one model)",
                         ProcsPerModel);
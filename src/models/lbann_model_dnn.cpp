@@ -28,6 +28,7 @@
 
 #include "lbann/models/lbann_model_dnn.hpp"
 #include "lbann/layers/lbann_layer_fully_connected.hpp"
+#include "lbann/layers/lbann_layer_batch_normalization.hpp"
 #include "lbann/layers/lbann_layer_softmax.hpp"
 #include "lbann/optimizers/lbann_optimizer.hpp"
 #include "lbann/optimizers/lbann_optimizer_sgd.hpp"
@@ -106,7 +107,7 @@ void lbann::deep_neural_network::train(int num_epochs, int evaluation_frequency)
     /// Set the execution mode to training
     m_execution_mode = execution_mode::training;
     for (size_t l = 0; l < m_layers.size(); ++l) {
-      m_layers[l]->m_execution_mode = execution_mode::training;
+      m_layers[l]->set_execution_mode(execution_mode::training);
     }
 
     // Train on mini-batches until data set is traversed
@@ -121,6 +122,12 @@ void lbann::deep_neural_network::train(int num_epochs, int evaluation_frequency)
     // Compute train accuracy on current epoch
     m_train_accuracy = DataType(num_samples - num_errors) / num_samples * 100;
 
+    // Do updates deferred to the next mini-batch, so evaluation and
+    // the epoch-end callbacks see the final weights.
+    for (Layer* layer : m_layers) {
+      layer->complete_pending_update();
+    }
+
     if(evaluation_frequency > 0
        && (epoch + 1) % evaluation_frequency == 0) {
       // Evaluate model on validation set
@@ -132,7 +139,7 @@ void lbann::deep_neural_network::train(int num_epochs, int evaluation_frequency)
       // Set execution mode back to training
       m_execution_mode = execution_mode::training;
       for (size_t l = 0; l < m_layers.size(); l++) {
-        m_layers[l]->m_execution_mode = execution_mode::training;
+        m_layers[l]->set_execution_mode(execution_mode::training);
       }
     }
 
@@ -153,6 +160,13 @@ bool lbann::deep_neural_network::train_mini_batch(long *num_samples,
   do_model_forward_prop_begin_cbs();
   DataType L2NormSum = 0;
   for (size_t l = 0; l < m_layers.size(); ++l) {
+    if (l > 0) {
+      // Pass on the number of samples the input layer read
+      m_layers[l]->set_cur_minibatch_size(
+        m_layers[0]->get_cur_minibatch_size());
+    }
+    // Finish the previous mini-batch's update before using the weights.
+    m_layers[l]->complete_pending_update();
     do_layer_forward_prop_begin_cbs(m_layers[l]);
     L2NormSum = m_layers[l]->forwardProp(L2NormSum);
     do_layer_forward_prop_end_cbs(m_layers[l]);
@@ -175,8 +189,11 @@ bool lbann::deep_neural_network::train_mini_batch(long *num_samples,
   do_model_backward_prop_end_cbs();
 
   /// Update layers
+  /// Note: deferred updates are done before the next forward propagation
   for (size_t l = m_layers.size() - 1; l > 0; --l) {
-    m_layers[l]->update();
+    if (!m_layers[l]->has_pending_update()) {
+      m_layers[l]->update();
+    }
   }
   const bool data_set_processed = m_layers[0]->update();
 
@@ -198,7 +215,7 @@ DataType lbann::deep_neural_network::evaluate(execution_mode mode)
   // Set the execution mode
   m_execution_mode = mode;
   for (size_t l = 0; l < m_layers.size(); ++l) {
-    m_layers[l]->m_execution_mode = mode;
+    m_layers[l]->set_execution_mode(mode);
   }
 
   // Evaluate on mini-batches until data set is traversed
@@ -236,6 +253,10 @@ bool lbann::deep_neural_network::evaluate_mini_batch(long *num_samples,
   // forward propagation (mini-batch)
   DataType L2NormSum = 0;
   for (size_t l = 0; l < m_layers.size(); l++) {
+    if (l > 0) {
+      m_layers[l]->set_cur_minibatch_size(
+        m_layers[0]->get_cur_minibatch_size());
+    }
     L2NormSum = m_layers[l]->forwardProp(L2NormSum);
   }
   *num_errors += (long) L2NormSum;
@@ -249,3 +270,18 @@ bool lbann::deep_neural_network::evaluate_mini_batch(long *num_samples,
   const bool data_set_processed = m_layers[0]->update();
   return data_set_processed;
 }
+
+int lbann::deep_neural_network::fold_batch_normalization()
+{
+  if (m_execution_mode == execution_mode::training) {
+    throw lbann_exception("Cannot fold batch normalization in training mode");
+  }
+  int num_folded = 0;
+  for (Layer* layer : m_layers) {
+    batch_normalization* bn = dynamic_cast<batch_normalization*>(layer);
+    if (bn != nullptr && bn->fold()) {
+      ++num_folded;
+    }
+  }
+  return num_folded;
+}
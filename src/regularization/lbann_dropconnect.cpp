@@ -0,0 +1,129 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_dropconnect .cpp .hpp - DropConnect implementation
+////////////////////////////////////////////////////////////////////////////////
+
+#include "lbann/lbann_base.hpp"
+#include "lbann/regularization/lbann_dropconnect.hpp"
+#include "lbann/utils/lbann_random.hpp"
+#include "lbann/utils/lbann_exception.hpp"
+
+using namespace El;
+
+namespace lbann {
+
+dropconnect::dropconnect(float keep_prob) :
+  m_keep_prob(keep_prob), m_local_height(0), m_local_width(0),
+  m_masked(false) {}
+
+void dropconnect::setup(Layer* l) {
+  regularizer::setup(l);
+  if (l->WB->RedundantSize() != 1) {
+    throw lbann_exception(
+      "dropconnect: weights replicated across processes are not supported");
+  }
+}
+
+void dropconnect::fp_connections() {
+
+  // Terminate early if DropConnect is disabled
+  if(m_layer->m_execution_mode != execution_mode::training
+     || m_keep_prob < 0.0f) return;
+
+  // Weights may still be masked if the last forward pass was not followed by
+  // backprop
+  if (m_masked) restore_weights();
+
+  // Determine the local block of weights (excluding biases)
+  ElMat* wb = m_layer->WB;
+  Int height, width;
+  m_layer->get_weights_shape(height, width);
+  m_local_height = 0;
+  m_local_width = 0;
+  while (m_local_height < wb->LocalHeight() &&
+         wb->GlobalRow(m_local_height) < height) {
+    ++m_local_height;
+  }
+  while (m_local_width < wb->LocalWidth() &&
+         wb->GlobalCol(m_local_width) < width) {
+    ++m_local_width;
+  }
+
+  // Save the weights and mask them in place, scaling kept weights by
+  // 1/m_keep_prob
+  Copy(wb->LockedMatrix(), m_weights_backup);
+  m_mask.assign((m_local_height * m_local_width + 63) / 64, 0);
+  auto& gen = get_generator();
+  std::bernoulli_distribution dist(m_keep_prob);
+  const DataType scale = 1.0 / m_keep_prob;
+  DataType* __restrict__ wb_buf = wb->Buffer();
+  const Int wb_ldim = wb->LDim();
+  for (Int col = 0; col < m_local_width; ++col) {
+    for (Int row = 0; row < m_local_height; ++row) {
+      const Int idx = row + col * m_local_height;
+      if (dist(gen)) {
+        m_mask[idx / 64] |= uint64_t(1) << (idx % 64);
+        wb_buf[row + col * wb_ldim] *= scale;
+      } else {
+        wb_buf[row + col * wb_ldim] = DataType(0);
+      }
+    }
+  }
+  m_masked = true;
+
+}
+
+void dropconnect::bp_connections() {
+
+  // Terminate early if no mask was applied
+  if (!m_masked) return;
+
+  // Gradient with respect to the unmasked weights
+  ElMat* wb_d = m_layer->WB_D;
+  const DataType scale = 1.0 / m_keep_prob;
+  DataType* __restrict__ wb_d_buf = wb_d->Buffer();
+  const Int wb_d_ldim = wb_d->LDim();
+  for (Int col = 0; col < m_local_width; ++col) {
+    for (Int row = 0; row < m_local_height; ++row) {
+      const Int idx = row + col * m_local_height;
+      if (m_mask[idx / 64] & (uint64_t(1) << (idx % 64))) {
+        wb_d_buf[row + col * wb_d_ldim] *= scale;
+      } else {
+        wb_d_buf[row + col * wb_d_ldim] = DataType(0);
+      }
+    }
+  }
+
+  restore_weights();
+
+}
+
+void dropconnect::restore_weights() {
+  Copy(m_weights_backup, m_layer->WB->Matrix());
+  m_masked = false;
+}
+
+}  // namespace lbann
@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2014-2016, Lawrence Livermore National Security, LLC. 
+// Produced at the Lawrence Livermore National Laboratory. 
+// Written by the LBANN Research Team (B. Van Essen, et al.) listed in
+// the CONTRIBUTORS file. <lbann-dev@llnl.gov>
+//
+// LLNL-CODE-697807.
+// All rights reserved.
+//
+// This file is part of LBANN: Livermore Big Artificial Neural Network
+// Toolkit. For details, see http://software.llnl.gov/LBANN or
+// https://github.com/LLNL/LBANN. 
+//
+// Licensed under the Apache License, Version 2.0 (the "Licensee"); you
+// may not use this file except in compliance with the License.  You may
+// obtain a copy of the License at:
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+// implied. See the License for the specific language governing
+// permissions and limitations under the license.
+//
+// lbann_comm_profiler .hpp .cpp - Profiling for communication primitives
+////////////////////////////////////////////////////////////////////////////////
+
+#include <fstream>
+#include <iterator>
+#include "lbann/utils/lbann_comm_profiler.hpp"
+#include "lbann/utils/lbann_summary.hpp"
+#include "lbann/utils/lbann_exception.hpp"
+
+namespace lbann {
+
+namespace {
+void add_call(lbann_comm_profiler::primitive_stats& stats, size_t bytes,
+              double time) {
+  ++stats.count;
+  stats.bytes += bytes;
+  stats.time += time;
+  ++stats.histogram[lbann_comm_profiler::get_size_bucket(bytes)];
+}
+
+void add_wait(lbann_comm_profiler::primitive_stats& stats, double time) {
+  ++stats.num_waits;
+  stats.wait_time += time;
+}
+}  // namespace
+
+int lbann_comm_profiler::get_size_bucket(size_t bytes) {
+  int bucket = 0;
+  while (bytes > 0 && bucket < NUM_SIZE_BUCKETS - 1) {
+    bytes >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+void lbann_comm_profiler::record(const std::string& primitive, size_t bytes,
+                                 double time) {
+  add_call(total_stats[primitive], bytes, time);
+  add_call(interval_stats[primitive], bytes, time);
+}
+
+void lbann_comm_profiler::record_wait(const std::string& primitive,
+                                      double time) {
+  add_wait(total_stats[primitive], time);
+  add_wait(interval_stats[primitive], time);
+}
+
+void lbann_comm_profiler::reset() {
+  total_stats.clear();
+  interval_stats.clear();
+}
+
+void lbann_comm_profiler::summarize(lbann_summary& summarizer, int64_t step) {
+  for (const auto& entry : interval_stats) {
+    const std::string prefix = "comm/" + entry.first + "/";
+    const primitive_stats& stats = entry.second;
+    summarizer.reduce_scalar(prefix + "count", stats.count, step);
+    summarizer.reduce_scalar(prefix + "bytes", stats.bytes, step);
+    summarizer.reduce_scalar(prefix + "time", stats.time, step);
+    if (stats.num_waits > 0) {
+      summarizer.reduce_scalar(prefix + "wait_time", stats.wait_time, step);
+    }
+    if (stats.count > 0) {
+      summarizer.reduce_scalar(prefix + "mean_bytes",
+                               (double) stats.bytes / stats.count, step);
+    }
+  }
+  interval_stats.clear();
+}
+
+void lbann_comm_profiler::dump_json(std::ostream& os) const {
+  os << "{\n";
+  for (auto iter = total_stats.begin(); iter != total_stats.end(); ++iter) {
+    const primitive_stats& stats = iter->second;
+    os << "  \"" << iter->first << "\": {"
+       << "\"count\": " << stats.count << ", "
+       << "\"bytes\": " << stats.bytes << ", "
+       << "\"time\": " << stats.time << ", "
+       << "\"num_waits\": " << stats.num_waits << ", "
+       << "\"wait_time\": " << stats.wait_time << ", "
+       << "\"size_histogram\": [";
+    // Trim trailing empty buckets.
+    int last = NUM_SIZE_BUCKETS - 1;
+    while (last > 0 && stats.histogram[last] == 0) {
+      --last;
+    }
+    for (int i = 0; i <= last; ++i) {
+      os << (i > 0 ? ", " : "") << stats.histogram[i];
+    }
+    os << "]}" << (std::next(iter) == total_stats.end() ? "\n" : ",\n");
+  }
+  os << "}\n";
+}
+
+void lbann_comm_profiler::dump_json(const std::string& filename) const {
+  std::ofstream os(filename);
+  if (!os) {
+    throw lbann_exception("lbann_comm_profiler: could not open " + filename);
+  }
+  dump_json(os);
+}
+
+}  // namespace lbann
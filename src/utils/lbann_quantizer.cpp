@@ -30,10 +30,206 @@
 #include "lbann/utils/lbann_quantizer.hpp"
 #include "lbann/utils/lbann_random.hpp"
 #include <cmath>
+#include <cstring>
+#include <numeric>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
 
 namespace lbann {
 
-lbann_quantizer::lbann_quantizer() {
+namespace {
+
+/**
+ * Quantize count (at most 32) consecutive entries of mat_buf plus their
+ * quantization error into a word, with bit i set when entry i is non-negative,
+ * and update the error.
+ */
+inline uint32_t quantize_word(const DataType* __restrict__ mat_buf,
+                              DataType* __restrict__ qerror_buf, int count,
+                              DataType avg_pos, DataType avg_neg) {
+  uint32_t q = 0;
+#ifdef __AVX__
+  if (count == 32) {
+    // Pack eight comparison results (of floats) at a time with movemask.
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 pos = _mm256_set1_ps(avg_pos);
+    const __m256 neg = _mm256_set1_ps(avg_neg);
+    for (int i = 0; i < 32; i += 8) {
+      const __m256 val = _mm256_add_ps(_mm256_loadu_ps(mat_buf + i),
+                                       _mm256_loadu_ps(qerror_buf + i));
+      const __m256 is_pos = _mm256_cmp_ps(val, zero, _CMP_GE_OQ);
+      q |= ((uint32_t) _mm256_movemask_ps(is_pos)) << i;
+      _mm256_storeu_ps(qerror_buf + i,
+                       _mm256_sub_ps(val, _mm256_blendv_ps(neg, pos, is_pos)));
+    }
+    return q;
+  }
+#endif
+  #pragma omp simd reduction(|:q)
+  for (int i = 0; i < count; ++i) {
+    const DataType val = mat_buf[i] + qerror_buf[i];
+    const bool is_pos = val >= 0.0f;
+    q |= ((uint32_t) is_pos) << i;
+    qerror_buf[i] = val - (is_pos ? avg_pos : avg_neg);
+  }
+  return q;
+}
+
+/**
+ * Unquantize count (at most 32) entries from q into buf, adding to the
+ * existing entries if apply is true.
+ */
+inline void unquantize_word(uint32_t q, DataType* __restrict__ buf, int count,
+                            DataType avg_pos, DataType avg_neg, bool apply) {
+  if (apply) {
+    #pragma omp simd
+    for (int i = 0; i < count; ++i) {
+      buf[i] += (q >> i) & 0x1 ? avg_pos : avg_neg;
+    }
+  } else {
+    #pragma omp simd
+    for (int i = 0; i < count; ++i) {
+      buf[i] = (q >> i) & 0x1 ? avg_pos : avg_neg;
+    }
+  }
+}
+
+/** Number of buckets (per sign) in threshold histograms. */
+const int HIST_BUCKETS = 1024;
+/** Shift of an entry's magnitude bits to get its coarse bucket. */
+const int HIST_COARSE_SHIFT = 21;
+/** Shift of an entry's magnitude bits to get its fine bucket. */
+const int HIST_FINE_SHIFT = 11;
+
+/** Counts and sums of magnitudes by bucket, for each sign. */
+struct threshold_histogram {
+  size_t count[2][HIST_BUCKETS];
+  double sum[2][HIST_BUCKETS];
+};
+
+/**
+ * Histogram the entries of mat + qerror by sign and magnitude. If coarse[sign]
+ * is negative, entries of that sign are bucketed by their coarse bucket;
+ * otherwise only entries in coarse bucket coarse[sign] are counted, by their
+ * fine bucket. Non-negative floats order like their bits, so buckets order
+ * like magnitudes.
+ */
+void fill_threshold_histogram(const Mat& mat, const Mat& qerror,
+                              const int (&coarse)[2],
+                              threshold_histogram& hist) {
+  memset(&hist, 0, sizeof(hist));
+  const Int width = mat.Width();
+  const Int height = mat.Height();
+  const Int ldim = mat.LDim();
+  const Int qerror_ldim = qerror.LDim();
+  const DataType* __restrict__ mat_buf = mat.LockedBuffer();
+  const DataType* __restrict__ qerror_buf = qerror.LockedBuffer();
+  const bool parallel = width > 1 && width * height >= 16384;
+  #pragma omp parallel if (parallel)
+  {
+    threshold_histogram local;
+    memset(&local, 0, sizeof(local));
+    #pragma omp for
+    for (Int col = 0; col < width; ++col) {
+      for (Int row = 0; row < height; ++row) {
+        const DataType val = mat_buf[row + col * ldim] +
+          qerror_buf[row + col * qerror_ldim];
+        const int sign = val >= 0.0f ? 0 : 1;
+        const DataType mag = sign ? -val : val;
+        uint32_t bits;
+        memcpy(&bits, &mag, sizeof(bits));
+        int bucket = bits >> HIST_COARSE_SHIFT;
+        if (coarse[sign] >= 0) {
+          if (bucket != coarse[sign]) {
+            continue;
+          }
+          bucket = (bits >> HIST_FINE_SHIFT) & (HIST_BUCKETS - 1);
+        }
+        ++local.count[sign][bucket];
+        local.sum[sign][bucket] += mag;
+      }
+    }
+    #pragma omp critical
+    {
+      for (int sign = 0; sign < 2; ++sign) {
+        for (int bucket = 0; bucket < HIST_BUCKETS; ++bucket) {
+          hist.count[sign][bucket] += local.count[sign][bucket];
+          hist.sum[sign][bucket] += local.sum[sign][bucket];
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Return the bucket, scanning from the largest, at which at least to_keep
+ * entries of sign have been seen. The counts and sums of the buckets above it
+ * (and of it, if include is true) are added to kept and kept_sum.
+ */
+int select_histogram_bucket(const threshold_histogram& hist, int sign,
+                            size_t to_keep, size_t& kept, double& kept_sum,
+                            bool include) {
+  size_t seen = 0;
+  int bucket = HIST_BUCKETS - 1;
+  for (; bucket > 0; --bucket) {
+    if (seen + hist.count[sign][bucket] >= to_keep) {
+      break;
+    }
+    seen += hist.count[sign][bucket];
+    kept_sum += hist.sum[sign][bucket];
+  }
+  kept += seen;
+  if (include) {
+    kept += hist.count[sign][bucket];
+    kept_sum += hist.sum[sign][bucket];
+  }
+  return bucket;
+}
+
+/**
+ * Merge the (index, value) pairs in a and b, both sorted by index, into out,
+ * summing the values of pairs with the same index.
+ */
+void merge_sparse(const lbann_quantizer::ThreshQuantized& a,
+                  const lbann_quantizer::ThreshQuantized& b,
+                  lbann_quantizer::ThreshQuantized& out) {
+  out.resize(a.size() + b.size());
+  size_t i = 0;
+  size_t j = 0;
+  size_t k = 0;
+  while (i < a.size() && j < b.size()) {
+    if (a[i] < b[j]) {
+      out[k] = a[i];
+      out[k + 1] = a[i + 1];
+      i += 2;
+    } else if (b[j] < a[i]) {
+      out[k] = b[j];
+      out[k + 1] = b[j + 1];
+      j += 2;
+    } else {
+      DataType a_val, b_val;
+      memcpy(&a_val, &a[i + 1], sizeof(a_val));
+      memcpy(&b_val, &b[j + 1], sizeof(b_val));
+      const DataType sum = a_val + b_val;
+      out[k] = a[i];
+      memcpy(&out[k + 1], &sum, sizeof(sum));
+      i += 2;
+      j += 2;
+    }
+    k += 2;
+  }
+  k = std::copy(a.begin() + i, a.end(), out.begin() + k) - out.begin();
+  k = std::copy(b.begin() + j, b.end(), out.begin() + k) - out.begin();
+  out.resize(k);
+}
+
+}  // namespace
+
+lbann_quantizer::lbann_quantizer() :
+  coll_algo(collective_algorithm::AUTO), recursive_threshold(256 * 1024),
+  comm_tag(0), thresh_estimator(threshold_estimator::HISTOGRAM),
+  pipeline_chunks(4) {
   reset_bytes_counters();
   reset_time_counters();
 }
@@ -42,6 +238,27 @@ lbann_quantizer::~lbann_quantizer() {
 
 }
 
+bool lbann_quantizer::use_recursive(lbann_comm* comm, const Mat& mat,
+                                    Int qheight) const {
+  if (qheight == 0) {
+    qheight = get_quantized_matrix_height(mat);
+  }
+  const int nprocs = comm->get_num_models();
+  const bool pow2 = nprocs > 1 && (nprocs & (nprocs - 1)) == 0;
+  switch (coll_algo) {
+  case collective_algorithm::RING:
+    return false;
+  case collective_algorithm::RECURSIVE:
+    return pow2;
+  default:
+    // Recursive algorithms need fewer steps, but with two models they are the
+    // same as the ring, and for large blocks the ring's bandwidth is better.
+    return pow2 && nprocs > 2 &&
+      (qheight * (mat.Width() / nprocs) * sizeof(qtype)) <=
+      recursive_threshold;
+  }
+}
+
 void lbann_quantizer::quantize(
   const Mat& mat, QuantizedMatrix& qmat, Mat& qerror, bool sample) {
   // Set up the quantized matrix. (+2 for the averages.)
@@ -56,31 +273,37 @@ void lbann_quantizer::quantize(
   const DataType* __restrict__ mat_buf = mat.LockedBuffer();
   DataType* __restrict__ qerror_buf = qerror.Buffer();
   qtype* __restrict__ qmat_buf = qmat.Buffer();
-  for (int col = 0; col < width; ++col) {
+  // The global generator is not thread-safe, so sampled columns use their own
+  // generators seeded from it.
+  const bool do_sample = height > NUM_ONEBIT_SAMPLES && sample;
+  const rng_gen::result_type sample_seed = do_sample ? get_generator()() : 0;
+  const bool parallel = width > 1 && width * height >= ONEBIT_PARALLEL_MIN;
+  #pragma omp parallel for if (parallel)
+  for (Int col = 0; col < width; ++col) {
+    const DataType* __restrict__ col_buf = mat_buf + col * ldim;
+    DataType* __restrict__ col_qerror = qerror_buf + col * ldim;
     // First compute the positive and negative column averages.
     DataType pos_sum = 0.0f;
     DataType neg_sum = 0.0f;
     size_t num_pos = 0;
     size_t num_neg = 0;
-    if (height <= NUM_ONEBIT_SAMPLES || !sample) {
-      for (int row = 0; row < height; ++row) {
-        const int pos = row + col * ldim;
-        const DataType val = mat_buf[pos] + qerror_buf[pos];
-        if (val >= 0.0f) {
-          pos_sum += val;
-          ++num_pos;
-        } else {
-          neg_sum += val;
-          ++num_neg;
-        }
+    if (!do_sample) {
+      #pragma omp simd reduction(+:pos_sum,neg_sum,num_pos)
+      for (Int row = 0; row < height; ++row) {
+        const DataType val = col_buf[row] + col_qerror[row];
+        const bool is_pos = val >= 0.0f;
+        pos_sum += is_pos ? val : 0.0f;
+        neg_sum += is_pos ? 0.0f : val;
+        num_pos += is_pos;
       }
+      num_neg = height - num_pos;
     } else {
       // Randomly sample NUM_ONEBIT_SAMPLES to approximate.
+      std::minstd_rand col_gen(sample_seed + col);
       std::uniform_int_distribution<int> row_dist(0, height - 1);
-      rng_gen& gen = get_generator();
       for (unsigned i = 0; i < NUM_ONEBIT_SAMPLES; ++i) {
-        const unsigned pos = row_dist(gen) + col * ldim;
-        const DataType val = mat_buf[pos] + qerror_buf[pos];
+        const int row = row_dist(col_gen);
+        const DataType val = col_buf[row] + col_qerror[row];
         if (val >= 0.0f) {
           pos_sum += val;
           ++num_pos;
@@ -101,31 +324,16 @@ void lbann_quantizer::quantize(
 
     // Store the averages.
     // Use memcpy so that we don't violate aliasing rules.
-    qtype tmp;
-    memcpy(&tmp, &avg_pos, sizeof(avg_pos));
-    qmat.Set(0, col, tmp);
-    memcpy(&tmp, &avg_neg, sizeof(avg_neg));
-    qmat.Set(1, col, tmp);
+    qtype* __restrict__ qcol_buf = qmat_buf + col * qmat_ldim;
+    memcpy(&qcol_buf[0], &avg_pos, sizeof(avg_pos));
+    memcpy(&qcol_buf[1], &avg_neg, sizeof(avg_neg));
 
     // Now quantize the column, NUM_BITS entries at a time.
     int qrow = 2;
-    for (int row_chunk = 0; row_chunk < height; row_chunk += NUM_BITS) {
-      uqtype q = 0;
-      for (unsigned bit = 0; bit < NUM_BITS; ++bit) {
-        int row = row_chunk + bit;
-        if (row >= height) {
-          break;
-        }
-        const int pos = row + col * ldim;
-        const DataType val = mat_buf[pos] + qerror_buf[pos];
-        if (val >= 0.0f) {
-          q |= 1 << bit;
-          qerror_buf[pos] = val - avg_pos;
-        } else {
-          qerror_buf[pos] = val - avg_neg;
-        }
-      }
-      qmat_buf[qrow + col * qmat_ldim] = (qtype) q;
+    for (Int row_chunk = 0; row_chunk < height; row_chunk += NUM_BITS) {
+      const int count = std::min((Int) NUM_BITS, height - row_chunk);
+      qcol_buf[qrow] = (qtype) quantize_word(
+        col_buf + row_chunk, col_qerror + row_chunk, count, avg_pos, avg_neg);
       ++qrow;
     }
   }
@@ -143,29 +351,22 @@ void lbann_quantizer::unquantize(const QuantizedMatrix& qmat, Mat& mat, bool app
   const Int qmat_ldim = qmat.LDim();
   const qtype* __restrict__ qmat_buf = qmat.LockedBuffer();
   DataType* __restrict__ mat_buf = mat.Buffer();
-  for (int col = 0; col < width; ++col) {
-    int qrow = 2;
+  const bool parallel = width > 1 && width * height >= ONEBIT_PARALLEL_MIN;
+  #pragma omp parallel for if (parallel)
+  for (Int col = 0; col < width; ++col) {
+    const qtype* __restrict__ qcol_buf = qmat_buf + col * qmat_ldim;
+    DataType* __restrict__ col_buf = mat_buf + col * ldim;
     // Extract the averages.
-    qtype tmp = qmat.Get(0, col);
     DataType avg_pos;
-    memcpy(&avg_pos, &tmp, sizeof(avg_pos));
-    tmp = qmat.Get(1, col);
+    memcpy(&avg_pos, &qcol_buf[0], sizeof(avg_pos));
     DataType avg_neg;
-    memcpy(&avg_neg, &tmp, sizeof(avg_neg));
+    memcpy(&avg_neg, &qcol_buf[1], sizeof(avg_neg));
     // Unquantize this column.
-    for (int row_chunk = 0; row_chunk < height; row_chunk += NUM_BITS) {
-      uqtype q = (uqtype) qmat_buf[qrow + col * qmat_ldim];
-      for (size_t bit = 0; bit < NUM_BITS; ++bit) {
-        int row = row_chunk + bit;
-        if (row >= height) {
-          break;
-        }
-        if (apply) {
-          mat_buf[row + col * ldim] += (q >> bit) & 0x1 ? avg_pos : avg_neg;
-        } else {
-          mat_buf[row + col * ldim] = (q >> bit) & 0x1 ? avg_pos : avg_neg;
-        }
-      }
+    int qrow = 2;
+    for (Int row_chunk = 0; row_chunk < height; row_chunk += NUM_BITS) {
+      const int count = std::min((Int) NUM_BITS, height - row_chunk);
+      unquantize_word((uqtype) qcol_buf[qrow], col_buf + row_chunk, count,
+                      avg_pos, avg_neg, apply);
       ++qrow;
     }
   }
@@ -179,80 +380,151 @@ void lbann_quantizer::unquantize(const QuantizedMatrix& qmat, DistMat& mat,
 void lbann_quantizer::intermodel_sum_quantized(
   lbann_comm* comm, Mat& mat, Mat& qerror, Mat& im_qerror,
   bool do_adagrad, Mat* gradhist) {
+  std::function<void(Mat&)> reduced_hook;
+  if (do_adagrad) {
+    reduced_hook = [gradhist] (Mat& reduced) {
+      std::function<DataType(DataType)> _sq = [](DataType x) { return x*x; };
+      std::function<DataType(DataType)> _sqrt =
+        [](DataType x) { return 1.0f / (std::sqrt(x) + 1e-8f); };
+      if (gradhist->Height() == 0) {
+        Zeros(*gradhist, reduced.Height(), reduced.Width());
+      }
+      Mat tmp(reduced);  // Temporary for AdaGrad computations.
+      // Compute squared gradient and store in history.
+      EntrywiseMap(tmp, _sq);
+      *gradhist += tmp;
+      // Compute 1/sqrt(gradhist) with small perturbation.
+      Copy(*gradhist, tmp);
+      EntrywiseMap(tmp, _sqrt);
+      // Adjust update.
+      Mat reduced_copy(reduced);
+      Hadamard(tmp, reduced_copy, reduced);
+    };
+  }
+  intermodel_sum_fixed_quantized(
+    comm, mat, qerror, im_qerror, get_quantized_matrix_height(mat),
+    [this] (const Mat& m, QuantizedMatrix& q, Mat& err) {
+      quantize(m, q, err);
+    },
+    [this] (const QuantizedMatrix& q, Mat& m, bool apply) {
+      unquantize(q, m, apply);
+    },
+    reduced_hook);
+}
+
+void lbann_quantizer::intermodel_sum_fixed_quantized(
+  lbann_comm* comm, Mat& mat, Mat& qerror, Mat& im_qerror, Int qheight,
+  std::function<void(const Mat&, QuantizedMatrix&, Mat&)> quant,
+  std::function<void(const QuantizedMatrix&, Mat&, bool)> unquant,
+  std::function<void(Mat&)> reduced_hook) {
   // Initialize qerror.
   if (qerror.Height() == 0) {
     qerror.Resize(mat.Height(), mat.Width(), mat.LDim());
     Zero(qerror);
   }
+  // The message shapes are the same on every call, so use pooled buffers
+  // (keyed on mat) to avoid allocating and to reuse persistent requests.
+  const size_t qcount = qheight * mat.Width();
+  const void* owner = mat.LockedBuffer();
+  qtype* rs_send_buf = comm->get_pooled_buffer<qtype>(owner, 0, qcount);
+  qtype* rs_recv_buf = comm->get_pooled_buffer<qtype>(owner, 1, qcount);
+  qtype* ag_send_buf = comm->get_pooled_buffer<qtype>(owner, 2, qcount);
+  qtype* ag_recv_buf = comm->get_pooled_buffer<qtype>(owner, 3, qcount);
+  // The reduce-scatter may pipeline chunks of columns, so each range of
+  // columns is quantized into (and received into) its own part of the buffers.
+  const DataType* mat_buf = mat.LockedBuffer();
+  const Int mat_ldim = mat.LDim();
   QuantizedMatrix to_send_quant;
   QuantizedMatrix rs_recv;
   auto rs_send_trans =
-    [&qerror, &to_send_quant, this] (Mat& mat, IR h, IR w, int& count) {
+    [&qerror, &to_send_quant, &quant, rs_send_buf, qheight]
+    (Mat& mat, IR h, IR w, int& count) {
       auto to_send = mat(h, w);
       auto to_send_qerr = qerror(h, w);
-      quantize(to_send, to_send_quant, to_send_qerr);
+      to_send_quant.Attach(qheight, to_send.Width(),
+                           rs_send_buf + qheight * w.beg, qheight);
+      quant(to_send, to_send_quant, to_send_qerr);
       count = to_send_quant.Height() * to_send_quant.Width();
       return to_send_quant.Buffer();
     };
   auto rs_get_recv_buf = 
-    [&rs_recv, this] (Mat& mat, int& count) {
-      if (rs_recv.Width() != mat.Width()) {
-        rs_recv.Resize(get_quantized_matrix_height(mat), mat.Width());
-      }
-      count = rs_recv.Height() * rs_recv.Width();
-      return rs_recv.Buffer();
+    [rs_recv_buf, qheight, mat_buf, mat_ldim] (Mat& view, int& count) {
+      const Int col = (view.LockedBuffer() - mat_buf) / mat_ldim;
+      count = qheight * view.Width();
+      return rs_recv_buf + qheight * col;
     };
   auto rs_recv_trans = 
-    [&rs_recv, this] (qtype*, Mat& accum) {
-      unquantize(rs_recv, accum, true);
+    [&rs_recv, &unquant, qheight] (qtype* buf, Mat& accum) {
+      rs_recv.Attach(qheight, accum.Width(), buf, qheight);
+      unquant(rs_recv, accum, true);
     };
-  intermodel_ring_reduce_scatter<qtype>(comm, mat, false, rs_send_trans,
-                                        rs_get_recv_buf, rs_recv_trans);
+  const bool recursive = use_recursive(comm, mat, qheight);
+  if (recursive) {
+    intermodel_recursive_reduce_scatter<qtype>(comm, mat, false, rs_send_trans,
+                                               rs_get_recv_buf, rs_recv_trans);
+  } else {
+    intermodel_ring_reduce_scatter<qtype>(comm, mat, false, rs_send_trans,
+                                          rs_get_recv_buf, rs_recv_trans);
+  }
+  // The recursive allgather gathers everything into ag_send_buf in place, so
+  // the reduced columns are quantized directly into their final position.
+  qtype* ag_reduced_buf = ag_send_buf;
+  if (recursive) {
+    const int rank = comm->get_model_rank();
+    ag_reduced_buf += qheight *
+      get_block_cols(mat, comm->get_num_models(), rank, rank + 1).beg;
+  }
   QuantizedMatrix ag_send;
   QuantizedMatrix ag_recv;
-  std::function<DataType(DataType)> _sq = [](DataType x) { return x*x; };
-  std::function<DataType(DataType)> _sqrt =
-    [](DataType x) { return 1.0f / (std::sqrt(x) + 1e-8f); };
   auto ag_reduced_trans =
-    [&im_qerror, &ag_send, gradhist, do_adagrad, _sq, _sqrt, this] (Mat& reduced) {
-      if (do_adagrad) {
-        if (gradhist->Height() == 0) {
-          Zeros(*gradhist, reduced.Height(), reduced.Width());
-        }
-        Mat tmp(reduced);  // Temporary for AdaGrad computations.
-        // Compute squared gradient and store in history.
-        EntrywiseMap(tmp, _sq);
-        *gradhist += tmp;
-        // Compute 1/sqrt(gradhist) with small perturbation.
-        Copy(*gradhist, tmp);
-        EntrywiseMap(tmp, _sqrt);                     
-        // Adjust update.
-        Mat reduced_copy(reduced);
-        Hadamard(tmp, reduced_copy, reduced);
+    [&im_qerror, &ag_send, &quant, &unquant, &reduced_hook, ag_reduced_buf,
+     qheight] (Mat& reduced) {
+      if (reduced_hook) {
+        reduced_hook(reduced);
       }
       if (im_qerror.Height() == 0) {
         im_qerror.Resize(reduced.Height(), reduced.Width(), reduced.LDim());
         Zero(im_qerror);
       }
-      quantize(reduced, ag_send, im_qerror);
+      ag_send.Attach(qheight, reduced.Width(), ag_reduced_buf, qheight);
+      quant(reduced, ag_send, im_qerror);
+      // Keep what the other models receive, so every model has the same sum.
+      unquant(ag_send, reduced, false);
     };
+  if (recursive) {
+    auto ag_get_range_buf = [ag_send_buf, qheight] (IR cols, int& count) {
+        count = qheight * (cols.end - cols.beg);
+        return ag_send_buf + qheight * cols.beg;
+      };
+    auto ag_range_recv_trans =
+      [&ag_recv, &unquant, qheight] (qtype* buf, Mat& accum) {
+        ag_recv.Attach(qheight, accum.Width(), buf, qheight);
+        unquant(ag_recv, accum, false);
+      };
+    intermodel_recursive_allgather<qtype>(comm, mat, ag_reduced_trans,
+                                          ag_get_range_buf,
+                                          ag_range_recv_trans);
+    return;
+  }
   auto ag_get_send_buf = [&ag_send] (int& count) {
       count = ag_send.Height() * ag_send.Width();
       return ag_send.Buffer();
     };
   auto ag_get_recv_buf = 
-    [&ag_recv, this] (Mat& recv_view, int& count) {
-      ag_recv.Resize(get_quantized_matrix_height(recv_view), recv_view.Width());
+    [&ag_recv, &ag_recv_buf, qheight] (Mat& recv_view, int& count) {
+      ag_recv.Attach(qheight, recv_view.Width(), ag_recv_buf, qheight);
       count = ag_recv.Height() * ag_recv.Width();
       return ag_recv.Buffer();
     };
   auto ag_recv_trans = 
-    [&ag_recv, this] (qtype*, Mat& accum) {
-      unquantize(ag_recv, accum);
+    [&ag_recv, &unquant] (qtype*, Mat& accum) {
+      unquant(ag_recv, accum, false);
     };
   auto ag_swap_bufs = 
-    [&ag_send, &ag_recv] (qtype*, qtype*) {
-      std::swap(ag_send, ag_recv);
+    [&ag_send, &ag_recv, &ag_send_buf, &ag_recv_buf, qheight] (qtype*, qtype*) {
+      // Forward what we just received from its buffer.
+      std::swap(ag_send_buf, ag_recv_buf);
+      ag_send.Attach(qheight, ag_recv.Width(), ag_send_buf, qheight);
     };
   intermodel_ring_allgather<qtype>(comm, mat, false, ag_reduced_trans,
                                    ag_get_send_buf, ag_get_recv_buf,
@@ -260,10 +532,12 @@ void lbann_quantizer::intermodel_sum_quantized(
 }
 
 void lbann_quantizer::intermodel_sum_quantized(
-  lbann_comm* comm, DistMat& mat, Mat& qerror, Mat& im_qerror,
+  lbann_comm* comm, ElMat& mat, Mat& qerror, Mat& im_qerror,
   bool do_adagrad, Mat* gradhist) {
-  intermodel_sum_quantized(comm, mat.Matrix(), qerror, im_qerror, do_adagrad,
-                           gradhist);
+  sum_redundant_shares(mat, [&] (Mat& share) {
+      intermodel_sum_quantized(comm, share, qerror, im_qerror, do_adagrad,
+                               gradhist);
+    });
 }
 
 void lbann_quantizer::intermodel_sum_quantized2(lbann_comm* comm, Mat& mat_,
@@ -303,10 +577,250 @@ void lbann_quantizer::intermodel_sum_quantized2(lbann_comm* comm, DistMat& mat,
   intermodel_sum_quantized2(comm, mat.Matrix(), qerror, im_qerror);
 }
 
+void lbann_quantizer::qsgd_quantize(const Mat& mat, QuantizedMatrix& qmat,
+                                    Mat& qerror, int bits) {
+  if (bits != 2 && bits != 4 && bits != 8) {
+    throw lbann_exception("lbann_quantizer: unsupported QSGD bits " +
+                          std::to_string(bits));
+  }
+  const int qheight = get_qsgd_matrix_height(mat, bits);
+  const int qwidth = mat.Width();
+  qmat.Resize(qheight, qwidth);
+
+  const Int width = mat.Width();
+  const Int height = mat.Height();
+  const Int ldim = mat.LDim();
+  const Int qmat_ldim = qmat.LDim();
+  const DataType* __restrict__ mat_buf = mat.LockedBuffer();
+  DataType* __restrict__ qerror_buf = qerror.Buffer();
+  qtype* __restrict__ qmat_buf = qmat.Buffer();
+  const Int per_word = NUM_BITS / bits;
+  // Levels are in [-s, s], stored offset by s.
+  const int s = (1 << (bits - 1)) - 1;
+  // As with sampling in quantize, each column has its own generator.
+  const rng_gen::result_type seed = get_generator()();
+  const bool parallel = width > 1 && width * height >= ONEBIT_PARALLEL_MIN;
+  #pragma omp parallel for if (parallel)
+  for (Int col = 0; col < width; ++col) {
+    const DataType* __restrict__ col_buf = mat_buf + col * ldim;
+    DataType* __restrict__ col_qerror = qerror_buf + col * ldim;
+    qtype* __restrict__ qcol_buf = qmat_buf + col * qmat_ldim;
+    DataType norm = 0.0f;
+    #pragma omp simd reduction(max:norm)
+    for (Int row = 0; row < height; ++row) {
+      norm = std::max(norm, std::abs(col_buf[row] + col_qerror[row]));
+    }
+    memcpy(&qcol_buf[0], &norm, sizeof(norm));
+    const DataType scale = norm > 0.0f ? s / norm : 0.0f;
+    const DataType step = norm / s;
+    std::minstd_rand col_gen(seed + col);
+    std::uniform_real_distribution<DataType> unif(0.0f, 1.0f);
+    int qrow = 1;
+    for (Int row_chunk = 0; row_chunk < height; row_chunk += per_word) {
+      const Int count = std::min(per_word, height - row_chunk);
+      uqtype qword = 0;
+      for (Int i = 0; i < count; ++i) {
+        const Int row = row_chunk + i;
+        const DataType val = col_buf[row] + col_qerror[row];
+        const DataType scaled = std::abs(val) * scale;
+        int level = std::min((int) scaled, s);
+        // Round up with probability equal to the fractional part.
+        if (level < s && unif(col_gen) < scaled - level) {
+          ++level;
+        }
+        if (val < 0.0f) {
+          level = -level;
+        }
+        col_qerror[row] = val - level * step;
+        qword |= ((uqtype) (level + s)) << (i * bits);
+      }
+      qcol_buf[qrow] = (qtype) qword;
+      ++qrow;
+    }
+  }
+}
+
+void lbann_quantizer::qsgd_quantize(const DistMat& mat, QuantizedMatrix& qmat,
+                                    Mat& qerror, int bits) {
+  qsgd_quantize(mat.LockedMatrix(), qmat, qerror, bits);
+}
+
+void lbann_quantizer::qsgd_unquantize(const QuantizedMatrix& qmat, Mat& mat,
+                                      int bits, bool apply) {
+  const Int width = mat.Width();
+  const Int height = mat.Height();
+  const Int ldim = mat.LDim();
+  const Int qmat_ldim = qmat.LDim();
+  const qtype* __restrict__ qmat_buf = qmat.LockedBuffer();
+  DataType* __restrict__ mat_buf = mat.Buffer();
+  const Int per_word = NUM_BITS / bits;
+  const int s = (1 << (bits - 1)) - 1;
+  const uqtype mask = (((uqtype) 1) << bits) - 1;
+  const bool parallel = width > 1 && width * height >= ONEBIT_PARALLEL_MIN;
+  #pragma omp parallel for if (parallel)
+  for (Int col = 0; col < width; ++col) {
+    const qtype* __restrict__ qcol_buf = qmat_buf + col * qmat_ldim;
+    DataType* __restrict__ col_buf = mat_buf + col * ldim;
+    DataType norm;
+    memcpy(&norm, &qcol_buf[0], sizeof(norm));
+    const DataType step = norm / s;
+    int qrow = 1;
+    for (Int row_chunk = 0; row_chunk < height; row_chunk += per_word) {
+      const Int count = std::min(per_word, height - row_chunk);
+      const uqtype qword = (uqtype) qcol_buf[qrow];
+      for (Int i = 0; i < count; ++i) {
+        const int level = (int) ((qword >> (i * bits)) & mask) - s;
+        const DataType val = level * step;
+        if (apply) {
+          col_buf[row_chunk + i] += val;
+        } else {
+          col_buf[row_chunk + i] = val;
+        }
+      }
+      ++qrow;
+    }
+  }
+}
+
+void lbann_quantizer::qsgd_unquantize(const QuantizedMatrix& qmat,
+                                      DistMat& mat, int bits, bool apply) {
+  qsgd_unquantize(qmat, mat.Matrix(), bits, apply);
+}
+
+void lbann_quantizer::intermodel_sum_qsgd(lbann_comm* comm, Mat& mat,
+                                          Mat& qerror, Mat& im_qerror,
+                                          int bits) {
+  if (bits != 2 && bits != 4 && bits != 8) {
+    throw lbann_exception("lbann_quantizer: unsupported QSGD bits " +
+                          std::to_string(bits));
+  }
+  intermodel_sum_fixed_quantized(
+    comm, mat, qerror, im_qerror, get_qsgd_matrix_height(mat, bits),
+    [this, bits] (const Mat& m, QuantizedMatrix& q, Mat& err) {
+      qsgd_quantize(m, q, err, bits);
+    },
+    [this, bits] (const QuantizedMatrix& q, Mat& m, bool apply) {
+      qsgd_unquantize(q, m, bits, apply);
+    },
+    std::function<void(Mat&)>());
+}
+
+void lbann_quantizer::intermodel_sum_qsgd(lbann_comm* comm, ElMat& mat,
+                                          Mat& qerror, Mat& im_qerror,
+                                          int bits) {
+  sum_redundant_shares(mat, [&] (Mat& share) {
+      intermodel_sum_qsgd(comm, share, qerror, im_qerror, bits);
+    });
+}
+
+inline void lbann_quantizer::thresh_writer::push_back(uqtype ent) {
+  if (!compress) {
+    buf[out++] = ent;
+    return;
+  }
+  empty = false;
+  // Each entry is its quotient in unary (1s terminated by a 0) followed by its
+  // GR_K-bit remainder, written LSB-first into consecutive words. Bits are
+  // accumulated in the low acc_bits bits of acc and written a word at a time.
+  uqtype quotient = ent >> GR_K;
+  const uqtype remainder = ent & (GR_M - 1);
+  // Write quotient 1s, filling whole words at once.
+  while (acc_bits + quotient >= NUM_BITS) {
+    const uqtype ones = NUM_BITS - acc_bits;
+    acc |= ((((uint64_t) 1) << ones) - 1) << acc_bits;
+    buf[out++] = (uqtype) acc;
+    acc = 0;
+    acc_bits = 0;
+    quotient -= ones;
+  }
+  acc |= ((((uint64_t) 1) << quotient) - 1) << acc_bits;
+  acc_bits += quotient;
+  // Write the trailing 0 and the remainder together.
+  acc |= ((uint64_t) remainder << 1) << acc_bits;
+  acc_bits += GR_K + 1;
+  if (acc_bits >= NUM_BITS) {
+    buf[out++] = (uqtype) acc;
+    acc >>= NUM_BITS;
+    acc_bits -= NUM_BITS;
+  }
+}
+
+inline size_t lbann_quantizer::thresh_writer::finish() {
+  if (compress) {
+    if (empty) {
+      // Mark empty input with a word of 1s.
+      buf[out++] = ~((uqtype) 0);
+    } else if (acc_bits > 0) {
+      // Pad the end of the last word with 1s to terminate it.
+      acc |= ~((uint64_t) 0) << acc_bits;
+      buf[out++] = (uqtype) acc;
+      acc = 0;
+      acc_bits = 0;
+    }
+    empty = false;
+  }
+  return out;
+}
+
+inline bool lbann_quantizer::thresh_reader::next(uqtype& ent) {
+  if (!compress) {
+    if (i == count) return false;
+    ent = buf[i++];
+    return true;
+  }
+  // Decode the quotient by counting 1s until we find a 0.
+  // If we hit the end without finding a 0, this was the end of the list.
+  uqtype quotient = 0;
+  while (true) {
+    if (acc_bits <= NUM_BITS && i < count) {
+      acc |= ((uint64_t) buf[i++]) << acc_bits;
+      acc_bits += NUM_BITS;
+    }
+    // The 0s of ~acc above acc_bits are masked out.
+    const uint64_t zeros = ~acc & ((acc_bits == 64) ? ~((uint64_t) 0) :
+                                   ((((uint64_t) 1) << acc_bits) - 1));
+    if (zeros != 0) {
+      const uqtype ones = __builtin_ctzll(zeros);
+      quotient += ones;
+      // Skip past the 1s and the 0.
+      acc = (ones + 1 == 64) ? 0 : acc >> (ones + 1);
+      acc_bits -= ones + 1;
+      break;
+    }
+    if (i == count) return false;  // Nothing left.
+    quotient += acc_bits;
+    acc = 0;
+    acc_bits = 0;
+  }
+  // Decode the remainder (GR_K bits).
+  if (acc_bits < GR_K && i < count) {
+    acc |= ((uint64_t) buf[i++]) << acc_bits;
+    acc_bits += NUM_BITS;
+  }
+  const uqtype remainder = acc & (GR_M - 1);
+  acc >>= GR_K;
+  acc_bits -= GR_K;
+  // Now decode the final value.
+  ent = quotient * GR_M + remainder;
+  return true;
+}
+
 void lbann_quantizer::threshold_quantize(const Mat& mat, ThreshQuantized& quant,
                                          Mat& qerror, DataType pos_thresh,
                                          DataType neg_thresh, bool delta,
                                          DataType pos_avg, DataType neg_avg) {
+  // At most every entry is kept.
+  const size_t start = quant.size();
+  quant.resize(start + mat.Height() * mat.Width());
+  thresh_writer writer(quant.data() + start, false);
+  threshold_quantize(mat, writer, qerror, pos_thresh, neg_thresh, delta,
+                     pos_avg, neg_avg);
+  quant.resize(start + writer.finish());
+}
+
+void lbann_quantizer::threshold_quantize(
+  const Mat& mat, thresh_writer& quant, Mat& qerror, DataType pos_thresh,
+  DataType neg_thresh, bool delta, DataType pos_avg, DataType neg_avg) {
   if (pos_avg == 0.0f) {
     pos_avg = pos_thresh;
   }
@@ -328,11 +842,11 @@ void lbann_quantizer::threshold_quantize(const Mat& mat, ThreshQuantized& quant,
         if (val >= pos_thresh) {
           qerror_buf[pos] = val - pos_avg;
           // Delta encode pos.
-          quant.emplace_back(((pos - prev_pos) << 1) | 1);
+          quant.push_back(((pos - prev_pos) << 1) | 1);
           prev_pos = pos;
         } else if (val <= neg_thresh) {
           qerror_buf[pos] = val - neg_avg;
-          quant.emplace_back((pos - prev_pos) << 1);
+          quant.push_back((pos - prev_pos) << 1);
           prev_pos = pos;
         } else {
           qerror_buf[pos] = val;
@@ -346,10 +860,10 @@ void lbann_quantizer::threshold_quantize(const Mat& mat, ThreshQuantized& quant,
         const DataType val = mat_buf[pos] + qerror_buf[pos];
         if (val >= pos_thresh) {
           qerror_buf[pos] = val - pos_avg;
-          quant.emplace_back((pos << 1) | 1);
+          quant.push_back((pos << 1) | 1);
         } else if (val <= neg_thresh) {
           qerror_buf[pos] = val - neg_avg;
-          quant.emplace_back(pos << 1);
+          quant.push_back(pos << 1);
         } else {
           qerror_buf[pos] = val;
         }
@@ -368,26 +882,25 @@ void lbann_quantizer::threshold_quantize(
 void lbann_quantizer::threshold_unquantize(
   const ThreshQuantized& quant, Mat& mat, DataType pos_avg, DataType neg_avg,
   bool delta) {
-  threshold_unquantize(quant, quant.begin(), mat, pos_avg, neg_avg, delta);
+  thresh_reader reader(quant.data(), quant.size(), false);
+  threshold_unquantize(reader, mat, pos_avg, neg_avg, delta);
 }
 
 void lbann_quantizer::threshold_unquantize(
-  const ThreshQuantized& quant, ThreshQuantized::const_iterator quant_start,
-  Mat& mat, DataType pos_avg, DataType neg_avg, bool delta) {
-  if (std::distance(quant_start, quant.end()) == 0) return;
+  thresh_reader& quant, Mat& mat, DataType pos_avg, DataType neg_avg,
+  bool delta) {
   DataType* __restrict__ buf = mat.Buffer();
+  uqtype q;
   if (delta) {
     unsigned prev_pos = 0;
-    for (auto iter = quant_start; iter != quant.end(); ++iter) {
-      const uqtype q = *iter;
+    while (quant.next(q)) {
       const unsigned pos = (q >> 1) + prev_pos;
       prev_pos = pos;
       if (q & 1) buf[pos] = pos_avg;
       else buf[pos] = neg_avg;
     }
   } else {
-    for (auto iter = quant_start; iter != quant.end(); ++iter) {
-      const uqtype q = *iter;
+    while (quant.next(q)) {
       const unsigned pos = q >> 1;
       if (q & 1) buf[pos] = pos_avg;
       else buf[pos] = neg_avg;
@@ -402,24 +915,15 @@ void lbann_quantizer::threshold_unquantize(
 }
 
 void lbann_quantizer::threshold_unquantize_apply(
-  const ThreshQuantized& quant, ThreshQuantized::const_iterator quant_start,
-  Mat& mat, DataType pos_avg, DataType neg_avg,
+  thresh_reader& quant, Mat& mat, DataType pos_avg, DataType neg_avg,
   std::vector<unsigned>& positions, bool delta) {
-  // A general note on positions that I'm putting here because I'm not sure
-  // where else to: Using a vector admits the possibility that we have
-  // duplicate entries. This could be fixed by using an unordered_set, but when
-  // I benchmarked this, it increased our runtime by ~5 times. Having duplicate
-  // entries should not change the final result: it means that
-  // threshold_quantize_apply may quantize the same entry multiple times, but
-  // the final unquantize is not an _apply, and so will just set that entry to
-  // the same value multiple times. We send some extra data, but the overhead
-  // is small.
-  if (std::distance(quant_start, quant.end()) == 0) return;
+  // Entries arrive in increasing position order, so the positions appended
+  // here are sorted; merge_positions then folds them into the earlier ones.
   DataType* __restrict__ buf = mat.Buffer();
+  uqtype q;
   if (delta) {
     unsigned prev_pos = 0;
-    for (auto iter = quant_start; iter != quant.end(); ++iter) {
-      const uqtype q = *iter;
+    while (quant.next(q)) {
       const unsigned pos = (q >> 1) + prev_pos;
       prev_pos = pos;
       positions.emplace_back(pos);
@@ -427,8 +931,7 @@ void lbann_quantizer::threshold_unquantize_apply(
       else buf[pos] += neg_avg;
     }
   } else {
-    for (auto iter = quant_start; iter != quant.end(); ++iter) {
-      const uqtype q = *iter;
+    while (quant.next(q)) {
       const unsigned pos = q >> 1;
       positions.emplace_back(pos);
       if (q & 1) buf[pos] += pos_avg;
@@ -437,8 +940,22 @@ void lbann_quantizer::threshold_unquantize_apply(
   }
 }
 
+void lbann_quantizer::merge_positions(thresh_buffers& bufs,
+                                      size_t old_size) {
+  std::vector<unsigned>& positions = bufs.positions;
+  std::vector<unsigned>& merged = bufs.merged_positions;
+  // Both vectors are reserved up front, so this never reallocates.
+  merged.resize(positions.size());
+  const auto old_end = positions.begin() + old_size;
+  auto merged_end = std::merge(positions.begin(), old_end,
+                               old_end, positions.end(), merged.begin());
+  merged.resize(std::distance(merged.begin(),
+                              std::unique(merged.begin(), merged_end)));
+  std::swap(positions, merged);
+}
+
 void lbann_quantizer::threshold_quantize_apply(
-  const Mat& mat, ThreshQuantized& quant, Mat& qerror, DataType pos_thresh,
+  const Mat& mat, thresh_writer& quant, Mat& qerror, DataType pos_thresh,
   DataType neg_thresh, std::vector<unsigned>& positions, bool delta,
   DataType pos_avg, DataType neg_avg) {
   if (pos_avg == 0.0f) {
@@ -450,17 +967,17 @@ void lbann_quantizer::threshold_quantize_apply(
   const DataType* __restrict__ mat_buf = mat.LockedBuffer();
   DataType* __restrict__ qerror_buf = qerror.Buffer();
   if (delta) {
-    // Need to sort so positions are in order, otherwise our delta encoding
-    // doesn't work. (Could be solved by adding stops, but maybe not worth it.)
-    std::sort(positions.begin(), positions.end());
+    // positions is sorted (see merge_positions), as delta encoding requires.
     unsigned prev_pos = 0;
     for (const auto& pos : positions) {
       const DataType val = mat_buf[pos] + qerror_buf[pos];
       if (val >= pos_thresh) {
-        quant.emplace_back(((pos - prev_pos) << 1) | 1);
+        quant.push_back(((pos - prev_pos) << 1) | 1);
+        qerror_buf[pos] = val - pos_avg;
         prev_pos = pos;
       } else if (val <= neg_thresh) {
-        quant.emplace_back((pos - prev_pos) << 1);
+        quant.push_back((pos - prev_pos) << 1);
+        qerror_buf[pos] = val - neg_avg;
         prev_pos = pos;
       } else {
         qerror_buf[pos] = val;
@@ -470,10 +987,10 @@ void lbann_quantizer::threshold_quantize_apply(
     for (const auto& pos : positions) {
       const DataType val = mat_buf[pos] + qerror_buf[pos];
       if (val >= pos_thresh) {
-        quant.emplace_back((pos << 1) | 1);
+        quant.push_back((pos << 1) | 1);
         qerror_buf[pos] = val - pos_avg;
       } else if (val <= neg_thresh) {
-        quant.emplace_back(pos << 1);
+        quant.push_back(pos << 1);
         qerror_buf[pos] = val - neg_avg;
       } else {
         qerror_buf[pos] = val;
@@ -484,15 +1001,31 @@ void lbann_quantizer::threshold_quantize_apply(
 
 void lbann_quantizer::adaptive_threshold_quantize(
   const Mat& mat, ThreshQuantized& q, Mat& qerror, int proportion, bool delta) {
+  // At most every entry is kept, plus the two averages.
+  const size_t start = q.size();
+  q.resize(start + mat.Height() * mat.Width() + 2);
+  thresh_writer writer(q.data() + start, false);
+  adaptive_threshold_quantize(mat, writer, qerror, proportion, delta);
+  q.resize(start + writer.finish());
+}
+
+void lbann_quantizer::adaptive_threshold_quantize(
+  const Mat& mat, thresh_writer& q, Mat& qerror, int proportion,
+  bool delta) {
   DataType pos_thresh, neg_thresh, pos_avg, neg_avg;
-  std::tie(pos_thresh, neg_thresh, pos_avg, neg_avg) =
-    proportion_threshold_average(mat, qerror, proportion);
+  if (thresh_estimator == threshold_estimator::HISTOGRAM) {
+    std::tie(pos_thresh, neg_thresh, pos_avg, neg_avg) =
+      histogram_threshold_average(mat, qerror, proportion);
+  } else {
+    std::tie(pos_thresh, neg_thresh, pos_avg, neg_avg) =
+      proportion_threshold_average(mat, qerror, proportion);
+  }
   // Store the averages for reconstruction.
   uqtype tmp;
   memcpy(&tmp, &pos_avg, sizeof(pos_avg));
-  q.push_back(tmp);
+  q.put_raw(tmp);
   memcpy(&tmp, &neg_avg, sizeof(neg_avg));
-  q.push_back(tmp);
+  q.put_raw(tmp);
   // Do regular thresholded quantization with the computed values.
   threshold_quantize(mat, q, qerror, pos_thresh, neg_thresh, delta, pos_avg,
                      neg_avg);
@@ -506,13 +1039,20 @@ void lbann_quantizer::adaptive_threshold_quantize(
 
 void lbann_quantizer::adaptive_threshold_unquantize(
   const ThreshQuantized& q, Mat& mat, bool delta) {
+  thresh_reader reader(q.data(), q.size(), false);
+  adaptive_threshold_unquantize(reader, mat, delta);
+}
+
+void lbann_quantizer::adaptive_threshold_unquantize(
+  thresh_reader& q, Mat& mat, bool delta) {
   // Get the averages out.
   DataType pos_avg;
-  memcpy(&pos_avg, &(q[0]), sizeof(pos_avg));
+  uqtype tmp = q.get_raw();
+  memcpy(&pos_avg, &tmp, sizeof(pos_avg));
   DataType neg_avg;
-  memcpy(&neg_avg, &(q[1]), sizeof(neg_avg));
-  threshold_unquantize(q, std::next(q.begin(), 2), mat, pos_avg, neg_avg,
-                       delta);
+  tmp = q.get_raw();
+  memcpy(&neg_avg, &tmp, sizeof(neg_avg));
+  threshold_unquantize(q, mat, pos_avg, neg_avg, delta);
 }
 
 void lbann_quantizer::adaptive_threshold_unquantize(
@@ -521,18 +1061,19 @@ void lbann_quantizer::adaptive_threshold_unquantize(
 }
 
 void lbann_quantizer::adaptive_threshold_unquantize_apply(
-  const ThreshQuantized& q, Mat& mat, std::vector<unsigned>& positions, bool delta) {
+  thresh_reader& q, Mat& mat, std::vector<unsigned>& positions, bool delta) {
   // Get the averages out.
   DataType pos_avg;
-  memcpy(&pos_avg, &(q[0]), sizeof(pos_avg));
+  uqtype tmp = q.get_raw();
+  memcpy(&pos_avg, &tmp, sizeof(pos_avg));
   DataType neg_avg;
-  memcpy(&neg_avg, &(q[1]), sizeof(neg_avg));
-  threshold_unquantize_apply(q, std::next(q.begin(), 2), mat, pos_avg, neg_avg,
-                             positions, delta);
+  tmp = q.get_raw();
+  memcpy(&neg_avg, &tmp, sizeof(neg_avg));
+  threshold_unquantize_apply(q, mat, pos_avg, neg_avg, positions, delta);
 }
 
 void lbann_quantizer::adaptive_threshold_quantize_apply(
-  const Mat& mat, ThreshQuantized& q, Mat& qerror, int proportion,
+  const Mat& mat, thresh_writer& q, Mat& qerror, int proportion,
   std::vector<unsigned>& positions, bool delta) {
   DataType pos_thresh, neg_thresh, pos_avg, neg_avg;
   std::tie(pos_thresh, neg_thresh, pos_avg, neg_avg) =
@@ -540,13 +1081,49 @@ void lbann_quantizer::adaptive_threshold_quantize_apply(
   // Store the averages for reconstruction.
   uqtype tmp;
   memcpy(&tmp, &pos_avg, sizeof(pos_avg));
-  q.push_back(tmp);
+  q.put_raw(tmp);
   memcpy(&tmp, &neg_avg, sizeof(neg_avg));
-  q.push_back(tmp);
+  q.put_raw(tmp);
   threshold_quantize_apply(mat, q, qerror, pos_thresh, neg_thresh, positions,
                            delta, pos_avg, neg_avg);
 }
 
+lbann_quantizer::thresh_buffers& lbann_quantizer::get_thresh_buffers(
+  lbann_comm* comm, const Mat& mat, bool adaptive, bool compress) {
+  thresh_buffers& bufs = thresh_bufs[mat.LockedBuffer()];
+  // The last block is the widest.
+  const int nprocs = comm->get_num_models();
+  const IR max_cols = get_block_cols(mat, nprocs, nprocs - 1, nprocs);
+  const Int max_width = max_cols.end - max_cols.beg;
+  bufs.max_words = get_thresh_bound(mat.Height(), max_width, mat.LDim(),
+                                    compress);
+  if (adaptive) bufs.max_words += 2;
+  // Slots 0-3 are used by intermodel_sum_fixed_quantized.
+  const void* owner = mat.LockedBuffer();
+  const size_t words = bufs.max_words;
+  bufs.rs_send_buf = comm->get_pooled_buffer<uqtype>(owner, 4, words);
+  bufs.rs_recv_buf = comm->get_pooled_buffer<uqtype>(owner, 5, words);
+  bufs.ag_send_buf = comm->get_pooled_buffer<uqtype>(owner, 6, words);
+  bufs.ag_recv_buf = comm->get_pooled_buffer<uqtype>(owner, 7, words);
+  // Each received run and the merged positions so far are both at most one
+  // block, so merge_positions never grows these.
+  const size_t max_positions = 2 * mat.Height() * max_width;
+  bufs.positions.reserve(max_positions);
+  bufs.merged_positions.reserve(max_positions);
+  bufs.positions.clear();
+  return bufs;
+}
+
+void lbann_quantizer::check_thresh_count(const thresh_buffers& bufs,
+                                         int count) const {
+  if (count < 0 || (size_t) count > bufs.max_words) {
+    throw lbann_exception(
+      "lbann_quantizer: threshold quantized message of " +
+      std::to_string(count) + " words exceeds buffer of " +
+      std::to_string(bufs.max_words));
+  }
+}
+
 void lbann_quantizer::intermodel_sum_threshold_quantized(
   lbann_comm* comm, Mat& mat, Mat& qerror, DataType pos_thresh,
   DataType neg_thresh, Mat& im_qerror, bool compress) {
@@ -554,83 +1131,74 @@ void lbann_quantizer::intermodel_sum_threshold_quantized(
     qerror.Resize(mat.Height(), mat.Width(), mat.LDim());
     Zero(qerror);
   }
-  ThreshQuantized rs_quant;
-  ThreshQuantized rs_recv;
-  std::vector<unsigned> positions;
-  auto rs_send_trans = 
-    [&qerror, &rs_quant, compress, pos_thresh, neg_thresh, this]
+  // Quantize straight into, and unquantize straight out of, buffers pooled in
+  // comm and sized for the largest block, so repeated sums do not allocate.
+  thresh_buffers& bufs = get_thresh_buffers(comm, mat, false, compress);
+  int rs_recv_count = 0;
+  auto rs_send_trans =
+    [&qerror, &bufs, compress, pos_thresh, neg_thresh, this]
     (Mat& mat, IR h, IR w, int& count) {
       auto to_send = mat(h, w);
       auto to_send_qerr = qerror(h, w);
-      rs_quant.clear();
-      threshold_quantize(to_send, rs_quant, to_send_qerr, pos_thresh,
+      thresh_writer writer(bufs.rs_send_buf, compress);
+      threshold_quantize(to_send, writer, to_send_qerr, pos_thresh,
                          neg_thresh, compress);
-      if (compress) {
-        ThreshQuantized comp;
-        compress_thresholds(rs_quant, comp);
-        std::swap(rs_quant, comp);
-      }
-      count = rs_quant.size();
-      return rs_quant.data();
+      count = writer.finish();
+      return bufs.rs_send_buf;
     };
-  auto rs_get_recv_buf = 
-    [&rs_recv] (Mat& mat, int& count) {
-      rs_recv.resize(count);
-      return rs_recv.data();
+  auto rs_get_recv_buf =
+    [&bufs, &rs_recv_count, this] (Mat& mat, int& count) {
+      check_thresh_count(bufs, count);
+      rs_recv_count = count;
+      return bufs.rs_recv_buf;
     };
-  auto rs_recv_trans = 
-    [&rs_recv, &positions, compress, pos_thresh, neg_thresh, this]
+  auto rs_recv_trans =
+    [&bufs, &rs_recv_count, compress, pos_thresh, neg_thresh, this]
     (uqtype* buf, Mat& accum) {
-      if (compress) {
-        ThreshQuantized uncomp;
-        uncompress_thresholds(rs_recv, uncomp);
-        std::swap(rs_recv, uncomp);
-      }
-      threshold_unquantize_apply(rs_recv, rs_recv.begin(), accum, pos_thresh,
-                                 neg_thresh, positions, compress);
+      thresh_reader reader(buf, rs_recv_count, compress);
+      const size_t old_size = bufs.positions.size();
+      threshold_unquantize_apply(reader, accum, pos_thresh, neg_thresh,
+                                 bufs.positions, compress);
+      merge_positions(bufs, old_size);
     };
   intermodel_ring_reduce_scatter<uqtype>(comm, mat, true, rs_send_trans,
                                          rs_get_recv_buf, rs_recv_trans);
-  ThreshQuantized ag_send;
-  ThreshQuantized ag_recv;
+  uqtype* ag_send = bufs.ag_send_buf;
+  uqtype* ag_recv = bufs.ag_recv_buf;
+  int ag_send_count = 0;
+  int ag_recv_count = 0;
   auto ag_reduced_trans =
-    [&im_qerror, &ag_send, &positions, compress, pos_thresh, neg_thresh, this]
-    (Mat& reduced) {
+    [&im_qerror, &bufs, &ag_send, &ag_send_count, compress, pos_thresh,
+     neg_thresh, this] (Mat& reduced) {
       if (im_qerror.Height() == 0) {
         im_qerror.Resize(reduced.Height(), reduced.Width(), reduced.LDim());
         Zero(im_qerror);
       }
-      threshold_quantize_apply(reduced, ag_send, im_qerror, pos_thresh,
-                               neg_thresh, positions, compress);
-      if (compress) {
-        ThreshQuantized comp;
-        compress_thresholds(ag_send, comp);
-        std::swap(ag_send, comp);
-      }
+      thresh_writer writer(ag_send, compress);
+      threshold_quantize_apply(reduced, writer, im_qerror, pos_thresh,
+                               neg_thresh, bufs.positions, compress);
+      ag_send_count = writer.finish();
     };
-  auto ag_get_send_buf = [&ag_send] (int& count) {
-      count = ag_send.size();
-      return ag_send.data();
+  auto ag_get_send_buf = [&ag_send, &ag_send_count] (int& count) {
+      count = ag_send_count;
+      return ag_send;
     };
   auto ag_get_recv_buf =
-    [&ag_recv] (Mat& recv_view, int& count) {
-      ag_recv.resize(count);
-      return ag_recv.data();
+    [&bufs, &ag_recv, &ag_recv_count, this] (Mat& recv_view, int& count) {
+      check_thresh_count(bufs, count);
+      ag_recv_count = count;
+      return ag_recv;
     };
-  auto ag_recv_trans = 
-    [&ag_recv, compress, pos_thresh, neg_thresh, this]
-    (uqtype*, Mat& accum) {
-      if (compress) {
-        ThreshQuantized uncomp;
-        uncompress_thresholds(ag_recv, uncomp);
-        threshold_unquantize(uncomp, accum, pos_thresh, neg_thresh, compress);
-      } else {
-        threshold_unquantize(ag_recv, accum, pos_thresh, neg_thresh);
-      }
+  auto ag_recv_trans =
+    [&ag_recv_count, compress, pos_thresh, neg_thresh, this]
+    (uqtype* buf, Mat& accum) {
+      thresh_reader reader(buf, ag_recv_count, compress);
+      threshold_unquantize(reader, accum, pos_thresh, neg_thresh, compress);
     };
   auto ag_swap_bufs =
-    [&ag_send, &ag_recv] (uqtype*, uqtype*) {
+    [&ag_send, &ag_recv, &ag_send_count, &ag_recv_count] (uqtype*, uqtype*) {
       std::swap(ag_send, ag_recv);
+      ag_send_count = ag_recv_count;
     };
   intermodel_ring_allgather<uqtype>(comm, mat, true, ag_reduced_trans,
                                     ag_get_send_buf, ag_get_recv_buf,
@@ -638,10 +1206,12 @@ void lbann_quantizer::intermodel_sum_threshold_quantized(
 }
 
 void lbann_quantizer::intermodel_sum_threshold_quantized(
-  lbann_comm* comm, DistMat& mat, Mat& qerror, DataType pos_thresh,
+  lbann_comm* comm, ElMat& mat, Mat& qerror, DataType pos_thresh,
   DataType neg_thresh, Mat& im_qerror, bool compress) {
-  intermodel_sum_threshold_quantized(comm, mat.Matrix(), qerror, pos_thresh,
-                                     neg_thresh, im_qerror, compress);
+  sum_redundant_shares(mat, [&] (Mat& share) {
+      intermodel_sum_threshold_quantized(comm, share, qerror, pos_thresh,
+                                         neg_thresh, im_qerror, compress);
+    });
 }
 
 void lbann_quantizer::intermodel_sum_adaptive_threshold_quantized(
@@ -651,85 +1221,97 @@ void lbann_quantizer::intermodel_sum_adaptive_threshold_quantized(
     qerror.Resize(mat.Height(), mat.Width(), mat.LDim());
     Zero(qerror);
   }
-  ThreshQuantized rs_quant;
-  ThreshQuantized rs_recv;
-  ThreshQuantized comp_buf;
-  ThreshQuantized uncomp_buf;
-  std::vector<unsigned> positions;
-  auto rs_send_trans = 
-    [&qerror, &rs_quant, compress, proportion, this]
+  // As in intermodel_sum_threshold_quantized, work in pooled buffers.
+  thresh_buffers& bufs = get_thresh_buffers(comm, mat, true, compress);
+  int rs_recv_count = 0;
+  auto rs_send_trans =
+    [&qerror, &bufs, compress, proportion, this]
     (Mat& mat, IR h, IR w, int& count) {
       auto to_send = mat(h, w);
       auto to_send_qerr = qerror(h, w);
-      rs_quant.clear();
-      adaptive_threshold_quantize(to_send, rs_quant, to_send_qerr, proportion,
+      thresh_writer writer(bufs.rs_send_buf, compress);
+      adaptive_threshold_quantize(to_send, writer, to_send_qerr, proportion,
                                   compress);
-      if (compress) {
-        ThreshQuantized comp;
-        compress_adaptive_thresholds(rs_quant, comp);
-        std::swap(rs_quant, comp);
-      }
-      count = rs_quant.size();
-      return rs_quant.data();
+      count = writer.finish();
+      return bufs.rs_send_buf;
     };
-  auto rs_get_recv_buf = 
-    [&rs_recv] (Mat& mat, int& count) {
-      rs_recv.resize(count);
-      return rs_recv.data();
+  auto rs_get_recv_buf =
+    [&bufs, &rs_recv_count, this] (Mat& mat, int& count) {
+      check_thresh_count(bufs, count);
+      rs_recv_count = count;
+      return bufs.rs_recv_buf;
     };
-  auto rs_recv_trans = 
-    [&rs_recv, &positions, compress, this]
+  auto rs_recv_trans =
+    [&bufs, &rs_recv_count, compress, this]
     (uqtype* buf, Mat& accum) {
-      if (compress) {
-        ThreshQuantized uncomp;
-        uncompress_adaptive_thresholds(rs_recv, uncomp);
-        std::swap(rs_recv, uncomp);
-      }
-      adaptive_threshold_unquantize_apply(rs_recv, accum, positions,
+      thresh_reader reader(buf, rs_recv_count, compress);
+      const size_t old_size = bufs.positions.size();
+      adaptive_threshold_unquantize_apply(reader, accum, bufs.positions,
                                           compress);
+      merge_positions(bufs, old_size);
     };
   intermodel_ring_reduce_scatter<uqtype>(comm, mat, true, rs_send_trans,
                                          rs_get_recv_buf, rs_recv_trans);
-  ThreshQuantized ag_send;
-  ThreshQuantized ag_recv;
+  uqtype* ag_send = bufs.ag_send_buf;
+  uqtype* ag_recv = bufs.ag_recv_buf;
+  int ag_send_count = 0;
+  int ag_recv_count = 0;
   auto ag_reduced_trans =
-    [&im_qerror, &ag_send, &positions, compress, proportion, this]
+    [&im_qerror, &bufs, &ag_send, &ag_send_count, compress, proportion, this]
     (Mat& reduced) {
       if (im_qerror.Height() == 0) {
         im_qerror.Resize(reduced.Height(), reduced.Width(), reduced.LDim());
         Zero(im_qerror);
       }
-      adaptive_threshold_quantize_apply(reduced, ag_send, im_qerror, proportion,
-                                        positions, compress);
-      if (compress) {
-        ThreshQuantized comp;
-        compress_adaptive_thresholds(ag_send, comp);
-        std::swap(comp, ag_send);
+      thresh_writer writer(ag_send, compress);
+      adaptive_threshold_quantize_apply(reduced, writer, im_qerror, proportion,
+                                        bufs.positions, compress);
+      ag_send_count = writer.finish();
+      // Keep what the other models receive, so every model has the same sum.
+      // Entries no other model sent were not quantized, so they move to the
+      // error instead.
+      const std::vector<unsigned>& positions = bufs.positions;
+      DataType* __restrict__ reduced_buf = reduced.Buffer();
+      DataType* __restrict__ im_qerror_buf = im_qerror.Buffer();
+      const Int ldim = reduced.LDim();
+      auto pos_iter = positions.begin();
+      for (Int col = 0; col < reduced.Width(); ++col) {
+        for (Int row = 0; row < reduced.Height(); ++row) {
+          const unsigned pos = row + col * ldim;
+          while (pos_iter != positions.end() && *pos_iter < pos) {
+            ++pos_iter;
+          }
+          if (pos_iter == positions.end() || *pos_iter != pos) {
+            im_qerror_buf[pos] += reduced_buf[pos];
+          }
+          reduced_buf[pos] = DataType(0);
+        }
       }
+      thresh_reader reader(ag_send, ag_send_count, compress);
+      adaptive_threshold_unquantize(reader, reduced, compress);
     };
-  auto ag_get_send_buf = [&ag_send] (int& count) {
-      count = ag_send.size();
-      return ag_send.data();
+  auto ag_get_send_buf = [&ag_send, &ag_send_count] (int& count) {
+      count = ag_send_count;
+      return ag_send;
     };
   auto ag_get_recv_buf =
-    [&ag_recv] (Mat& recv_view, int& count) {
-      ag_recv.resize(count);
-      return ag_recv.data();
+    [&bufs, &ag_recv, &ag_recv_count, this] (Mat& recv_view, int& count) {
+      check_thresh_count(bufs, count);
+      ag_recv_count = count;
+      return ag_recv;
     };
-  auto ag_recv_trans = 
-    [&ag_recv, compress, proportion, this]
-    (uqtype*, Mat& accum) {
-      if (compress) {
-        ThreshQuantized uncomp;
-        uncompress_adaptive_thresholds(ag_recv, uncomp);
-        adaptive_threshold_unquantize(uncomp, accum, compress);
-      } else {
-        adaptive_threshold_unquantize(ag_recv, accum);
-      }
+  auto ag_recv_trans =
+    [&ag_recv_count, compress, this]
+    (uqtype* buf, Mat& accum) {
+      // Unsent entries of the sum are zero.
+      Zero(accum);
+      thresh_reader reader(buf, ag_recv_count, compress);
+      adaptive_threshold_unquantize(reader, accum, compress);
     };
   auto ag_swap_bufs =
-    [&ag_send, &ag_recv] (uqtype*, uqtype*) {
+    [&ag_send, &ag_recv, &ag_send_count, &ag_recv_count] (uqtype*, uqtype*) {
       std::swap(ag_send, ag_recv);
+      ag_send_count = ag_recv_count;
     };
   intermodel_ring_allgather<uqtype>(comm, mat, true, ag_reduced_trans,
                                     ag_get_send_buf, ag_get_recv_buf,
@@ -737,113 +1319,296 @@ void lbann_quantizer::intermodel_sum_adaptive_threshold_quantized(
 }
 
 void lbann_quantizer::intermodel_sum_adaptive_threshold_quantized(
-  lbann_comm* comm, DistMat& mat, Mat& qerror, int proportion, Mat& im_qerror,
+  lbann_comm* comm, ElMat& mat, Mat& qerror, int proportion, Mat& im_qerror,
   bool compress) {
-  intermodel_sum_adaptive_threshold_quantized(comm, mat.Matrix(), qerror,
-                                              proportion, im_qerror, compress);
+  sum_redundant_shares(mat, [&] (Mat& share) {
+      intermodel_sum_adaptive_threshold_quantized(comm, share, qerror,
+                                                  proportion, im_qerror,
+                                                  compress);
+    });
 }
 
-void lbann_quantizer::compress_thresholds(const ThreshQuantized& q,
-                                          ThreshQuantized& cq) {
-  compress_thresholds(q, q.begin(), cq);
+void lbann_quantizer::intermodel_sum_topk(lbann_comm* comm, Mat& mat,
+                                          Mat& qerror, int proportion) {
+  // Initialize qerror.
+  if (qerror.Height() == 0) {
+    qerror.Resize(mat.Height(), mat.Width(), mat.LDim());
+    Zero(qerror);
+  }
+  thresh_buffers& bufs = get_thresh_buffers(mat);
+  ThreshQuantized& sparse = bufs.ag_send;
+  ThreshQuantized& recv = bufs.ag_recv;
+  ThreshQuantized& merged = bufs.uncomp;
+  double send_trans_start = get_time();
+  sparse.clear();
+  topk_select(mat, qerror, proportion, sparse);
+  rs_send_trans_time += get_time() - send_trans_start;
+  double ag_start = get_time();
+  const int rank = comm->get_model_rank();
+  const int nprocs = comm->get_num_models();
+  const bool pow2 = (nprocs & (nprocs - 1)) == 0;
+  if (!pow2) {
+    // Sets from the other models are accumulated as they arrive.
+    Zero(mat);
+    sparse_accumulate(sparse, mat);
+  }
+  int src = rank - 1;
+  if (src < 0) src = nprocs - 1;
+  const int dst = (rank + 1) % nprocs;
+  for (int step = 1; step < nprocs; step = pow2 ? step * 2 : step + 1) {
+    const int send_to = pow2 ? rank ^ step : dst;
+    const int recv_from = pow2 ? rank ^ step : src;
+    lbann_mpi_req<uqtype> req;
+    comm->nb_send_var(sparse.data(), sparse.size(), send_to, comm_tag, req);
+    ag_bytes_sent += sparse.size() * sizeof(uqtype);
+    double recv_buf_start = get_time();
+    lbann_matched_msg msg;
+    const int recv_size = comm->probe_var<uqtype>(recv_from, comm_tag, msg);
+    recv.resize(recv_size);
+    ag_recv_buf_time += get_time() - recv_buf_start;
+    comm->recv_var(recv.data(), recv_size, msg);
+    ag_bytes_received += recv_size * sizeof(uqtype);
+    double recv_trans_start = get_time();
+    if (pow2) {
+      merge_sparse(sparse, recv, merged);
+    } else {
+      sparse_accumulate(recv, mat);
+    }
+    ag_recv_trans_time += get_time() - recv_trans_start;
+    comm->wait<uqtype>(req);
+    // Send the merged set next, or forward what was received around the ring.
+    std::swap(sparse, pow2 ? merged : recv);
+  }
+  if (pow2) {
+    double recv_trans_start = get_time();
+    Zero(mat);
+    sparse_accumulate(sparse, mat);
+    ag_recv_trans_time += get_time() - recv_trans_start;
+  }
+  ag_time += get_time() - ag_start;
 }
 
-void lbann_quantizer::compress_thresholds(
-  const ThreshQuantized& q, ThreshQuantized::const_iterator qstart,
-  ThreshQuantized& cq) {
-  // Handle empty input.
-  if (std::distance(qstart, q.end()) == 0) {
-    cq.push_back(~((uqtype) 0));
+void lbann_quantizer::intermodel_sum_topk(lbann_comm* comm, ElMat& mat,
+                                          Mat& qerror, int proportion) {
+  sum_redundant_shares(mat, [&] (Mat& share) {
+      intermodel_sum_topk(comm, share, qerror, proportion);
+    });
+}
+
+void lbann_quantizer::intermodel_average_delta_quantized(
+  lbann_comm* comm, Mat& mat, const Mat& ref, Mat& qerror, Mat& im_qerror,
+  int proportion) {
+  // Sum the differences in place, then add ref back to the average.
+  Axpy(DataType(-1), ref, mat);
+  if (proportion == 0) {
+    intermodel_sum_quantized(comm, mat, qerror, im_qerror);
+  } else {
+    intermodel_sum_adaptive_threshold_quantized(comm, mat, qerror, proportion,
+                                                im_qerror);
+  }
+  Scale(DataType(1) / comm->get_num_models(), mat);
+  Axpy(DataType(1), ref, mat);
+}
+
+void lbann_quantizer::intermodel_broadcast_delta_quantized(
+  lbann_comm* comm, const Mat& mat, Mat& ref, Mat& qerror, int root,
+  int proportion) {
+  const void* owner = ref.LockedBuffer();
+  if (proportion == 0) {
+    const Int qheight = get_quantized_matrix_height(ref);
+    qtype* buf = comm->get_pooled_buffer<qtype>(owner, 0,
+                                                qheight * ref.Width());
+    QuantizedMatrix qmat;
+    qmat.Attach(qheight, ref.Width(), buf, qheight);
+    lbann_mpi_req<qtype> req;
+    nb_intermodel_broadcast_delta_quantized(comm, mat, ref, qerror, root, qmat,
+                                            req);
+    complete_broadcast_delta_quantized(comm, qmat, ref, req);
     return;
   }
-  // Write to cur starting from cur's LSB.
-  uqtype cur = 0;
-  // The current bit to write to. This is between 0 and NUM_BITS-1.
-  // E.g., between 0, ... 31 inclusive, so the bit is 1 << cur_bit.
-  // Thus there are NUM_BITS - cur_bit bits left that can be written.
-  uqtype cur_bit = 0;
-  for (auto iter = qstart; iter != q.end(); ++iter) {
-    uqtype ent = *iter;
-    uqtype quotient = ent >> GR_K;
-    uqtype remainder = ent & (GR_M - 1);
-    uqtype bits_left = NUM_BITS - cur_bit;
-    // Write quotient 1s.
-    if (bits_left >= quotient) {
-      // Can fit in the current chunk.
-      if (quotient == NUM_BITS) {
-        cq.push_back(~((uqtype) 0));
-        // Don't need to reset cur, cur_bit: already 0.
-      } else {
-        cur |= ((1 << quotient) - 1) << cur_bit;
-        cur_bit += quotient;
-        if (cur_bit == NUM_BITS) {
-          cq.push_back(cur);
-          cur = 0;
-          cur_bit = 0;
-        }
-      }
-    } else {
-      // Need to split quotient into multiple chunks.
-      // Write the first bits_left 1s to the current chunk.
-      if (bits_left == NUM_BITS) {
-        cur = ~((uqtype) 0);
-      } else {
-        cur |= ((1 << bits_left) - 1) << cur_bit;
-      }
-      cq.push_back(cur);
-      quotient -= bits_left;
-      // Write chunks of 1s until we have less than NUM_BITS left to write.
-      for (uqtype i = 0; i < quotient / NUM_BITS; ++i) {
-        cq.push_back(~((uqtype) 0));
-      }
-      // Lastly write the remaining 1s to a new chunk.
-      quotient %= NUM_BITS;
-      if (quotient > 0) {
-        cur = (1 << quotient) - 1;
-        cur_bit = quotient;
-      } else {
-        cur = 0;
-        cur_bit = 0;
-      }
+  const bool is_root = comm->get_model_rank() == root;
+  if (is_root) {
+    if (qerror.Height() == 0) {
+      qerror.Resize(ref.Height(), ref.Width(), ref.LDim());
+      Zero(qerror);
+    }
+    // The quantizers quantize mat + qerror and leave the error in qerror, so
+    // shifting qerror by -ref quantizes the difference without a copy.
+    Axpy(DataType(-1), ref, qerror);
+  }
+  const size_t max_words =
+    get_thresh_bound(ref.Height(), ref.Width(), ref.LDim(), true) + 2;
+  uqtype* buf = comm->get_pooled_buffer<uqtype>(owner, 4, max_words);
+  int count = 0;
+  if (is_root) {
+    thresh_writer writer(buf, true);
+    adaptive_threshold_quantize(mat, writer, qerror, proportion, true);
+    count = writer.finish();
+  }
+  count = comm->intermodel_broadcast(root, count);
+  comm->intermodel_broadcast(buf, count, root);
+  thresh_buffers& bufs = get_thresh_buffers(ref);
+  thresh_reader reader(buf, count, true);
+  adaptive_threshold_unquantize_apply(reader, ref, bufs.positions, true);
+  bufs.positions.clear();
+}
+
+void lbann_quantizer::nb_intermodel_broadcast_delta_quantized(
+  lbann_comm* comm, const Mat& mat, const Mat& ref, Mat& qerror, int root,
+  QuantizedMatrix& qmat, lbann_mpi_req<qtype>& req) {
+  const Int qheight = get_quantized_matrix_height(ref);
+  if (qmat.Height() != qheight || qmat.Width() != ref.Width()) {
+    qmat.Resize(qheight, ref.Width());
+  }
+  if (comm->get_model_rank() == root) {
+    if (qerror.Height() == 0) {
+      qerror.Resize(ref.Height(), ref.Width(), ref.LDim());
+      Zero(qerror);
     }
-    // Write trailing 0.
-    // There should always be at least one bit available here.
-    cur_bit += 1;
-    if (cur_bit == NUM_BITS) {
-      cq.push_back(cur);
-      cur = 0;
-      cur_bit = 0;
+    // As above, shift qerror to quantize the difference from ref.
+    Axpy(DataType(-1), ref, qerror);
+    quantize(mat, qmat, qerror);
+  }
+  comm->nb_intermodel_broadcast(qmat.Buffer(), qheight * ref.Width(), root,
+                                req);
+}
+
+void lbann_quantizer::complete_broadcast_delta_quantized(
+  lbann_comm* comm, const QuantizedMatrix& qmat, Mat& ref,
+  lbann_mpi_req<qtype>& req) {
+  comm->wait<qtype>(req);
+  unquantize(qmat, ref, true);
+}
+
+void lbann_quantizer::release_buffers(lbann_comm* comm, const Mat& mat) {
+  const DataType* start = mat.LockedBuffer();
+  const DataType* end = start + mat.LDim() * mat.Width();
+  for (auto iter = thresh_bufs.begin(); iter != thresh_bufs.end();) {
+    if (iter->first >= start && iter->first < end) {
+      iter = thresh_bufs.erase(iter);
+    } else {
+      ++iter;
     }
-    // Write remainder as a GR_K-length binary string.
-    // Always fits in at most two chunks, since GR_K <= 31.
-    bits_left = NUM_BITS - cur_bit;
-    if (bits_left >= GR_K) {
-      // Can fit the remainder in the current chunk.
-      cur |= remainder << cur_bit;
-      cur_bit += GR_K;
-      if (cur_bit == NUM_BITS) {
-        cq.push_back(cur);
-        cur = 0;
-        cur_bit = 0;
+  }
+  comm->release_pooled_buffers(start, sizeof(DataType) * (end - start));
+}
+
+void lbann_quantizer::get_redundant_share(const ElMat& mat, IR& rows,
+                                          IR& cols) const {
+  const Int height = mat.LocalHeight();
+  const Int width = mat.LocalWidth();
+  const Int num_shares = mat.RedundantSize();
+  const Int share = mat.RedundantRank();
+  rows = IR(0, height);
+  cols = IR(0, width);
+  if (num_shares == 1) {
+    return;
+  }
+  // Split by columns, which keeps shares contiguous, unless there are too few
+  // (e.g. for a [*,*] column vector).
+  if (width >= num_shares) {
+    cols = IR(share * width / num_shares, (share + 1) * width / num_shares);
+  } else {
+    rows = IR(share * height / num_shares, (share + 1) * height / num_shares);
+  }
+}
+
+void lbann_quantizer::combine_redundant_shares(ElMat& mat, IR rows, IR cols) {
+  if (mat.RedundantSize() == 1) {
+    return;
+  }
+  // Zero everything outside this process's share, so that summing the copies
+  // assembles the shares.
+  Mat& local = mat.Matrix();
+  const Int height = local.Height();
+  const Int width = local.Width();
+  auto before_rows = local(IR(0, rows.beg), IR(0, width));
+  auto after_rows = local(IR(rows.end, height), IR(0, width));
+  auto before_cols = local(IR(0, height), IR(0, cols.beg));
+  auto after_cols = local(IR(0, height), IR(cols.end, width));
+  Zero(before_rows);
+  Zero(after_rows);
+  Zero(before_cols);
+  Zero(after_cols);
+  AllReduce(local, mat.RedundantComm(), mpi::SUM);
+}
+
+void lbann_quantizer::sum_redundant_shares(ElMat& mat,
+                                           std::function<void(Mat&)> sum) {
+  IR rows, cols;
+  get_redundant_share(mat, rows, cols);
+  // Every model has the same distribution, so models skip empty shares
+  // together.
+  if (rows.end > rows.beg && cols.end > cols.beg) {
+    auto share = mat.Matrix()(rows, cols);
+    sum(share);
+  }
+  combine_redundant_shares(mat, rows, cols);
+}
+
+void lbann_quantizer::topk_select(const Mat& mat, Mat& qerror, int proportion,
+                                  ThreshQuantized& sparse) {
+  DataType pos_thresh, neg_thresh, pos_avg, neg_avg;
+  std::tie(pos_thresh, neg_thresh, pos_avg, neg_avg) =
+    histogram_threshold_average(mat, qerror, proportion);
+  const Int width = mat.Width();
+  const Int height = mat.Height();
+  const Int ldim = mat.LDim();
+  const DataType* __restrict__ mat_buf = mat.LockedBuffer();
+  DataType* __restrict__ qerror_buf = qerror.Buffer();
+  for (Int col = 0; col < width; ++col) {
+    for (Int row = 0; row < height; ++row) {
+      const Int pos = row + col * ldim;
+      const DataType val = mat_buf[pos] + qerror_buf[pos];
+      // Zeros are never worth sending, even if the threshold is 0.
+      if ((val >= pos_thresh && val > 0.0f) ||
+          (val <= neg_thresh && val < 0.0f)) {
+        uqtype val_bits;
+        memcpy(&val_bits, &val, sizeof(val));
+        sparse.push_back(row + col * height);
+        sparse.push_back(val_bits);
+        qerror_buf[pos] = 0.0f;
+      } else {
+        qerror_buf[pos] = val;
       }
-    } else {
-      // Need to split the remainder into two chunks.
-      // Write the first bits_left bits to the current chunk.
-      cur |= (remainder & ((1 << bits_left) - 1)) << cur_bit;
-      cq.push_back(cur);
-      // Now write the remaining GR_K - bits_left bits to the new chunk.
-      cur = remainder >> bits_left;
-      cur_bit = GR_K - bits_left;
     }
   }
-  // Pad the end of cur with 1s to terminate it (if needed).
-  if (cur_bit > 0) {
-    uqtype bits_left = NUM_BITS - cur_bit;
-    cur |= ((1 << bits_left) - 1) << cur_bit;
+}
+
+void lbann_quantizer::sparse_accumulate(const ThreshQuantized& sparse,
+                                        Mat& mat) {
+  const Int height = mat.Height();
+  const Int ldim = mat.LDim();
+  DataType* __restrict__ mat_buf = mat.Buffer();
+  for (size_t i = 0; i < sparse.size(); i += 2) {
+    DataType val;
+    memcpy(&val, &sparse[i + 1], sizeof(val));
+    mat_buf[(sparse[i] % height) + (sparse[i] / height) * ldim] += val;
   }
-  if (cur) {
-    cq.push_back(cur);
+}
+
+void lbann_quantizer::compress_thresholds(const ThreshQuantized& q,
+                                          ThreshQuantized& cq) {
+  compress_thresholds(q, q.begin(), cq);
+}
+
+void lbann_quantizer::compress_thresholds(
+  const ThreshQuantized& q, ThreshQuantized::const_iterator qstart,
+  ThreshQuantized& cq) {
+  // Compute the exact output size first so words can be written without
+  // reallocating. Empty input is marked with a single word.
+  size_t total_bits = 0;
+  for (auto iter = qstart; iter != q.end(); ++iter) {
+    total_bits += (*iter >> GR_K) + 1 + GR_K;
+  }
+  const size_t out = cq.size();
+  cq.resize(out + std::max((total_bits + NUM_BITS - 1) / NUM_BITS,
+                           (size_t) 1));
+  thresh_writer writer(cq.data() + out, true);
+  for (auto iter = qstart; iter != q.end(); ++iter) {
+    writer.push_back(*iter);
   }
+  cq.resize(out + writer.finish());
 }
 
 void lbann_quantizer::compress_adaptive_thresholds(const ThreshQuantized& q,
@@ -861,59 +1626,17 @@ void lbann_quantizer::uncompress_thresholds(const ThreshQuantized& cq,
 void lbann_quantizer::uncompress_thresholds(
   const ThreshQuantized& cq, ThreshQuantized::const_iterator cqstart,
   ThreshQuantized& q) {
-  uqtype quotient = 0;
-  uqtype remainder = 0;
-  // Like in compress, cur_bit is the current bit being read.
-  uqtype cur_bit = 0;
-  for (size_t i = std::distance(cq.begin(), cqstart); i < cq.size();) {
-    uqtype cur = cq[i];
-    // Decode the quotient by continuing until we find a 0.
-    // If we hit the end without finding a 0, this was the end of the list.
-    while ((cur >> cur_bit) & 0x1) {
-      ++quotient;
-      ++cur_bit;
-      if (cur_bit == NUM_BITS) {
-        // Hit end of current chunk.
-        ++i;
-        if (i == cq.size()) {
-          return;  // Nothing left.
-        }
-        cur = cq[i];
-        cur_bit = 0;
-      }
-    }
-    // Skip past the 0.
-    ++cur_bit;
-    if (cur_bit == NUM_BITS) {
-      ++i;
-      cur = cq[i];
-      cur_bit = 0;
-    }
-    // Decode the remainder (GR_K bits).
-    if (cur_bit + GR_K <= NUM_BITS) {
-      // Remainder is entirely in the current chunk.
-      remainder = (cur >> cur_bit) & (GR_M - 1);
-      cur_bit += GR_K;
-      if (cur_bit == NUM_BITS) {
-        ++i;
-        cur_bit = 0;
-      }
-    } else {
-      // Remainder is split over this and the next chunk.
-      uqtype bits_left = NUM_BITS - cur_bit;
-      // Start with the top bits_left bits.
-      remainder = cur >> cur_bit;
-      ++i;
-      cur = cq[i];
-      // Now get remaining GR_K - bits_left bits from the new cur.
-      remainder |= (cur & ((1 << (GR_K - bits_left)) - 1)) << bits_left;
-      cur_bit = GR_K - bits_left;
-    }
-    // Now decode the final value.
-    q.push_back(quotient * GR_M + remainder);
-    quotient = 0;
-    remainder = 0;
+  const size_t i = std::distance(cq.begin(), cqstart);
+  // Every entry takes at least GR_K + 1 bits, which bounds the output size.
+  size_t out = q.size();
+  q.resize(out + ((cq.size() - i) * NUM_BITS) / (GR_K + 1));
+  uqtype* __restrict__ q_buf = q.data();
+  thresh_reader reader(cq.data() + i, cq.size() - i, true);
+  uqtype ent;
+  while (reader.next(ent)) {
+    q_buf[out++] = ent;
   }
+  q.resize(out);
 }
 
 void lbann_quantizer::uncompress_adaptive_thresholds(const ThreshQuantized& cq,
@@ -1003,6 +1726,62 @@ lbann_quantizer::proportion_threshold_average(
   return std::make_tuple(pos_thresh, neg_thresh, pos_avg, neg_avg);
 }
 
+std::tuple<DataType, DataType, DataType, DataType>
+lbann_quantizer::histogram_threshold_average(
+  const Mat& mat, const Mat& qerror, int proportion, bool refine) {
+  double pta_start = get_time();
+  // Index 0 is for non-negative entries, 1 for negative entries.
+  threshold_histogram hist;
+  int coarse[2] = {-1, -1};
+  fill_threshold_histogram(mat, qerror, coarse, hist);
+  size_t to_keep[2];
+  size_t kept[2] = {0, 0};
+  double kept_sum[2] = {0.0, 0.0};
+  uint32_t thresh_bits[2] = {0, 0};
+  for (int sign = 0; sign < 2; ++sign) {
+    const size_t total = std::accumulate(hist.count[sign],
+                                         hist.count[sign] + HIST_BUCKETS,
+                                         (size_t) 0);
+    to_keep[sign] = std::max(total / proportion, (size_t) 1);
+    if (total == 0) {
+      // Never matches when refining.
+      coarse[sign] = HIST_BUCKETS;
+      continue;
+    }
+    coarse[sign] = select_histogram_bucket(hist, sign, to_keep[sign],
+                                           kept[sign], kept_sum[sign],
+                                           !refine);
+    thresh_bits[sign] = ((uint32_t) coarse[sign]) << HIST_COARSE_SHIFT;
+  }
+  if (refine) {
+    fill_threshold_histogram(mat, qerror, coarse, hist);
+    for (int sign = 0; sign < 2; ++sign) {
+      if (coarse[sign] == HIST_BUCKETS) {
+        continue;
+      }
+      const int fine = select_histogram_bucket(
+        hist, sign, to_keep[sign] - kept[sign], kept[sign], kept_sum[sign],
+        true);
+      thresh_bits[sign] |= ((uint32_t) fine) << HIST_FINE_SHIFT;
+    }
+  }
+  // Set to 0 if there's none.
+  DataType thresh[2] = {0.0f, 0.0f};
+  DataType avg[2] = {0.0f, 0.0f};
+  for (int sign = 0; sign < 2; ++sign) {
+    if (kept[sign] > 0) {
+      memcpy(&thresh[sign], &thresh_bits[sign], sizeof(DataType));
+      avg[sign] = kept_sum[sign] / kept[sign];
+      if (sign) {
+        thresh[sign] = -thresh[sign];
+        avg[sign] = -avg[sign];
+      }
+    }
+  }
+  pta_time += get_time() - pta_start;
+  return std::make_tuple(thresh[0], thresh[1], avg[0], avg[1]);
+}
+
 std::tuple<DataType, DataType, DataType, DataType>
 lbann_quantizer::proportion_threshold_average_pos(
   const Mat& mat, const Mat& qerror, int proportion,
@@ -25,12 +25,68 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "lbann/utils/lbann_random.hpp"
+#include <cmath>
+#include <cstdint>
 
 namespace {
 // Random number generator, file-visible only.
 lbann::rng_gen generator;
+
+// Seed used by the counter-based matrix fills.
+uint64_t fill_seed = 0;
+// Number of counter-based fills performed since the last init_random.
+// Every rank performs the same sequence of fills, so this stays consistent
+// across ranks and gives each fill an independent stream.
+uint64_t fill_stream = 0;
+
+/** SplitMix64 finalizer; a bijective, well-mixing 64-bit hash. */
+inline uint64_t mix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * Counter-based generator: return 64 random bits that depend only on the
+ * stream key and the global (row, col) position of an entry.
+ */
+inline uint64_t counter_bits(uint64_t key, El::Int row, El::Int col) {
+  return mix64(mix64(key ^ mix64((uint64_t) row)) ^ (uint64_t) col);
+}
+
+/** Return a new stream key for a matrix fill. */
+inline uint64_t next_fill_key() {
+  return mix64(fill_seed ^ mix64(fill_stream++));
+}
+
+/** Uniform double in [0, 1) from the high 53 bits of x. */
+inline double bits_to_unit(uint64_t x) {
+  return (x >> 11) * (1.0 / 9007199254740992.0);
 }
 
+/**
+ * Fill the local entries of mat with f(bits), where bits is the counter-based
+ * random value of the entry's global position.
+ */
+template <typename F>
+void counter_fill(ElMat& mat, El::Int m, El::Int n, F f) {
+  mat.Resize(m, n);
+  const uint64_t key = next_fill_key();
+  const El::Int local_height = mat.LocalHeight();
+  const El::Int local_width = mat.LocalWidth();
+  Mat& local_mat = mat.Matrix();
+  for (El::Int col = 0; col < local_width; ++col) {
+    const El::Int global_col = mat.GlobalCol(col);
+    for (El::Int row = 0; row < local_height; ++row) {
+      local_mat.Set(row, col,
+                    f(counter_bits(key, mat.GlobalRow(row), global_col)));
+    }
+  }
+}
+
+}  // namespace
+
 namespace lbann {
 
 rng_gen& get_generator() {
@@ -47,11 +103,25 @@ void init_random(int seed) {
     // Seed with a random value.
     std::random_device rd;
     unsigned rand_val = rd();
+    // The counter-based fills need the same seed on every rank.
+    if (El::mpi::Initialized()) {
+      El::mpi::Broadcast(&rand_val, 1, 0, El::mpi::COMM_WORLD);
+    }
     get_generator().seed(rand_val);
 #ifdef LBANN_SET_EL_RNG
     El::Generator().seed(rand_val);
 #endif
+    seed = (int) rand_val;
   }
+  ::fill_seed = mix64((uint64_t) (unsigned) seed);
+  ::fill_stream = 0;
+}
+
+void init_local_random(int seed) {
+  get_generator().seed(seed);
+#ifdef LBANN_SET_EL_RNG
+  El::Generator().seed(seed);
+#endif
 }
 
 void gaussian_fill(ElMat& mat, El::Int m, El::Int n, DataType mean,
@@ -59,37 +129,24 @@ void gaussian_fill(ElMat& mat, El::Int m, El::Int n, DataType mean,
 #ifdef LBANN_PARALLEL_RANDOM_MATRICES
   El::Gaussian(mat, m, n, mean, stddev);
 #else
-  mat.Resize(m, n);
-  if (mat.Grid().Rank() == 0) {
-    mat.Reserve(n * m);
-    auto& gen = get_generator();
-    std::normal_distribution<DataType> dist(mean, stddev);
-    for (int col = 0; col < n; ++col) {
-      for (int row = 0; row < m; ++row) {
-        mat.QueueUpdate(row, col, dist(gen));
-      }
-    }
-  }
-  mat.ProcessQueues();
+  // Box-Muller transform using two independent uniforms from the same bits.
+  const double two_pi = 2.0 * El::Pi<double>();
+  counter_fill(mat, m, n, [=] (uint64_t bits) {
+      const double u1 = ((bits >> 32) + 1.0) * (1.0 / 4294967296.0);  // (0, 1]
+      const double u2 = (bits & 0xFFFFFFFFULL) * (1.0 / 4294967296.0);  // [0, 1)
+      const double z = std::sqrt(-2.0 * std::log(u1)) * std::cos(two_pi * u2);
+      return (DataType) (mean + stddev * z);
+    });
 #endif  // LBANN_PARALLEL_RANDOM_MATRICES
 }
 
-void bernoulli_fill(ElMat& mat, El::Int m, El::Int n, DataType p) {
+void bernoulli_fill(ElMat& mat, El::Int m, El::Int n, double p) {
 #ifdef LBANN_PARALLEL_RANDOM_MATRICES
   El::Bernoulli(mat, m, n, p);
 #else
-  mat.Resize(m, n);
-  if (mat.Grid().Rank() == 0) {
-    mat.Reserve(m * n);
-    auto& gen = get_generator();
-    std::bernoulli_distribution dist(p);
-    for (int col = 0; col = n; ++col) {
-      for (int row = 0; row < m; ++row) {
-        mat.QueueUpdate(row, col, dist(gen) ? 1.0f : 0.0f);
-      }
-    }
-  }
-  mat.ProcessQueues();
+  counter_fill(mat, m, n, [=] (uint64_t bits) {
+      return bits_to_unit(bits) < p ? DataType(1) : DataType(0);
+    });
 #endif  // LBANN_PARALLEL_RANDOM_MATRICES  
 }
 
@@ -98,21 +155,10 @@ void uniform_fill(ElMat& mat, El::Int m, El::Int n, DataType center,
 #ifdef LBANN_PARALLEL_RANDOM_MATRICES
   El::Uniform(mat, m, n, center, radius);
 #else
-  mat.Resize(m, n);
-  if (mat.Grid().Rank() == 0) {
-    mat.Reserve(n * m);
-    auto& gen = get_generator();
-    std::uniform_real_distribution<DataType> dist(center - radius,
-                                                  center + radius);
-    for (int col = 0; col < n; ++col) {
-      for (int row = 0; row < m; ++row) {
-        mat.QueueUpdate(row, col, dist(gen));
-      }
-    }
-  }
-  mat.ProcessQueues();
+  counter_fill(mat, m, n, [=] (uint64_t bits) {
+      return (DataType) (center + radius * (2.0 * bits_to_unit(bits) - 1.0));
+    });
 #endif  // LBANN_PARALLEL_RANDOM_MATRICES
 }
 
 }  // namespace lbann
-